@@ -0,0 +1,452 @@
+#include "benchmark.h"
+#include "int_defs.h"
+#include "vector_defs.h"
+#include "keystream.h"
+#include "crc32c.h"
+#include "serialization.h"
+#include "rng.h"
+#include "memory.h"
+#include "parallel.h"
+#include "filesystem_interface.h"	// get_configuration, get_files_recursive
+#include <iostream>
+#include <format>
+#include <chrono>
+#include <random>
+#include <array>
+#include <algorithm>	// std::min, std::equal, std::clamp
+#include <limits>
+#include <thread>
+#include <cstdlib>		// std::malloc, std::free
+#include <atomic>
+#include <bit>			// std::bit_ceil
+#include <unordered_map>
+
+
+namespace diff::benchmark {
+
+	using clock = std::chrono::steady_clock;
+
+	// Best of a few runs, so one scheduler hiccup doesn't decide the result.
+	enum : std::size_t { repetitions = 5 };
+
+	template<typename F>
+	[[nodiscard]] static double best_seconds(F&& func) {
+		double best = std::numeric_limits<double>::max();
+		for (std::size_t i = 0; i < repetitions; ++i) {
+			const auto start{ clock::now() };
+			func();
+			best = std::min(best, std::chrono::duration<double>{ clock::now() - start }.count());
+		}
+		return best;
+	}
+
+	static void print_throughput(string_view label, const std::size_t byte_count, const double seconds) {
+		std::cout << std::format("  {:<24} {:>10.3f} ms {:>10.1f} MB/s\n"sv, label, seconds * 1000.0, (static_cast<double>(byte_count) / (1024.0 * 1024.0)) / seconds);
+	}
+
+
+	// Snapshot body encryption: the per-byte gamerand loop of versions 1-3 against the lane keystream of version 4.
+	static bool keystream_benchmark(const std::filesystem::path&) {
+		constexpr std::size_t byte_count = std::size_t{ 64 } * 1024 * 1024;
+
+		diff::vector<unsigned char> original(byte_count);
+		{
+			gamerand filler{ std::random_device{}() };
+			for (auto& byte : original) {
+				byte = static_cast<unsigned char>(filler.next());
+			}
+		}
+		diff::vector<unsigned char> work(original);
+		const u32 seed = std::random_device{}();
+
+		std::cout << std::format("Keystream: {} MB, best of {} runs.\n"sv, byte_count / (1024 * 1024), static_cast<std::size_t>(repetitions));
+
+		const double legacy_encrypt = best_seconds([&] { keystream::legacy{ seed }.encrypt(work.data(), work.size()); });
+		const double legacy_decrypt = best_seconds([&] { keystream::legacy{ seed }.decrypt(work.data(), work.size()); });
+		const bool legacy_ok = std::equal(work.begin(), work.end(), original.begin()); // Same number of encryptions and decryptions.
+
+		const double lanes_encrypt = best_seconds([&] { keystream::encrypt(work.data(), work.size(), 0, seed); });
+		const double lanes_decrypt = best_seconds([&] { keystream::decrypt(work.data(), work.size(), 0, seed); });
+		const bool lanes_ok = std::equal(work.begin(), work.end(), original.begin());
+
+		// Unaligned ranges must produce the same bytes as one whole pass.
+		keystream::encrypt(work.data(), work.size(), 0, seed);
+		for (std::size_t offset = 0, step = 1; offset < work.size(); offset += step, step = (step * 3) + 7) {
+			const std::size_t count = std::min(step, work.size() - offset);
+			keystream::decrypt(work.data() + offset, count, offset, seed);
+		}
+		const bool ranges_ok = std::equal(work.begin(), work.end(), original.begin());
+
+		print_throughput("legacy encrypt"sv, byte_count, legacy_encrypt);
+		print_throughput("legacy decrypt"sv, byte_count, legacy_decrypt);
+		print_throughput("lanes encrypt"sv, byte_count, lanes_encrypt);
+		print_throughput("lanes decrypt"sv, byte_count, lanes_decrypt);
+		std::cout << std::format("  Decrypt speedup: {:.1f}x\n"sv, legacy_decrypt / lanes_decrypt);
+
+		if (not (legacy_ok and lanes_ok and ranges_ok)) {
+			std::cout << std::format("  Round trip FAILED (legacy: {}, lanes: {}, ranges: {}).\n"sv, legacy_ok, lanes_ok, ranges_ok);
+			return false;
+		}
+		std::cout << "  Round trips OK.\n";
+		return true;
+	}
+
+
+	// Chunk checksums: one CRC-32C pass, and a full parallel verify of the same bytes with a footer.
+	static bool crc32c_benchmark(const std::filesystem::path&) {
+		constexpr std::size_t byte_count = std::size_t{ 256 } * 1024 * 1024;
+
+		dynamic_buffer buf{};
+		if (not buf.expand_for_extra(byte_count)) {
+			std::cout << "  Buffer allocation FAILED.\n";
+			return false;
+		}
+		{
+			gamerand filler{ std::random_device{}() };
+			for (std::size_t i = 0; i < byte_count; i += sizeof(u32)) {
+				const u32 value = filler.next();
+				(void)buf.write(value); // Reserved above.
+			}
+		}
+
+		std::cout << std::format("CRC-32C: {} MB, {}, {} hardware threads, best of {} runs.\n"sv, byte_count / (1024 * 1024), crc32c::hardware_accelerated() ? "CRC instructions"sv : "table fallback"sv, std::thread::hardware_concurrency(), static_cast<std::size_t>(repetitions));
+
+		// Standard check value for CRC-32C.
+		constexpr char check_input[]{ "123456789" };
+		const bool check_ok = crc32c::compute(check_input, sizeof(check_input) - 1) == 0xE3069283;
+
+		// The same bytes in uneven pieces must give the same CRC as one pass.
+		const u32 whole = crc32c::compute(buf.data(), buf.length());
+		u32 pieces = 0;
+		for (std::size_t offset = 0, step = 1; offset < buf.length(); offset += step, step = (step * 3) + 5) {
+			pieces = crc32c::update(pieces, buf.data() + offset, std::min(step, buf.length() - offset));
+		}
+		const bool pieces_ok = whole == pieces;
+
+		volatile u32 sink = 0;
+		const double single = best_seconds([&] { sink = crc32c::compute(buf.data(), buf.length()); });
+
+		if (not crc32c::append_footer(buf)) {
+			std::cout << "  Footer FAILED.\n";
+			return false;
+		}
+		bool verify_ok = true;
+		const double verify = best_seconds([&] { verify_ok = crc32c::verify(buf.data(), buf.length()).has_value() and verify_ok; });
+
+		buf.begin()[byte_count / 3] ^= 0x10;
+		const bool damage_found = not crc32c::verify(buf.data(), buf.length()).has_value();
+
+		print_throughput("one pass"sv, byte_count, single);
+		print_throughput("parallel verify"sv, byte_count, verify);
+
+		if (not (check_ok and pieces_ok and verify_ok and damage_found)) {
+			std::cout << std::format("  FAILED (check value: {}, pieces: {}, verify: {}, damage found: {}).\n"sv, check_ok, pieces_ok, verify_ok, damage_found);
+			return false;
+		}
+		std::cout << "  Checks OK.\n";
+		return true;
+	}
+
+
+	// Snapshot loading: decryption and decoding of a synthetic tree, split across as many threads as the hardware offers.
+	static bool deserialize_benchmark(const std::filesystem::path&) {
+		constexpr std::size_t file_count = std::size_t{ 2 } * 1000 * 1000;
+
+		diff::vector<file> files{};
+		files.reserve(file_count);
+		for (std::size_t i = 0; i < file_count; ++i) {
+			const std::filesystem::path relative{ std::format("Project {}/Sub {}/Part_{}.dat"sv, i / 5000, (i / 50) % 100, i) };
+			files.emplace_back(std::filesystem::path{ relative }, lowercase_path{ relative.parent_path() }, lowercase_path{ relative.filename() }, file::owner_name{ diff::u8string{ u8"owner" } }, i * 7, std::chrono::seconds{ static_cast<i64>(i) });
+		}
+		std::sort(files.begin(), files.end());
+
+		std::cout << std::format("Deserialize: {} files, {} hardware threads, best of {} runs.\n"sv, file_count, std::thread::hardware_concurrency(), static_cast<std::size_t>(repetitions));
+
+		// file::operator== only compares the sort key.
+		const auto same_file = [](const file& lhs, const file& rhs) noexcept {
+			return (lhs == rhs) and (lhs.original_path == rhs.original_path) and (lhs.owner == rhs.owner) and (lhs.size_in_bytes == rhs.size_in_bytes) and (lhs.last_write == rhs.last_write);
+		};
+
+		bool all_ok = true;
+		for (const bool encrypted : { false, true }) {
+			const auto encoded{ encrypted ? serialization::serialize_to_buffer_encrypted(files) : serialization::serialize_to_buffer_unencrypted(files) };
+			if (not encoded.has_value()) {
+				std::cout << "  Serialization FAILED.\n";
+				return false;
+			}
+
+			// Loading decrypts in place, so every run gets a fresh copy, made outside the timed part.
+			double best = std::numeric_limits<double>::max();
+			bool ok = true;
+			for (std::size_t i = 0; i < repetitions; ++i) {
+				dynamic_buffer copy{};
+				if (not copy.write(encoded.value().data(), encoded.value().length())) {
+					std::cout << "  Buffer copy FAILED.\n";
+					return false;
+				}
+				const auto start{ clock::now() };
+				const auto loaded{ serialization::deserialize_from_buffer(copy) };
+				best = std::min(best, std::chrono::duration<double>{ clock::now() - start }.count());
+				ok = ok and loaded.has_value() and std::equal(loaded.value().files.begin(), loaded.value().files.end(), files.begin(), files.end(), same_file);
+			}
+
+			print_throughput(encrypted ? "encrypted"sv : "plain"sv, encoded.value().length(), best);
+			std::cout << std::format("  {:<24} {:>10.0f} files/s\n"sv, "", static_cast<double>(file_count) / best);
+			if (not ok) {
+				std::cout << std::format("  Round trip FAILED ({}).\n"sv, encrypted ? "encrypted"sv : "plain"sv);
+			}
+			all_ok = all_ok and ok;
+		}
+		if (all_ok) {
+			std::cout << "  Round trips OK.\n";
+		}
+		return all_ok;
+	}
+
+
+	// Small allocations from several threads at once: the allocator's thread caches, its lock alone, and the system heap.
+	static bool allocation_benchmark(const std::filesystem::path&) {
+		// Capped, so runs on different machines stay comparable.
+		const std::size_t thread_count = std::clamp<std::size_t>(std::thread::hardware_concurrency(), 1, 8);
+		constexpr std::size_t live_blocks = 32;	// Per thread, replaced round robin.
+		constexpr std::size_t operations = std::size_t{ 2 } * 1000 * 1000;	// Per thread, each one a deallocation and an allocation.
+
+		std::cout << std::format("Allocation: {} threads, {} allocations each, best of {} runs.\n"sv, thread_count, operations, static_cast<std::size_t>(repetitions));
+
+		struct allocator {
+			string_view label;
+			void* (*allocate)(std::size_t);
+			void (*deallocate)(void*, std::size_t);
+		};
+		static constexpr std::array allocators{
+			allocator{ "system heap"sv, [](const std::size_t n) { return std::malloc(n); }, [](void* p, std::size_t) { std::free(p); } },
+			allocator{ "shared lock"sv, [](const std::size_t n) { return memory::allocate(n, memory::path::shared_lock); }, [](void* p, const std::size_t n) { memory::deallocate(p, n, memory::path::shared_lock); } },
+			allocator{ "thread caches"sv, [](const std::size_t n) { return memory::allocate(n, memory::path::thread_cache); }, [](void* p, const std::size_t n) { memory::deallocate(p, n, memory::path::thread_cache); } },
+		};
+
+		bool all_ok = true;
+		for (const auto& alloc : allocators) {
+			// Every block is stamped with its thread's index at both ends, so a block handed to two threads at once shows up when freed.
+			std::atomic<bool> ok{ true };
+			const auto task = [&alloc, &ok](const std::size_t task_idx) noexcept {
+				struct live_block {
+					unsigned char* ptr{ nullptr };
+					std::size_t size{ 0 };
+				};
+				std::array<live_block, live_blocks> blocks{};
+				gamerand sizes{ static_cast<u32>(task_idx) + 1 };
+				const auto stamp = static_cast<unsigned char>(task_idx + 1);
+				bool task_ok = true;
+				for (std::size_t i = 0; i < operations; ++i) {
+					live_block& slot = blocks[i % live_blocks];
+					if (slot.ptr != nullptr) {
+						task_ok = task_ok and (slot.ptr[0] == stamp) and (slot.ptr[slot.size - 1] == stamp);
+						alloc.deallocate(slot.ptr, slot.size);
+					}
+					slot.size = 1 + (sizes.next() % 128);	// Up to 128 bytes, the sizes the buckets and slabs serve.
+					slot.ptr = static_cast<unsigned char*>(alloc.allocate(slot.size));
+					if (slot.ptr == nullptr) {
+						task_ok = false;
+						continue;
+					}
+					slot.ptr[0] = stamp;
+					slot.ptr[slot.size - 1] = stamp;
+				}
+				for (const auto& slot : blocks) {
+					if (slot.ptr != nullptr) {
+						alloc.deallocate(slot.ptr, slot.size);
+					}
+				}
+				if (not task_ok) {
+					ok = false;
+				}
+			};
+
+			const double seconds = best_seconds([&] { run_tasks(thread_count, task); });
+			const double total = static_cast<double>(operations * thread_count);
+			std::cout << std::format("  {:<24} {:>10.3f} ms {:>10.1f} M allocs/s\n"sv, alloc.label, seconds * 1000.0, (total / seconds) / 1'000'000.0);
+			if (not ok) {
+				std::cout << std::format("  {} FAILED: a block was lost or shared between threads.\n"sv, alloc.label);
+			}
+			all_ok = all_ok and ok;
+		}
+		if (all_ok) {
+			std::cout << "  Checks OK.\n";
+		}
+		return all_ok;
+	}
+
+
+	// The allocator's buckets, fed the allocations of a real scan of the configured folder: first recorded, then replayed against each allocation path.
+	// Also suggests bucket sizes from the scan's peaks, for DIRDIFFER_BLOCK_COUNTS.
+	static bool buckets_benchmark(const std::filesystem::path& config_path) {
+		const auto config{ get_configuration(config_path) };
+		if (not config.has_value()) {
+			std::cout << std::format("  Needs a valid configuration at <{}>, for the folder to scan.\n"sv, config_path.string());
+			return false;
+		}
+
+		constexpr std::size_t max_events = std::size_t{ 1 } << 22;
+		diff::vector<memory::trace_event> events(max_events);
+		std::size_t event_count = 0;
+		std::size_t file_count = 0;
+		{
+			memory::start_trace(events);
+			{
+				auto files{ get_files_recursive(config.value()) };
+				if (files.has_value()) {
+					std::sort(files.value().begin(), files.value().end());
+					file_count = files.value().size();
+				}
+			}
+			event_count = memory::stop_trace();
+		}
+		if (file_count == 0) {
+			std::cout << std::format("  Scanning <{}> found nothing to trace.\n"sv, config.value().get_root().string());
+			return false;
+		}
+
+		// Turn pointers into slots, so the replay can free what it allocated in their place. Frees of blocks from before the trace are dropped.
+		struct replay_event {
+			u32 slot;
+			u32 byte_count;
+			bool freed;
+		};
+		diff::vector<replay_event> replay{};
+		replay.reserve(event_count);
+		u32 slot_count = 0;
+		std::array<std::size_t, memory::bucket_count> live{};
+		std::array<std::size_t, memory::bucket_count> peak{};
+		{
+			std::unordered_map<const void*, u32> slots{};
+			diff::vector<u32> free_slots{};
+			for (std::size_t i = 0; i < event_count; ++i) {
+				const auto& e = events[i];
+				const std::size_t bucket = (std::max<std::size_t>(e.byte_count, 1) + 15) / 16 - 1;
+				if (e.freed) {
+					const auto it = slots.find(e.ptr);
+					if (it == slots.end()) {
+						continue;
+					}
+					replay.push_back(replay_event{ it->second, e.byte_count, true });
+					free_slots.push_back(it->second);
+					slots.erase(it);
+					if (bucket < memory::bucket_count) {
+						--live[bucket];
+					}
+				}
+				else {
+					u32 slot = slot_count;
+					if (free_slots.empty()) {
+						++slot_count;
+					}
+					else {
+						slot = free_slots.back();
+						free_slots.pop_back();
+					}
+					slots[e.ptr] = slot;
+					replay.push_back(replay_event{ slot, e.byte_count, false });
+					if (bucket < memory::bucket_count) {
+						peak[bucket] = std::max(peak[bucket], ++live[bucket]);
+					}
+				}
+			}
+		}
+		events = {};
+
+		std::cout << std::format("Buckets: scan of {} files, {} allocation events{}, best of {} runs.\n"sv, file_count, replay.size(), event_count == max_events ? " (trace full)"sv : ""sv, static_cast<std::size_t>(repetitions));
+
+		struct allocator {
+			string_view label;
+			void* (*allocate)(std::size_t);
+			void (*deallocate)(void*, std::size_t);
+		};
+		static constexpr std::array allocators{
+			allocator{ "system heap"sv, [](const std::size_t n) { return std::malloc(n); }, [](void* p, std::size_t) { std::free(p); } },
+			allocator{ "shared lock"sv, [](const std::size_t n) { return memory::allocate(n, memory::path::shared_lock); }, [](void* p, const std::size_t n) { memory::deallocate(p, n, memory::path::shared_lock); } },
+			allocator{ "thread cache"sv, [](const std::size_t n) { return memory::allocate(n, memory::path::thread_cache); }, [](void* p, const std::size_t n) { memory::deallocate(p, n, memory::path::thread_cache); } },
+		};
+
+		bool ok = true;
+		diff::vector<void*> ptrs(slot_count, nullptr);
+		diff::vector<u32> sizes(slot_count, 0);
+		for (const auto& alloc : allocators) {
+			const double seconds = best_seconds([&] {
+				for (const auto& e : replay) {
+					if (e.freed) {
+						alloc.deallocate(ptrs[e.slot], e.byte_count);
+						ptrs[e.slot] = nullptr;
+					}
+					else {
+						ptrs[e.slot] = alloc.allocate(e.byte_count);
+						sizes[e.slot] = e.byte_count;
+						ok = ok and ((ptrs[e.slot] != nullptr) or (e.byte_count == 0));
+					}
+				}
+				// What the scan left alive, which its caller would free later.
+				for (std::size_t i = 0; i < ptrs.size(); ++i) {
+					if (ptrs[i] != nullptr) {
+						alloc.deallocate(ptrs[i], sizes[i]);
+						ptrs[i] = nullptr;
+					}
+				}
+			});
+			std::cout << std::format("  {:<24} {:>10.3f} ms {:>10.1f} M events/s\n"sv, alloc.label, seconds * 1000.0, (static_cast<double>(replay.size()) / seconds) / 1'000'000.0);
+		}
+
+		std::cout << "  Blocks live at once, against bucket sizes:\n";
+		std::string suggested{};
+		for (std::size_t i = 0; i < memory::bucket_count; ++i) {
+			const std::size_t fitting = std::clamp<std::size_t>(std::bit_ceil(std::max<std::size_t>(peak[i], 1)), 64, 4096);
+			std::cout << std::format("  {:>3} bytes: peak {:>6}, bucket {:>5}\n"sv, (i + 1) * 16, peak[i], memory::bucket_block_counts[i]);
+			suggested += std::format("{}{}"sv, i == 0 ? ""sv : ","sv, fitting);
+		}
+		std::cout << std::format("  To fit this scan: DIRDIFFER_BLOCK_COUNTS={}\n"sv, suggested);
+
+		if (not ok) {
+			std::cout << "  Replay FAILED: an allocation returned null.\n";
+		}
+		return ok;
+	}
+
+
+	struct named_benchmark {
+		string_view name;
+		bool (*func)(const std::filesystem::path& config_path);
+	};
+
+	static constexpr std::array benchmarks{
+		named_benchmark{ "keystream"sv, keystream_benchmark },
+		named_benchmark{ "crc32c"sv, crc32c_benchmark },
+		named_benchmark{ "deserialize"sv, deserialize_benchmark },
+		named_benchmark{ "allocation"sv, allocation_benchmark },
+		named_benchmark{ "buckets"sv, buckets_benchmark },
+	};
+
+
+	bool run(string_view name, const std::filesystem::path& config_path) noexcept {
+		try {
+			for (const auto& b : benchmarks) {
+				if (b.name == name) {
+					return b.func(config_path);
+				}
+			}
+			std::cout << "Unknown benchmark \"" << name << "\".\n";
+			list();
+			return false;
+		}
+		catch (...) {
+			std::cout << "Benchmark \"" << name << "\" failed with an exception.\n";
+			return false;
+		}
+	}
+
+	void list() noexcept {
+		std::cout << "Available benchmarks:";
+		for (const auto& b : benchmarks) {
+			std::cout << ' ' << b.name;
+		}
+		std::cout << '\n';
+	}
+
+}
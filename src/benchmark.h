@@ -0,0 +1,15 @@
+#pragma once
+#include "string_defs.h"
+#include <filesystem>
+
+
+namespace diff::benchmark {
+
+	// Runs the named benchmark and prints its results to the console. Returns false for unknown names or if the benchmark failed.
+	// Benchmarks that work on real data read the configuration at config_path, for the folder to scan.
+	[[nodiscard]] bool run(string_view name, const std::filesystem::path& config_path) noexcept;
+
+	// Prints the names run() accepts.
+	void list() noexcept;
+
+}
@@ -0,0 +1,239 @@
+#include "chunked_writer.h"
+#include "logger.h"
+#include "vector_defs.h"
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <array>
+#include <algorithm>	// std::min, std::max
+#include <cstring>		// std::memcpy
+
+
+namespace diff {
+
+	// Owns the file, both chunks, and the thread that encrypts, checksums and writes them.
+	class chunked_file_writer::writer_thread {
+	public:
+		// Throws if allocating the chunks or starting the thread fails.
+		explicit writer_thread(std::ofstream&& out, const std::filesystem::path& out_path, const std::optional<u32> seed, const u64 prefix, const bool checksum)
+			: chunks{ std::make_unique_for_overwrite<unsigned char[]>(chunk_length), std::make_unique_for_overwrite<unsigned char[]>(chunk_length) }
+			, ofs{ std::move(out) }
+			, path{ out_path }
+			, encryption_seed{ seed }
+			, plain_prefix{ prefix }
+			, checksummed{ checksum }
+			, thread{ [this] { run(); } }
+		{}
+
+		~writer_thread() noexcept {
+			(void)stop();
+		}
+
+		writer_thread(const writer_thread&) = delete;
+		writer_thread(writer_thread&&) = delete;
+		writer_thread& operator=(const writer_thread&) = delete;
+		writer_thread& operator=(writer_thread&&) = delete;
+
+		[[nodiscard]] unsigned char* first_chunk() noexcept { return chunks[0].get(); }
+
+		// Queues [data, data + length), which starts stream_offset bytes into the file, and returns the chunk to continue in.
+		// Blocks until the previously queued chunk is written, since that is the one returned. Returns nullptr if any write has failed.
+		[[nodiscard]] unsigned char* submit(unsigned char* data, const std::size_t length, const u64 stream_offset) noexcept {
+			{
+				std::unique_lock lock{ mutex };
+				idle_cv.wait(lock, [this] { return not busy; });
+				if (failed) {
+					return nullptr;
+				}
+				pending = data;
+				pending_length = length;
+				pending_offset = stream_offset;
+				busy = true;
+			}
+			work_cv.notify_one();
+			return (data == chunks[0].get()) ? chunks[1].get() : chunks[0].get();
+		}
+
+		// Waits for the last queued chunk, ends the thread, and closes the file. Safe to call more than once.
+		// The checksum footer is only written if sealing, so a file abandoned midway never looks complete.
+		[[nodiscard]] bool stop(const bool seal = false) noexcept {
+			if (thread.joinable()) {
+				{
+					std::lock_guard lock{ mutex };
+					stopping = true;
+				}
+				work_cv.notify_one();
+				thread.join();
+			}
+			if (seal and checksummed and ofs.is_open() and not failed) {
+				failed = not write_footer();
+			}
+			if (ofs.is_open()) {
+				try {
+					ofs.close();
+				}
+				catch (...) {}
+				if (ofs.fail()) {
+					log::error("Chunked Writer: Failed to close <{}>."sv, path.string());
+					failed = true;
+				}
+			}
+			return not failed;
+		}
+
+	private:
+		std::array<std::unique_ptr<unsigned char[]>, 2> chunks;
+		std::ofstream ofs;
+		std::filesystem::path path;
+		std::optional<u32> encryption_seed;
+		u64 plain_prefix;
+		bool checksummed;
+		diff::vector<u32> chunk_crcs{};	// Only touched by the thread, and by stop() once it has ended.
+		u64 written{ 0 };
+
+		std::mutex mutex{};
+		std::condition_variable work_cv{};
+		std::condition_variable idle_cv{};
+		unsigned char* pending{ nullptr };
+		std::size_t pending_length{ 0 };
+		u64 pending_offset{ 0 };
+		bool busy{ false };
+		bool stopping{ false };
+		bool failed{ false };
+
+		std::thread thread; // Last, so it starts after everything it touches is initialized.
+
+		void run() noexcept {
+			while (true) {
+				unsigned char* data{ nullptr };
+				std::size_t length = 0;
+				u64 offset = 0;
+				{
+					std::unique_lock lock{ mutex };
+					work_cv.wait(lock, [this] { return busy or stopping; });
+					if (not busy) {
+						return; // Stopping, and nothing left to write.
+					}
+					data = pending;
+					length = pending_length;
+					offset = pending_offset;
+				}
+
+				const bool ok = write_out(data, length, offset);
+
+				{
+					std::lock_guard lock{ mutex };
+					failed = failed or not ok;
+					busy = false;
+				}
+				idle_cv.notify_one();
+			}
+		}
+
+		[[nodiscard]] bool write_out(unsigned char* data, const std::size_t length, const u64 offset) noexcept {
+			if (encryption_seed.has_value() and ((offset + length) > plain_prefix)) {
+				const u64 encrypt_from = std::max(offset, plain_prefix);
+				const std::size_t skip = static_cast<std::size_t>(encrypt_from - offset);
+				keystream::encrypt(data + skip, length - skip, encrypt_from - plain_prefix, encryption_seed.value());
+			}
+			if (checksummed) {
+				try {
+					chunk_crcs.push_back(crc32c::compute(data, length)); // Every chunk but the last is full, so these line up with checksum chunks.
+				}
+				catch (...) {
+					log::error("Chunked Writer: Failed to allocate space for the checksum of the chunk at offset <{}> of <{}>."sv, offset, path.string());
+					return false;
+				}
+			}
+			try {
+				if (not ofs.write(reinterpret_cast<const char*>(data), length)) {
+					log::error("Chunked Writer: Failed to write <{}> bytes at offset <{}> of <{}>."sv, length, offset, path.string());
+					return false;
+				}
+				written += length;
+				return true;
+			}
+			catch (std::exception& ex) {
+				log::error("Chunked Writer: Exception thrown while writing <{}>: {}"sv, path.string(), ex.what());
+				return false;
+			}
+		}
+
+		[[nodiscard]] bool write_footer() noexcept {
+			try {
+				diff::vector<unsigned char> footer(static_cast<std::size_t>(crc32c::footer_length(chunk_crcs.size())));
+				crc32c::encode_footer(chunk_crcs.data(), chunk_crcs.size(), written, footer.data());
+				if (not ofs.write(reinterpret_cast<const char*>(footer.data()), footer.size())) {
+					log::error("Chunked Writer: Failed to write the checksum footer of <{}>."sv, path.string());
+					return false;
+				}
+				return true;
+			}
+			catch (...) {
+				log::error("Chunked Writer: Failed to write the checksum footer of <{}>."sv, path.string());
+				return false;
+			}
+		}
+	};
+
+
+	chunked_file_writer::chunked_file_writer(std::unique_ptr<writer_thread>&& init) noexcept
+		: worker{ std::move(init) }
+		, chunk{ worker->first_chunk() }
+	{}
+	chunked_file_writer::chunked_file_writer(chunked_file_writer&&) noexcept = default;
+	chunked_file_writer& chunked_file_writer::operator=(chunked_file_writer&&) noexcept = default;
+	chunked_file_writer::~chunked_file_writer() noexcept = default;
+
+
+	std::optional<chunked_file_writer> chunked_file_writer::open(const std::filesystem::path& file_path, const std::optional<u32> encryption_seed, const u64 plain_prefix, const bool checksummed) noexcept {
+		try {
+			std::ofstream ofs{ file_path, std::ios::binary | std::ios::trunc };
+			if (not ofs.is_open()) {
+				log::error("Chunked Writer: Failed to open file <{}>."sv, file_path.string());
+				return std::nullopt;
+			}
+			return chunked_file_writer{ std::make_unique<writer_thread>(std::move(ofs), file_path, encryption_seed, plain_prefix, checksummed) };
+		}
+		catch (std::exception& ex) {
+			log::error("Chunked Writer: Failed to set up writing to <{}>: {}"sv, file_path.string(), ex.what());
+			return std::nullopt;
+		}
+	}
+
+	bool chunked_file_writer::write(const void* src, std::size_t byte_count) noexcept {
+		const unsigned char* from = static_cast<const unsigned char*>(src);
+		while (byte_count != 0) {
+			if ((fill == chunk_length) and not flush_chunk()) {
+				return false;
+			}
+			const std::size_t count = std::min(byte_count, chunk_length - fill);
+			std::memcpy(chunk + fill, from, count);
+			fill += count;
+			from += count;
+			byte_count -= count;
+		}
+		return true;
+	}
+
+	bool chunked_file_writer::flush_chunk() noexcept {
+		unsigned char* next = worker->submit(chunk, fill, flushed);
+		if (next == nullptr) {
+			return false;
+		}
+		chunk = next;
+		flushed += fill;
+		fill = 0;
+		return true;
+	}
+
+	bool chunked_file_writer::finish() noexcept {
+		if ((fill != 0) and not flush_chunk()) {
+			(void)worker->stop();
+			return false;
+		}
+		return worker->stop(true);
+	}
+
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include "int_defs.h"
+#include "string_defs.h"
+#include "varint.h"
+#include "keystream.h"
+#include "crc32c.h"
+#include "dynamic_buffer.h"	// string_type
+#include <filesystem>
+#include <optional>
+#include <memory>
+#include <type_traits>
+
+
+namespace diff {
+
+	// Same write interface as dynamic_buffer, but output goes to a file in fixed-size chunks instead of one growing buffer.
+	// Two chunks are used in turns. While one is being filled, a background thread encrypts and writes the other, so encoding overlaps with disk I/O.
+	// Nothing is guaranteed to be on disk until finish() returns true. If finish() is never called, or fails, the file is left incomplete.
+	class chunked_file_writer {
+	public:
+		enum : std::size_t { chunk_length = std::size_t{ 1024 } * 1024 };
+		static_assert((chunk_length % keystream::segment_length) == 0, "Chunks should cover whole keystream segments.");
+		static_assert(chunk_length == crc32c::chunk_length, "Chunks are checksummed as they are written, so they must match checksum chunks.");
+
+		chunked_file_writer() = delete;
+		chunked_file_writer(chunked_file_writer&&) noexcept;
+		chunked_file_writer& operator=(chunked_file_writer&&) noexcept;
+		~chunked_file_writer() noexcept;
+		chunked_file_writer(const chunked_file_writer&) = delete;
+		chunked_file_writer& operator=(const chunked_file_writer&) = delete;
+
+		// Creates or truncates file_path. If encryption_seed is given, everything past the first plain_prefix bytes is encrypted with the lane keystream on its way to disk.
+		// If checksummed, every chunk is checksummed as it is written out, and finish() ends the file with a crc32c footer.
+		[[nodiscard]] static std::optional<chunked_file_writer> open(const std::filesystem::path& file_path, std::optional<u32> encryption_seed, u64 plain_prefix, bool checksummed) noexcept;
+
+		[[nodiscard]] bool write(const void* src, std::size_t byte_count) noexcept;
+
+		template<typename T> requires (std::is_trivially_copyable_v<T> and not std::is_pointer_v<T>)
+		[[nodiscard]] bool write(const T& val) noexcept {
+			return write(std::addressof(val), sizeof(T));
+		}
+
+		[[nodiscard]] bool write_varint(const u64 val) noexcept {
+			if ((chunk_length - fill) >= varint::max_u64_bytes) {
+				fill += varint::encode(val, chunk + fill);
+				return true;
+			}
+			unsigned char encoded[varint::max_u64_bytes]{};
+			return write(encoded, varint::encode(val, encoded));
+		}
+
+		template<typename CharT>
+		[[nodiscard]] bool write_varint_string(std::basic_string_view<CharT> val) noexcept {
+			return write_varint(static_cast<u64>(val.length())) and write(val.data(), val.length() * sizeof(CharT));
+		}
+		template<string_type S>
+		[[nodiscard]] bool write_varint_string(const S& val) noexcept {
+			return write_varint_string(std::basic_string_view<typename S::value_type>{ val.data(), val.length() });
+		}
+
+		// Total bytes written so far, i.e. the offset of the next byte in the file.
+		[[nodiscard]] u64 position() const noexcept { return flushed + fill; }
+
+		// Writes out what is left, waits for the background thread, and closes the file. Returns false if any write failed along the way.
+		[[nodiscard]] bool finish() noexcept;
+
+	private:
+		class writer_thread;
+		std::unique_ptr<writer_thread> worker;
+		unsigned char* chunk{ nullptr };	// Owned by worker.
+		std::size_t fill{ 0 };
+		u64 flushed{ 0 };
+
+		explicit chunked_file_writer(std::unique_ptr<writer_thread>&& init) noexcept;
+
+		// Hands the current chunk to the background thread and continues in the other one.
+		[[nodiscard]] bool flush_chunk() noexcept;
+	};
+
+}
@@ -1,6 +1,6 @@
 #include "configuration.h"
 #include "logger.h"
-#include "string_utils.h"		// split, make_lowercase, ul_parse
+#include "string_utils.h"		// split, make_lowercase, make_portable_separators, ul_parse
 
 
 namespace diff {
@@ -16,6 +16,10 @@ namespace diff {
 				file_extensions,
 				excluded_folders,
 				min_depth,
+				history_size,
+				empty_report,
+				log_level,
+				metrics_file,
 				email_from,
 				email_to,
 				email_cc,
@@ -68,6 +72,10 @@ namespace diff {
 					else if (val.str == u8"<file extensions>")	{ current_category = line::value_of::file_extensions; }
 					else if (val.str == u8"<excluded folders>")	{ current_category = line::value_of::excluded_folders; }
 					else if (val.str == u8"<min depth>")		{ current_category = line::value_of::min_depth; }
+					else if (val.str == u8"<history size>")		{ current_category = line::value_of::history_size; }
+					else if (val.str == u8"<empty report>")		{ current_category = line::value_of::empty_report; }
+					else if (val.str == u8"<log level>")		{ current_category = line::value_of::log_level; }
+					else if (val.str == u8"<metrics file>")		{ current_category = line::value_of::metrics_file; }
 					else if (val.str == u8"<email from>")		{ current_category = line::value_of::email_from; }
 					else if (val.str == u8"<email to>")			{ current_category = line::value_of::email_to; }
 					else if (val.str == u8"<email cc>")			{ current_category = line::value_of::email_cc; }
@@ -91,6 +99,10 @@ namespace diff {
 		// <file extensions>	MULTIPLE
 		// <excluded folders>	MULTIPLE	OPTIONAL
 		// <min depth>			SINGLE
+		// <history size>		SINGLE		OPTIONAL
+		// <empty report>		SINGLE		OPTIONAL
+		// <log level>			SINGLE		OPTIONAL
+		// <metrics file>		SINGLE		OPTIONAL
 		// <email from>			SINGLE
 		// <email to>			SINGLE
 		// <email cc>			MULTIPLE	OPTIONAL
@@ -100,6 +112,10 @@ namespace diff {
 		
 		bool root_found = false;
 		bool depth_found = false;
+		bool history_found = false;
+		bool empty_report_found = false;
+		bool log_level_found = false;
+		bool metrics_file_found = false;
 		bool from_found = false;
 		bool to_found = false;
 		bool subject_found = false;
@@ -238,6 +254,7 @@ namespace diff {
 				if ((ln.str.front() == u8'\\') bitor (ln.str.front() == u8'/')) {
 					ln.str.erase(ln.str.begin());
 				}
+				make_portable_separators(ln.str); // Compared against the '/' separated folders of scanned files.
 				lowercase_path excl{ std::move(ln.str) };
 				if (std::find(ret.excluded_folders.begin(), ret.excluded_folders.end(), excl) != ret.excluded_folders.end()) {
 					log::warning("Config Parse: Duplicate excluded folder at line <{}> was ignored."sv, ln.source_line);
@@ -260,6 +277,58 @@ namespace diff {
 				}
 				break;
 			}
+			case line::history_size: {
+				if (const i64 parsed = ul_parse(ln.str); parsed < 0) {
+					log::warning("Config Parse: Could not parse <history size> value at line <{}> as number."sv, ln.source_line);
+				}
+				else {
+					ret.history_size = static_cast<u32>(parsed);
+					if (history_found) {
+						log::warning("Config Parse: Definition of <history size> at line <{}> overrides previous one."sv, ln.source_line);
+					}
+					history_found = true;
+				}
+				break;
+			}
+			case line::empty_report: {
+				make_lowercase(ln.str);
+				if (ln.str == u8"send")			{ ret.empty_report = empty_report_policy::send; }
+				else if (ln.str == u8"skip")	{ ret.empty_report = empty_report_policy::skip; }
+				else if (ln.str == u8"batch")	{ ret.empty_report = empty_report_policy::batch; }
+				else {
+					log::warning("Config Parse: <empty report> value at line <{}> is not one of send, skip or batch, and was ignored."sv, ln.source_line);
+					break;
+				}
+				if (empty_report_found) {
+					log::warning("Config Parse: Definition of <empty report> at line <{}> overrides previous one."sv, ln.source_line);
+				}
+				empty_report_found = true;
+				break;
+			}
+			case line::log_level: {
+				make_lowercase(ln.str);
+				if (ln.str == u8"info")				{ ret.log_level = log::sev_info; }
+				else if (ln.str == u8"warning")		{ ret.log_level = log::sev_warning; }
+				else if (ln.str == u8"error")		{ ret.log_level = log::sev_error; }
+				else if (ln.str == u8"critical")	{ ret.log_level = log::sev_critical; }
+				else {
+					log::warning("Config Parse: <log level> value at line <{}> is not one of info, warning, error or critical, and was ignored."sv, ln.source_line);
+					break;
+				}
+				if (log_level_found) {
+					log::warning("Config Parse: Definition of <log level> at line <{}> overrides previous one."sv, ln.source_line);
+				}
+				log_level_found = true;
+				break;
+			}
+			case line::metrics_file: {
+				ret.metrics_file = ln.str;
+				if (metrics_file_found) {
+					log::warning("Config Parse: Definition of <metrics file> at line <{}> overrides previous one."sv, ln.source_line);
+				}
+				metrics_file_found = true;
+				break;
+			}
 			case line::email_from: {
 				if (not is_valid_email(ln.str)) {
 					log::warning("Config Parse: Invalid <email from> address at line <{}> was ignored."sv, ln.source_line);
@@ -361,7 +430,7 @@ namespace diff {
 
 			if ((excl_ref.length() < in_ref.length()) and (in_ref.find_first_of(excl_ref) == 0)) {
 				const auto char_after_excl = in_ref[excl_ref.length()];
-				if ((char_after_excl == u8'\\') bitor (char_after_excl == u8'/')) {
+				if (char_after_excl == u8'/') {
 					return true; // Input is a subdirectory of this excluded folder.
 				}
 			}
@@ -394,6 +463,19 @@ namespace diff {
 
 		ret += u8"\tMinimum Depth: <" + u8asd + u8">\n";
 
+		const std::string history_str = std::to_string(history_size);
+		ret += u8"\tHistory Size: <" + diff::u8string{ history_str.begin(), history_str.end() } + u8">\n";
+
+		ret += u8"\tEmpty Report: <";
+		ret += (empty_report == empty_report_policy::skip) ? u8"skip" : (empty_report == empty_report_policy::batch) ? u8"batch" : u8"send";
+		ret += u8">\n";
+
+		ret += u8"\tLog Level: <";
+		ret += (log_level == log::sev_critical) ? u8"critical" : (log_level == log::sev_error) ? u8"error" : (log_level == log::sev_warning) ? u8"warning" : u8"info";
+		ret += u8">\n";
+
+		ret += u8"\tMetrics File: <" + metrics_file.u8string() + u8">\n";
+
 		ret += u8"\tExtensions:\n";
 		for (const auto& ext : extensions) {
 			ret += u8"\t\t" + ext.str_cref() + u8'\n';
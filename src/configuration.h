@@ -6,6 +6,7 @@
 #include <filesystem>
 #include "lowercase_path.h"
 #include "smtp.h"
+#include "logger.h"
 
 #include "winapi_funcs.h"
 
@@ -15,6 +16,13 @@ namespace diff {
 	public:
 		static std::optional<configuration> parse_file_contents(const u8string& contents) noexcept;
 		
+		// What to do with the report of a run that found nothing created or deleted.
+		enum class empty_report_policy : u32 {
+			send,	// Send it like any other.
+			skip,	// Never send it.
+			batch	// Only send it once no report has gone out for a while, so quiet stretches still get word now and then.
+		};
+		
 		constexpr configuration() noexcept = default;
 		constexpr configuration(const configuration&) = default;
 		constexpr configuration(configuration&&) noexcept = default;
@@ -26,6 +34,14 @@ namespace diff {
 		
 		[[nodiscard]] u32 get_min_depth() const noexcept { return min_depth; }
 		
+		[[nodiscard]] u32 get_history_size() const noexcept { return history_size; }
+		
+		[[nodiscard]] empty_report_policy get_empty_report() const noexcept { return empty_report; }
+		
+		[[nodiscard]] log::severity get_log_level() const noexcept { return log_level; }
+		
+		[[nodiscard]] const std::filesystem::path& get_metrics_file() const noexcept { return metrics_file; }
+		
 		[[nodiscard]] const email_metadata& get_email_metadata() const noexcept { return email; }
 
 		[[nodiscard]] bool folder_is_excluded(const lowercase_path& folder_path) const noexcept;
@@ -41,6 +57,10 @@ namespace diff {
 		diff::vector<lowercase_path> extensions{};
 		diff::vector<lowercase_path> excluded_folders{}; // Relative to root.
 		u32 min_depth{};
+		u32 history_size{ 30 }; // Past runs to keep. 0 keeps none.
+		empty_report_policy empty_report{ empty_report_policy::send };
+		log::severity log_level{ log::sev_info }; // Least severe messages written to the log.
+		std::filesystem::path metrics_file{}; // Where each run's metrics are written as JSON. Empty writes none. Relative paths are relative to the executable.
 		email_metadata email{};
 	};
 	
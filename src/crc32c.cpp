@@ -0,0 +1,229 @@
+#include "crc32c.h"
+#include "parallel.h"
+#include "logger.h"
+#include "vector_defs.h"
+#include <array>
+#include <cstring>	// std::memcpy
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define DIRDIFFER_CRC32C_SSE42
+#include <nmmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>		// __cpuid
+#define DIRDIFFER_CRC32C_TARGET
+#else
+#include <cpuid.h>		// __get_cpuid
+#define DIRDIFFER_CRC32C_TARGET __attribute__((target("sse4.2")))
+#endif
+#elif defined(__ARM_FEATURE_CRC32)
+#define DIRDIFFER_CRC32C_ARMV8
+#include <arm_acle.h>
+#endif
+
+
+namespace diff::crc32c {
+
+	// Slicing-by-8 tables for the reflected Castagnoli polynomial. tables[0] is the classic byte-at-a-time table, and tables[k] advances it by k more zero bytes.
+	struct lookup_tables {
+		enum : u32 { polynomial = 0x82F63B78 };
+
+		constexpr lookup_tables() noexcept {
+			for (u32 i = 0; i < 256; ++i) {
+				u32 crc = i;
+				for (int bit = 0; bit < 8; ++bit) {
+					crc = (crc >> 1) ^ ((crc & 1) ? u32{ polynomial } : u32{ 0 });
+				}
+				tables[0][i] = crc;
+			}
+			for (u32 i = 0; i < 256; ++i) {
+				for (std::size_t k = 1; k < tables.size(); ++k) {
+					tables[k][i] = (tables[k - 1][i] >> 8) ^ tables[0][tables[k - 1][i] & 0xFF];
+				}
+			}
+		}
+
+		std::array<std::array<u32, 256>, 8> tables{};
+	};
+	static constexpr lookup_tables lookup{};
+
+	// crc is the raw register, i.e. already inverted.
+	[[nodiscard]] static u32 update_software(u32 crc, const unsigned char* data, std::size_t length) noexcept {
+		const auto& t = lookup.tables;
+		for (; length >= 8; data += 8, length -= 8) {
+			u32 low = 0;
+			u32 high = 0;
+			std::memcpy(&low, data, sizeof(u32));
+			std::memcpy(&high, data + sizeof(u32), sizeof(u32));
+			low ^= crc;
+			crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24]
+				^ t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF] ^ t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+		}
+		for (; length != 0; ++data, --length) {
+			crc = (crc >> 8) ^ t[0][(crc ^ *data) & 0xFF];
+		}
+		return crc;
+	}
+
+#if defined(DIRDIFFER_CRC32C_SSE42)
+	DIRDIFFER_CRC32C_TARGET [[nodiscard]] static u32 update_hardware(u32 crc, const unsigned char* data, std::size_t length) noexcept {
+		u64 crc64 = crc;
+		for (; length >= sizeof(u64); data += sizeof(u64), length -= sizeof(u64)) {
+			u64 word = 0;
+			std::memcpy(&word, data, sizeof(u64));
+			crc64 = _mm_crc32_u64(crc64, word);
+		}
+		crc = static_cast<u32>(crc64);
+		for (; length != 0; ++data, --length) {
+			crc = _mm_crc32_u8(crc, *data);
+		}
+		return crc;
+	}
+
+	[[nodiscard]] static bool detect_hardware() noexcept {
+#if defined(_MSC_VER)
+		int info[4]{};
+		__cpuid(info, 1);
+		const unsigned int ecx = static_cast<unsigned int>(info[2]);
+#else
+		unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+		if (not __get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+			return false;
+		}
+#endif
+		return (ecx & (1u << 20)) != 0; // SSE4.2
+	}
+#elif defined(DIRDIFFER_CRC32C_ARMV8)
+	[[nodiscard]] static u32 update_hardware(u32 crc, const unsigned char* data, std::size_t length) noexcept {
+		for (; length >= sizeof(u64); data += sizeof(u64), length -= sizeof(u64)) {
+			u64 word = 0;
+			std::memcpy(&word, data, sizeof(u64));
+			crc = __crc32cd(crc, word);
+		}
+		for (; length != 0; ++data, --length) {
+			crc = __crc32cb(crc, *data);
+		}
+		return crc;
+	}
+
+	[[nodiscard]] static bool detect_hardware() noexcept { return true; } // Only defined when the target guarantees the instructions.
+#else
+	[[nodiscard]] static u32 update_hardware(u32 crc, const unsigned char* data, std::size_t length) noexcept { return update_software(crc, data, length); }
+	[[nodiscard]] static bool detect_hardware() noexcept { return false; }
+#endif
+
+	bool hardware_accelerated() noexcept {
+		static const bool available = detect_hardware();
+		return available;
+	}
+
+	u32 update(const u32 crc, const void* const data, const std::size_t length) noexcept {
+		const unsigned char* const bytes = static_cast<const unsigned char*>(data);
+		return ~(hardware_accelerated() ? update_hardware(~crc, bytes, length) : update_software(~crc, bytes, length));
+	}
+
+
+	// Once the footer is found, chunks are checked this many at a time per thread at least.
+	enum : u64 { min_chunks_per_verify_task = 8 };
+
+	// Fixed part of the footer, after the chunk CRCs.
+	struct footer_tail {
+		u64 covered_length{ 0 };
+		u32 chunk_length{ 0 };
+		u32 footer_crc{ 0 };
+	};
+	static_assert(sizeof(footer_tail) == (footer_length(0)), "Footer tail must have no padding.");
+
+	void encode_footer(const u32* const crcs, const std::size_t count, const u64 covered_length, unsigned char* const out) noexcept {
+		const std::size_t crcs_length = count * sizeof(u32);
+		std::memcpy(out, crcs, crcs_length);
+		footer_tail tail{ covered_length, static_cast<u32>(chunk_length), 0 };
+		std::memcpy(out + crcs_length, &tail, sizeof(u64) + sizeof(u32));
+		tail.footer_crc = compute(out, crcs_length + sizeof(u64) + sizeof(u32));
+		std::memcpy(out + crcs_length, &tail, sizeof(footer_tail));
+	}
+
+	bool append_footer(dynamic_buffer& buf) noexcept {
+		const u64 covered_length = buf.length();
+		const u64 count = chunk_count(covered_length);
+		const std::size_t length = static_cast<std::size_t>(footer_length(count));
+
+		diff::vector<u32> crcs{};
+		diff::vector<unsigned char> footer{};
+		try {
+			crcs.resize(static_cast<std::size_t>(count));
+			footer.resize(length);
+		}
+		catch (...) {
+			log::error("Checksum: Failed to allocate space for <{}> chunk checksums."sv, count);
+			return false;
+		}
+		const unsigned char* const data = buf.data();
+		for (u64 i = 0; i < count; ++i) {
+			const u64 offset = i * chunk_length;
+			crcs[static_cast<std::size_t>(i)] = compute(data + offset, static_cast<std::size_t>(std::min<u64>(chunk_length, covered_length - offset)));
+		}
+		encode_footer(crcs.data(), crcs.size(), covered_length, footer.data());
+
+		if (not buf.reposition(static_cast<std::size_t>(covered_length)) or not buf.write(footer.data(), footer.size())) {
+			log::error("Checksum: Failed to append a <{}> byte footer."sv, length);
+			return false;
+		}
+		return true;
+	}
+
+	std::optional<verified_range> verify(const unsigned char* const data, const std::size_t length) noexcept {
+		footer_tail tail{};
+		if (length < sizeof(footer_tail)) {
+			log::error("Checksum: <{}> bytes are too few to end in a checksum footer."sv, length);
+			return std::nullopt;
+		}
+		std::memcpy(&tail, data + length - sizeof(footer_tail), sizeof(footer_tail));
+
+		const u64 room = length - sizeof(footer_tail);
+		const u64 count = (tail.chunk_length != 0) ? ((tail.covered_length + tail.chunk_length - 1) / tail.chunk_length) : 0;
+		if ((tail.chunk_length == 0) or (tail.covered_length > room) or ((room - tail.covered_length) != (count * sizeof(u32)))) {
+			log::error("Checksum: Footer does not fit the <{}> bytes it ends. The data is truncated or was never checksummed."sv, length);
+			return std::nullopt;
+		}
+		const unsigned char* const crcs_begin = data + tail.covered_length;
+		if (compute(crcs_begin, static_cast<std::size_t>((count * sizeof(u32)) + sizeof(u64) + sizeof(u32))) != tail.footer_crc) {
+			log::error("Checksum: Footer is corrupt."sv);
+			return std::nullopt;
+		}
+
+		// Each task records the first chunk it found corrupt, or count if none.
+		const std::size_t task_count = task_count_for(count, min_chunks_per_verify_task);
+		diff::vector<u64> first_bad{};
+		try {
+			first_bad.resize(task_count, count);
+		}
+		catch (...) {
+			log::error("Checksum: Failed to allocate verification tasks."sv);
+			return std::nullopt;
+		}
+		const u64 chunks_per_task = (count + task_count - 1) / task_count;
+		const u64 stride = tail.chunk_length;
+		run_tasks(task_count, [&](const std::size_t task) noexcept {
+			const u64 begin = std::min(task * chunks_per_task, count);
+			const u64 end = std::min(begin + chunks_per_task, count);
+			for (u64 i = begin; i < end; ++i) {
+				const u64 offset = i * stride;
+				u32 expected = 0;
+				std::memcpy(&expected, crcs_begin + (i * sizeof(u32)), sizeof(u32));
+				if (compute(data + offset, static_cast<std::size_t>(std::min(stride, tail.covered_length - offset))) != expected) {
+					first_bad[task] = i;
+					return;
+				}
+			}
+		});
+
+		for (const u64 bad : first_bad) {
+			if (bad != count) {
+				log::error("Checksum: Chunk <{}> of <{}> (bytes {} to {}) is corrupt."sv, bad + 1, count, bad * stride, std::min((bad + 1) * stride, tail.covered_length));
+				return std::nullopt;
+			}
+		}
+		return verified_range{ tail.covered_length, count };
+	}
+
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include "int_defs.h"
+#include "dynamic_buffer.h"
+#include <cstddef>	// std::size_t
+#include <optional>
+
+
+namespace diff::crc32c {
+
+	// CRC-32C (Castagnoli polynomial). Uses the SSE4.2 or ARMv8 CRC instructions where the CPU has them, and a table otherwise. Both give the same results.
+	// Continues from crc, so a long range can be checksummed in pieces. Start from 0.
+	[[nodiscard]] u32 update(u32 crc, const void* data, std::size_t length) noexcept;
+	[[nodiscard]] inline u32 compute(const void* data, std::size_t length) noexcept { return update(0, data, length); }
+
+	// Whether update() runs on CRC instructions rather than the table.
+	[[nodiscard]] bool hardware_accelerated() noexcept;
+
+
+	// Chunk checksums, for files that should be checkable without decoding them.
+	// Such a file ends with a footer holding the CRC of every chunk_length bytes of everything before it, as stored, so damage is pinned to a chunk before anything is decrypted or parsed.
+	// Footer: u32 CRC per chunk, u64 length covered, u32 chunk length, then u32 CRC of the footer up to there.
+	enum : std::size_t { chunk_length = std::size_t{ 1024 } * 1024 };
+
+	[[nodiscard]] constexpr u64 chunk_count(const u64 covered_length) noexcept { return (covered_length + chunk_length - 1) / chunk_length; }
+	[[nodiscard]] constexpr u64 footer_length(const u64 chunk_count) noexcept { return (chunk_count * sizeof(u32)) + sizeof(u64) + sizeof(u32) + sizeof(u32); }
+
+	// Writes the footer for crcs[0, count), which checksum the first covered_length bytes of a file, into out. out must hold footer_length(count) bytes.
+	void encode_footer(const u32* crcs, std::size_t count, u64 covered_length, unsigned char* out) noexcept;
+
+	// Checksums everything in buf and appends the footer. The cursor ends up at the end.
+	[[nodiscard]] bool append_footer(dynamic_buffer& buf) noexcept;
+
+	struct verified_range {
+		u64 covered_length{ 0 };	// Bytes before the footer.
+		u64 chunk_count{ 0 };
+	};
+
+	// Checks that [data, data + length) ends in an intact footer, and that every chunk before it matches its CRC. Chunks are checked on several threads.
+	// Logs what failed, naming the first corrupt chunk.
+	[[nodiscard]] std::optional<verified_range> verify(const unsigned char* data, std::size_t length) noexcept;
+
+}
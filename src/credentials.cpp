@@ -0,0 +1,109 @@
+#include "credentials.h"
+#include "snapshot_format.h"	// header
+#include "filesystem_interface.h"
+#include "dynamic_buffer.h"
+#include "keystream.h"
+#include "logger.h"
+#include <random>
+
+
+namespace diff {
+
+	// Layout: magic, header (same seed hiding as snapshots, versioned on its own), then url, username and password as varint strings.
+	// Everything after the header is encrypted with the lane keystream.
+	enum : u32 {
+		credentials_magic = 'CRED',
+		credentials_version = 1
+	};
+
+	static constexpr std::size_t credentials_body_start = sizeof(u32) + sizeof(header);
+
+
+	std::optional<smtp_info> read_credentials(const std::filesystem::path& file_path) noexcept {
+		auto opt_buf{ read_dbuf_from_file(file_path) };
+		if (not opt_buf.has_value()) {
+			log::error("Credentials: Failed to read <{}>."sv, file_path.string());
+			return std::nullopt;
+		}
+		dynamic_buffer& buf = opt_buf.value();
+		buf.rewind();
+
+		u32 magic = 0;
+		header h{};
+		if (not buf.read(magic) or (magic != credentials_magic) or not buf.read(h)) {
+			log::error("Credentials: <{}> is not a credentials file."sv, file_path.string());
+			return std::nullopt;
+		}
+		if ((h.get_header_size() != sizeof(header)) or (h.get_version() != credentials_version)) {
+			log::error("Credentials: Unsupported header in <{}> (size {}, version {})."sv, file_path.string(), h.get_header_size(), h.get_version());
+			return std::nullopt;
+		}
+
+		if (h.get_encrypted()) {
+			const auto seed{ h.get_seed() };
+			if (not seed.has_value()) {
+				log::error("Credentials: Failed to find the decryption seed of <{}>."sv, file_path.string());
+				return std::nullopt;
+			}
+			keystream::decrypt(buf.begin() + credentials_body_start, buf.length() - credentials_body_start, 0, seed.value());
+		}
+
+		smtp_info ret{};
+		if (not buf.read_varint_string(ret.url)
+			or not buf.read_varint_string(ret.username)
+			or not buf.read_varint_string(ret.password))
+		{
+			log::error("Credentials: Failed to read SMTP info from <{}>."sv, file_path.string());
+			return std::nullopt;
+		}
+
+		log::info("Credentials: Read SMTP info from <{}>."sv, file_path.string());
+		return ret;
+	}
+
+
+	bool write_credentials(const std::filesystem::path& file_path, const smtp_info& smtp) noexcept {
+
+		static_assert(sizeof(smtp_info) == (
+			sizeof(decltype(smtp_info::url)) +
+			sizeof(decltype(smtp_info::username)) +
+			sizeof(decltype(smtp_info::password))
+		),
+			"Unexpected smtp_info stack size. Did you change the class but forgot to update the credentials store?"
+		);
+
+		const u32 seed = std::random_device{}();
+		const header h{ named<bool, 'ENCR'>{ true }, named<u32, 'SEED'>{ seed }, named<u32, 'VERS'>{ u32{ credentials_version } } };
+
+		dynamic_buffer buf{};
+		const std::size_t estimated_size = credentials_body_start + (3 * varint::max_u64_bytes) + smtp.url.length() + smtp.username.length() + smtp.password.length();
+		if (not buf.expand_for_extra(estimated_size)) {
+			log::error("Credentials: Failed to allocate buffer space (<{}> bytes)."sv, estimated_size);
+			return false;
+		}
+
+		if (not buf.write(u32{ credentials_magic })
+			or not buf.write(h)
+			or not buf.write_varint_string(smtp.url)
+			or not buf.write_varint_string(smtp.username)
+			or not buf.write_varint_string(smtp.password))
+		{
+			log::error("Credentials: Failed to write SMTP info into buffer."sv);
+			return false;
+		}
+
+		keystream::encrypt(buf.begin() + credentials_body_start, buf.length() - credentials_body_start, 0, seed);
+
+		// A torn store would be trusted just for existing, and fail every run after until the credentials are set again.
+		std::filesystem::path new_file_path{ file_path };
+		new_file_path += ".new";
+		if (not write_dbuf_to_file(new_file_path, buf) or not commit_file(new_file_path, file_path)) {
+			log::error("Credentials: Failed to write <{}>."sv, file_path.string());
+			return false;
+		}
+
+		log::info("Credentials: Wrote SMTP info to <{}>."sv, file_path.string());
+		return true;
+	}
+
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include "smtp.h"
+#include <filesystem>
+#include <optional>
+
+
+namespace diff {
+
+	// SMTP credentials store, a small file of its own so they can be read or changed without touching the file snapshot.
+
+	[[nodiscard]] std::optional<smtp_info> read_credentials(const std::filesystem::path& file_path) noexcept;
+
+	// Always encrypted. Creates or replaces file_path, writing beside it and moving the result in place, so after a crash at any point it holds either the old credentials or the new ones.
+	[[nodiscard]] bool write_credentials(const std::filesystem::path& file_path, const smtp_info& smtp) noexcept;
+
+}
@@ -1,6 +1,9 @@
 #include "differ.h"
 #include "string_utils.h"
+#include "parallel.h"
 #include "logger.h"
+#include <algorithm>	// std::replace
+#include <atomic>
 
 
 namespace diff {
@@ -11,12 +14,12 @@ namespace diff {
 	
 		struct name_attrs {
 			
-			constexpr name_attrs(const std::u8string& stem) {
+			constexpr name_attrs(u8string_view stem) {
 				if (stem.empty()) {
 					return;
 				}
 				
-				diff::vector<diff::u8string> parts{ [](const std::u8string& stem) {
+				diff::vector<diff::u8string> parts{ [](u8string_view stem) {
 					/*
 					Atypical string split. Keeps the delimiter at the START of each part. Additionally, trims leading & trailing whitespace of each part after split is done.
 					Visually, imagine just breaking the string before each delim, without removing anything. Examples with delim '/':
@@ -102,6 +105,9 @@ namespace diff {
 		
 	public:
 		
+		// The listing grows through the whole diff and is dropped once the report is made, so it can live in a phase_arena.
+		explicit diff_string_maker(std::pmr::memory_resource* const scratch) noexcept : str{ scratch }, last_parent{ scratch } {}
+		
 		[[nodiscard]] constexpr bool reserve(const std::size_t n) noexcept {
 			try {
 				str.reserve(n);
@@ -118,25 +124,41 @@ namespace diff {
 		
 		[[nodiscard]] bool append(const file& f) noexcept {
 			try {
-				const u8string u8ogparent{ f.original_path.parent_path().u8string() };
+				return append(f.original_path.parent_path().generic_u8string(), f.parent.str_cref(), f.original_path.filename().u8string(), f.owner.val);
+			}
+			catch (...) {
+				return false;
+			}
+		}
+		
+		[[nodiscard]] bool append(const snapshot_entry& e) noexcept {
+			return append(e.parent, e.parent_lower, e.filename, e.owner);
+		}
+		
+		// og_ arguments keep the original capitalization, for display. Parents are separated by '/', and shown with the OS's own separator.
+		[[nodiscard]] bool append(u8string_view og_parent, u8string_view parent_lower, u8string_view og_filename, u8string_view owner) noexcept {
+			try {
+				const u8string u8ogparent{ og_parent };
 				
 				// Update last parent. 
-				if (f.parent != last_parent) {					// Input file is in a different folder from the previous one.
-					last_parent = f.parent;						// Update last parent.
+				if (parent_lower != last_parent) {				// Input file is in a different folder from the previous one.
+					last_parent = parent_lower;					// Update last parent.
+					const std::size_t parent_start = str.length();
 					str.append(u8ogparent).append(u8"\r\n");	// Append the parent string (no tab). Use og for capitalization.
+					std::replace(str.begin() + parent_start, str.end(), u8'/', static_cast<char8_t>(std::filesystem::path::preferred_separator));
 				}
 				
 				// Append filename.
 				str.append(u8"\t")
-				   .append(f.original_path.filename().u8string())
+				   .append(og_filename)
 				   .append(u8"\r\n");	
 				
-				auto parents{ split(u8ogparent, u8'\\') };
+				auto parents{ split(u8ogparent, u8'/') };
 				
 				const diff::u8string standard{ (parents.size() > 0) ? std::move(parents[0]) : diff::u8string{ u8"N/A" } };
 				const diff::u8string family{ (parents.size() > 1) ? std::move(parents[1]) : diff::u8string{ u8"N/A" } };
 				
-				name_attrs attrs{ f.original_path.stem().u8string() };
+				name_attrs attrs{ stem_of(og_filename) };
 				
 				// Append details.
 				str.append(u8"\t\tStandard: ").append(standard)
@@ -145,7 +167,7 @@ namespace diff {
 				   .append(u8"\r\n\t\tVariant: ").append(attrs.variant)
 				   .append(u8"\r\n\t\tVersion: ").append(attrs.version)
 				   .append(u8"\r\n\t\tCatalog: ").append(attrs.catalog)
-				   .append(u8"\r\n\t\tOwner: ").append(f.owner.val)
+				   .append(u8"\r\n\t\tOwner: ").append(owner)
 				   .append(u8"\r\n");
 				
 				return true;
@@ -155,85 +177,260 @@ namespace diff {
 			}
 		}
 		
-		diff::u8string str{};
-		lowercase_path last_parent{};
+		diff::pmr::u8string str;
+		diff::pmr::u8string last_parent;
+		
+	private:
+		// Same as std::filesystem::path::stem(), for a lone filename.
+		[[nodiscard]] static constexpr u8string_view stem_of(u8string_view filename) noexcept {
+			if ((filename == u8"."sv) or (filename == u8".."sv)) {
+				return filename;
+			}
+			const auto dot_idx = filename.rfind(u8'.');
+			return ((dot_idx == u8string_view::npos) or (dot_idx == 0)) ? filename : filename.substr(0, dot_idx);
+		}
+
 	};
 	
 	
-	std::optional<u8string> diff_sorted_files(const old_files_t& olds, const new_files_t& news) noexcept {
-
-		diff_string_maker created{};
-		diff_string_maker deleted{};
-		// diff_string_maker changed{};
+	// Sources for merge_sorted. All expose the same cursor: valid() / get() / advance().
+	class vector_source {
+	public:
+		explicit vector_source(const diff::vector<file>& files) noexcept : it{ files.begin() }, end{ files.end() } {}
 		
-		// if (not (created.reserve(1024) and deleted.reserve(1024) and changed.reserve(1024))) { // Start off with a big block to avoid initial growth's allocation spam.
-		if (not (created.reserve(1024) and deleted.reserve(1024))) { // Start off with a big block to avoid initial growth's allocation spam.
-			log::error("Diffing: Failed to allocate initial space."sv);
-			return std::nullopt;
+		[[nodiscard]] bool valid() const noexcept { return it != end; }
+		[[nodiscard]] const file& get() const noexcept { return *it; }
+		[[nodiscard]] bool advance() noexcept { ++it; return true; }
+		
+	private:
+		diff::vector<file>::const_iterator it;
+		diff::vector<file>::const_iterator end;
+	};
+	
+	class view_source {
+	public:
+		explicit view_source(snapshot_view& view) noexcept : view{ view } { has_current = view.next(); }
+		
+		[[nodiscard]] bool valid() const noexcept { return has_current; }
+		[[nodiscard]] const snapshot_entry& get() const noexcept { return view.current(); }
+		// False only if the snapshot turned out to be corrupt.
+		[[nodiscard]] bool advance() noexcept { has_current = view.next(); return not view.failed(); }
+		[[nodiscard]] bool failed() const noexcept { return view.failed(); }
+		
+	private:
+		snapshot_view& view;
+		bool has_current{ false };
+	};
+	
+	// Files kept by a delta_overlay, in key order.
+	class record_map_source {
+	public:
+		explicit record_map_source(const std::map<record_key, file_record>& records) noexcept : it{ records.begin() }, end{ records.end() } { refresh(); }
+		
+		[[nodiscard]] bool valid() const noexcept { return it != end; }
+		[[nodiscard]] const snapshot_entry& get() const noexcept { return current; }
+		[[nodiscard]] bool advance() noexcept { ++it; refresh(); return true; }
+		
+	private:
+		std::map<record_key, file_record>::const_iterator it;
+		std::map<record_key, file_record>::const_iterator end;
+		snapshot_entry current{};
+		
+		void refresh() noexcept {
+			if (it != end) {
+				current = it->second.view();
+			}
+		}
+	};
+	
+	// The base snapshot with a journal's overlay on top: base files the overlay removed are skipped, and the files it added are merged in.
+	// A null base is an empty one, so only the added files are left.
+	class old_journaled_source {
+	public:
+		explicit old_journaled_source(snapshot_view* base, const delta_overlay& overlay) noexcept
+			: base{ base }
+			, removed_it{ overlay.removed().begin() }
+			, removed_end{ overlay.removed().end() }
+			, added_it{ overlay.added().begin() }
+			, added_end{ overlay.added().end() }
+		{
+			(void)(next_base() and pick());
 		}
 		
+		[[nodiscard]] bool valid() const noexcept { return has_current; }
+		[[nodiscard]] const snapshot_entry& get() const noexcept { return current; }
+		// False only if the snapshot turned out to be corrupt.
+		[[nodiscard]] bool advance() noexcept {
+			if (from_base) {
+				if (not next_base()) {
+					return false;
+				}
+			}
+			else {
+				++added_it;
+			}
+			return pick();
+		}
+		[[nodiscard]] bool failed() const noexcept { return (base != nullptr) and base->failed(); }
+		
+	private:
+		snapshot_view* base;
+		std::map<record_key, file_record>::const_iterator removed_it;
+		std::map<record_key, file_record>::const_iterator removed_end;
+		std::map<record_key, file_record>::const_iterator added_it;
+		std::map<record_key, file_record>::const_iterator added_end;
+		snapshot_entry current{};
+		bool has_base{ false };
+		bool has_current{ false };
+		bool from_base{ false };
+		
+		// Moves the base to its next file that the overlay didn't remove. Both are sorted, so the removed files are walked in lockstep.
+		[[nodiscard]] bool next_base() noexcept {
+			while ((has_base = ((base != nullptr) and base->next()))) {
+				const auto& entry{ base->current() };
+				while ((removed_it != removed_end) and ((removed_it->first <=> entry) < 0)) {
+					++removed_it;
+				}
+				if ((removed_it == removed_end) or ((removed_it->first <=> entry) != 0)) {
+					return true;
+				}
+			}
+			return not failed();
+		}
+		
+		// Makes the smaller of the base and the added files current. On a tie the added one wins, since it is the more recent record.
+		[[nodiscard]] bool pick() noexcept {
+			const bool has_added = (added_it != added_end);
+			if (has_base and has_added and ((added_it->first <=> base->current()) == 0) and not next_base()) {
+				return false;
+			}
+			from_base = has_base and (not has_added or ((added_it->first <=> base->current()) > 0));
+			if (from_base) {
+				current = base->current();
+			}
+			else if (has_added) {
+				current = added_it->second.view();
+			}
+			has_current = has_base or has_added;
+			return true;
+		}
+	};
+	
+	
+	struct merge_result {
+		explicit merge_result(std::pmr::memory_resource* const scratch) noexcept : created{ scratch }, deleted{ scratch } {}
+		
+		diff_string_maker created;
+		diff_string_maker deleted;
 		std::size_t deleted_count = 0;
 		std::size_t created_count = 0;
 		std::size_t remained_count = 0;
+		journal_delta* changes{ nullptr }; // Also collects what was created and deleted, if set.
+	};
+	
+	template <typename T>
+	[[nodiscard]] static bool record_change(diff::vector<file_record>& records, const T& f) noexcept {
+		try {
+			records.push_back(file_record::from(f));
+			return true;
+		}
+		catch (...) {
+			return false;
+		}
+	}
+	
+	template <typename OldSource, typename NewSource>
+	[[nodiscard]] static bool merge_sorted(OldSource& old_src, NewSource& new_src, merge_result& res) noexcept {
 		
-		{
-			// Set intersection-like
+		// if (not (res.created.reserve(1024) and res.deleted.reserve(1024) and res.changed.reserve(1024))) { // Start off with a big block to avoid initial growth's allocation spam.
+		if (not (res.created.reserve(1024) and res.deleted.reserve(1024))) { // Start off with a big block to avoid initial growth's allocation spam.
+			log::error("Diffing: Failed to allocate initial space."sv);
+			return false;
+		}
+		
+		// Set intersection-like
+		
+		const auto advance_old = [&old_src]() {
+			if (not old_src.advance()) {
+				log::error("Diffing: Failed to read next old file."sv);
+				return false;
+			}
+			return true;
+		};
+		
+		const auto advance_new = [&new_src]() {
+			if (not new_src.advance()) {
+				log::error("Diffing: Failed to read next new file."sv);
+				return false;
+			}
+			return true;
+		};
+		
+		const auto add_deleted = [&res](const auto& f) {
+			if (not res.deleted.append(f) or ((res.changes != nullptr) and not record_change(res.changes->deleted, f))) {
+				log::error("Diffing: Failed to append file to \"deleted\" list."sv);
+				return false;
+			}
+			++res.deleted_count;
+			return true;
+		};
+		
+		const auto add_created = [&res](const auto& f) {
+			if (not res.created.append(f) or ((res.changes != nullptr) and not record_change(res.changes->created, f))) {
+				log::error("Diffing: Failed to append file to \"created\" list."sv);
+				return false;
+			}
+			++res.created_count;
+			return true;
+		};
+		
+		while (old_src.valid() bitand new_src.valid()) {
 			
-			auto old_it{ olds.files.begin() };
-			auto new_it{ news.files.begin() };
-			const auto old_end{ olds.files.end() };
-			const auto new_end{ news.files.end() };
+			const auto cmp = (old_src.get() <=> new_src.get()); // Spaceship!
 			
-			while ((old_it != old_end) bitand (new_it != new_end)) {
-				
-				const auto cmp = (*old_it <=> *new_it); // Spaceship!
-				
-				if (cmp < 0) { // old < new, so this old is not present in news, so it has been deleted.
-					if (not deleted.append(*old_it)) {
-						log::error("Diffing: Failed to append file to \"deleted\" list."sv);
-						return std::nullopt;
-					}
-					++old_it;
-					++deleted_count;
-				}
-				else if (cmp > 0) { // old > new, so this new is not present in olds, so it is newly created.
-					if (not created.append(*new_it)) {
-						log::error("Diffing: Failed to append file to \"created\" list."sv);
-						return std::nullopt;
-					}
-					++new_it;
-					++created_count;
-				}
-				else { // old == new, so this new existed before and still exists.
-					
-					// Handling here scrapped because no longer relevant.
-					
-					++old_it;
-					++new_it;
-					++remained_count;
+			if (cmp < 0) { // old < new, so this old is not present in news, so it has been deleted.
+				if (not add_deleted(old_src.get()) or not advance_old()) {
+					return false;
 				}
 			}
-			
-			// Handle remaining deleted files.
-			for (; old_it != old_end; ++old_it) {
-				if (not deleted.append(*old_it)) {
-					log::error("Diffing: Failed to append file to \"deleted\" list."sv);
-					return std::nullopt;
+			else if (cmp > 0) { // old > new, so this new is not present in olds, so it is newly created.
+				if (not add_created(new_src.get()) or not advance_new()) {
+					return false;
 				}
-				++deleted_count;
 			}
-			
-			// Handle remaining created files.
-			for (; new_it != new_end; ++new_it) {
-				if (not created.append(*new_it)) {
-					log::error("Diffing: Failed to append file to \"created\" list."sv);
-					return std::nullopt;
+			else { // old == new, so this new existed before and still exists.
+				
+				// Handling here scrapped because no longer relevant.
+				
+				if (not advance_old() or not advance_new()) {
+					return false;
 				}
-				++created_count;
+				++res.remained_count;
 			}
-			
 		}
 		
+		// Handle remaining deleted files.
+		while (old_src.valid()) {
+			if (not add_deleted(old_src.get()) or not advance_old()) {
+				return false;
+			}
+		}
+		
+		// Handle remaining created files.
+		while (new_src.valid()) {
+			if (not add_created(new_src.get()) or not advance_new()) {
+				return false;
+			}
+		}
+		
+		return true;
+	}
+	
+	
+	[[nodiscard]] static std::optional<u8string> make_report(const merge_result& res) noexcept {
+		const auto& created = res.created;
+		const auto& deleted = res.deleted;
+		
 		diff::u8string report{};
 		
 		try {
@@ -260,9 +457,156 @@ namespace diff {
 			report.append(u8"Deleted files:\r\n\r\n").append(deleted.str);
 		}
 		
-		log::info("Diffing: Generated report with info for <{}> deleted, <{}> created, and <{}> still-existing files."sv, deleted_count, created_count, remained_count);
+		log::info("Diffing: Generated report with info for <{}> deleted, <{}> created, and <{}> still-existing files."sv, res.deleted_count, res.created_count, res.remained_count);
 		return report;
 	}
 	
 	
+	std::optional<u8string> diff_sorted_files(const old_files_t& olds, const new_files_t& news, journal_delta* changes, std::pmr::memory_resource* scratch) noexcept {
+		merge_result res{ scratch };
+		res.changes = changes;
+		vector_source old_src{ olds.files };
+		vector_source new_src{ news.files };
+		if (not merge_sorted(old_src, new_src, res)) {
+			return std::nullopt;
+		}
+		return make_report(res);
+	}
+	
+	std::optional<u8string> diff_sorted_files(snapshot_view& base, const delta_overlay& overlay, const new_files_t& news, journal_delta* changes, std::pmr::memory_resource* scratch) noexcept {
+		merge_result res{ scratch };
+		res.changes = changes;
+		old_journaled_source old_src{ &base, overlay };
+		if (old_src.failed()) {
+			log::error("Diffing: Failed to read first old file."sv);
+			return std::nullopt;
+		}
+		vector_source new_src{ news.files };
+		if (not merge_sorted(old_src, new_src, res)) {
+			return std::nullopt;
+		}
+		return make_report(res);
+	}
+	
+	std::optional<u8string> diff_sorted_files(snapshot_view& olds, snapshot_view& news) noexcept {
+		merge_result res{ std::pmr::get_default_resource() };
+		view_source old_src{ olds };
+		view_source new_src{ news };
+		if (old_src.failed() or new_src.failed()) {
+			log::error("Diffing: Failed to read first file of the {} snapshot."sv, old_src.failed() ? "old"sv : "new"sv);
+			return std::nullopt;
+		}
+		if (not merge_sorted(old_src, new_src, res)) {
+			return std::nullopt;
+		}
+		return make_report(res);
+	}
+	
+	std::optional<u8string> diff_sorted_files(const delta_overlay& change) noexcept {
+		merge_result res{ std::pmr::get_default_resource() };
+		record_map_source old_src{ change.removed() };
+		record_map_source new_src{ change.added() };
+		if (not merge_sorted(old_src, new_src, res)) {
+			return std::nullopt;
+		}
+		return make_report(res);
+	}
+	
+	
+	// Shards vary wildly in size, so threads take them one at a time as they free up, rather than in fixed ranges.
+	enum : u64 { min_shards_per_diff_task = 2 };
+	
+	[[nodiscard]] static bool diff_part(const std::filesystem::path& shard_folder, shard_part& part, merge_result& res) noexcept {
+		std::optional<snapshot_view> base{};
+		if (part.base != nullptr) {
+			base = open_shard(shard_folder, *part.base);
+			if (not base.has_value()) {
+				return false;
+			}
+		}
+		old_journaled_source old_src{ base.has_value() ? &base.value() : nullptr, part.overlay };
+		if (old_src.failed()) {
+			log::error("Diffing: Failed to read first old file of the shard of <{}>."sv, string_view{ reinterpret_cast<const char*>(part.key.data()), part.key.length() });
+			return false;
+		}
+		vector_source new_src{ part.files };
+		if (not merge_sorted(old_src, new_src, res)) {
+			return false;
+		}
+		part.changed = (res.created_count != 0) or (res.deleted_count != 0);
+		part.outdated = base.has_value() and not base.value().is_current_version();
+		return true;
+	}
+	
+	std::optional<u8string> diff_sharded_files(const std::filesystem::path& shard_folder, diff::vector<shard_part>& parts, journal_delta* changes, std::pmr::memory_resource* scratch) noexcept {
+		diff::pmr::vector<merge_result> results{ scratch };
+		diff::vector<journal_delta> part_changes{};
+		try {
+			results.reserve(parts.size());
+			for (std::size_t i = 0; i < parts.size(); ++i) {
+				results.emplace_back(scratch);
+			}
+			if (changes != nullptr) {
+				part_changes.resize(parts.size());
+				for (std::size_t i = 0; i < parts.size(); ++i) {
+					results[i].changes = &part_changes[i];
+				}
+			}
+		}
+		catch (...) {
+			log::error("Diffing: Failed to allocate space for <{}> shards."sv, parts.size());
+			return std::nullopt;
+		}
+		
+		std::atomic<std::size_t> next_part{ 0 };
+		std::atomic<bool> failed{ false };
+		run_tasks(task_count_for(parts.size(), min_shards_per_diff_task), [&](std::size_t) noexcept {
+			for (std::size_t i = next_part++; (i < parts.size()) and not failed; i = next_part++) {
+				if (not diff_part(shard_folder, parts[i], results[i])) {
+					failed = true;
+				}
+			}
+		});
+		if (failed) {
+			return std::nullopt;
+		}
+		
+		// Parts are in key order, and so is everything within each, so putting them one after the other lists each directory whole.
+		merge_result res{ scratch };
+		std::size_t created_length = 0;
+		std::size_t deleted_length = 0;
+		for (const auto& part_res : results) {
+			created_length += part_res.created.length();
+			deleted_length += part_res.deleted.length();
+		}
+		if (not (res.created.reserve(created_length) and res.deleted.reserve(deleted_length))) {
+			log::error("Diffing: Failed to allocate space to join the diffs of <{}> shards."sv, parts.size());
+			return std::nullopt;
+		}
+		for (const auto& part_res : results) {
+			res.created.str.append(part_res.created.str);
+			res.deleted.str.append(part_res.deleted.str);
+			res.created_count += part_res.created_count;
+			res.deleted_count += part_res.deleted_count;
+			res.remained_count += part_res.remained_count;
+		}
+		results.clear();
+		
+		if (changes != nullptr) {
+			try {
+				for (auto& part_change : part_changes) {
+					changes->created.insert(changes->created.end(), std::make_move_iterator(part_change.created.begin()), std::make_move_iterator(part_change.created.end()));
+					changes->deleted.insert(changes->deleted.end(), std::make_move_iterator(part_change.deleted.begin()), std::make_move_iterator(part_change.deleted.end()));
+				}
+			}
+			catch (...) {
+				log::error("Diffing: Failed to allocate space to join the changes of <{}> shards."sv, parts.size());
+				return std::nullopt;
+			}
+		}
+		
+		return make_report(res);
+	}
+	
+	
 }
\ No newline at end of file
@@ -2,7 +2,11 @@
 #include "string_defs.h"
 #include "vector_defs.h"
 #include "file.h"
+#include "snapshot_view.h"
+#include "journal.h"
+#include "shards.h"		// shard_part
 #include <optional>
+#include <memory_resource>
 
 namespace diff {
 	
@@ -17,6 +21,22 @@ namespace diff {
 		diff::vector<file> files{};
 	};
 	
-	std::optional<u8string> diff_sorted_files(const old_files_t& olds, const new_files_t& news) noexcept;
+	// If changes is set, the files created and deleted are also collected into it, ready to be journaled.
+	// The lists of created and deleted files are built in scratch, e.g. the diff's phase_arena, and only the finished report is allocated normally.
+	std::optional<u8string> diff_sorted_files(const old_files_t& olds, const new_files_t& news, journal_delta* changes = nullptr, std::pmr::memory_resource* scratch = std::pmr::get_default_resource()) noexcept;
+	
+	// Same as above, but old files are the base snapshot, decoded one by one straight from its mapping, with a journal's overlay applied on top. The view is consumed.
+	std::optional<u8string> diff_sorted_files(snapshot_view& base, const delta_overlay& overlay, const new_files_t& news, journal_delta* changes = nullptr, std::pmr::memory_resource* scratch = std::pmr::get_default_resource()) noexcept;
+	
+	// Same as the base-and-overlay diff, but the base is split into shards, and each part is diffed on its own, several at a time. Each shard is opened (and checked) by the thread diffing it, and dropped once it is done.
+	// Sets each part's changed flag. The report lists one top-level directory after another, in key order.
+	std::optional<u8string> diff_sharded_files(const std::filesystem::path& shard_folder, diff::vector<shard_part>& parts, journal_delta* changes = nullptr, std::pmr::memory_resource* scratch = std::pmr::get_default_resource()) noexcept;
+	
+	// Diffs two saved snapshots, both decoded one file at a time straight from their mappings, so neither is ever held in memory whole. Both views are consumed.
+	std::optional<u8string> diff_sorted_files(snapshot_view& olds, snapshot_view& news) noexcept;
+	
+	// Diffs two states given only the net change from one to the other, e.g. composed from stored runs, so neither state is ever materialized.
+	// The change's removed files are the old side and its added files the new side. Files in both were deleted and created again in between, so they count as remaining.
+	std::optional<u8string> diff_sorted_files(const delta_overlay& change) noexcept;
 }
 
@@ -1,8 +1,11 @@
 #pragma once
 #include "int_defs.h"
 #include "string_defs.h"
+#include "varint.h"
+#include "winapi_funcs.h"	// reserve_address_space, commit_address_space, release_address_space for big buffers
 #include <cstdlib>	// std::malloc, std::free, std::realloc, std::memcpy
 #include <bit>		// std::bit_ceil for calculating growing size
+#include <span>		// std::span for zero-copy reads
 #include <fstream>	// std::ifstream for reading from stream
 
 namespace diff {
@@ -27,20 +30,24 @@ namespace diff {
 		explicit constexpr dynamic_buffer() noexcept = default;
 		constexpr dynamic_buffer(dynamic_buffer&& rhs) noexcept :
 			mem(rhs.mem),
-			off(rhs.off) {
-			static_assert(sizeof(dynamic_buffer) == (sizeof(buf_t*) + sizeof(offsets)), "dynamic_buffer size changed. Update non-defaulted move operations!");
+			off(rhs.off),
+			reserved(rhs.reserved) {
+			static_assert(sizeof(dynamic_buffer) == (sizeof(buf_t*) + sizeof(offsets) + sizeof(size_t)), "dynamic_buffer size changed. Update non-defaulted move operations!");
 			// I don't want to include a header just for std::exchange().
 			rhs.mem = nullptr;
 			rhs.off.zero();
+			rhs.reserved = 0;
 		}
 		constexpr dynamic_buffer& operator=(dynamic_buffer&& rhs) noexcept {
-			static_assert(sizeof(dynamic_buffer) == (sizeof(buf_t*) + sizeof(offsets)), "dynamic_buffer size changed. Update non-defaulted move operations!");
+			static_assert(sizeof(dynamic_buffer) == (sizeof(buf_t*) + sizeof(offsets) + sizeof(size_t)), "dynamic_buffer size changed. Update non-defaulted move operations!");
 			if (&rhs != this) {
 				free_self();
 				this->mem = rhs.mem;
 				this->off = rhs.off;
+				this->reserved = rhs.reserved;
 				rhs.mem = nullptr;
 				rhs.off.zero();
+				rhs.reserved = 0;
 			}
 			return *this;
 		}
@@ -175,6 +182,107 @@ namespace diff {
 		}
 
 
+		// LEB128 read/write helpers. Same guarantees as the trivial helpers.
+		[[nodiscard]] bool read_varint(u64& out) const noexcept {
+			const size_t consumed = varint::decode(mem + off.pos, off.len - off.pos, out);
+			off.pos += consumed;
+			return consumed != 0;
+		}
+
+		[[nodiscard]] bool write_varint(const u64 val) noexcept {
+			unsigned char encoded[varint::max_u64_bytes]{};
+			return write(encoded, varint::encode(val, encoded));
+		}
+
+
+		// String read/write helpers with a LEB128 length prefix instead of a fixed 8 bytes one.
+		template<string_type S>
+		[[nodiscard]] bool read_varint_string(S& out) const noexcept {
+			offsets old_offsets{ off };
+
+			u64 length = 0;
+			if (not read_varint(length) or (length > ((off.len - off.pos) / sizeof(typename S::value_type)))) {
+				off = old_offsets;
+				return false;
+			}
+
+			try {
+				out.resize(length);
+			}
+			catch (...) {
+				off = old_offsets;
+				out.clear();
+				return false;
+			}
+
+			if (length == 0) {
+				return true;
+			}
+
+			return read(out.data(), length * sizeof(typename S::value_type));
+		}
+
+		template<typename CharT>
+		[[nodiscard]] bool write_varint_string(const std::basic_string_view<CharT> val) noexcept {
+			const size_t string_bytes = (val.length() * sizeof(CharT));
+			const size_t total_bytes_needed = varint::encoded_size(val.length()) + string_bytes;
+			if (not expand_to(calc_regular_size(off.pos + total_bytes_needed))) {
+				return false;
+			}
+			(void)write_varint(static_cast<u64>(val.length()));
+			(void)write(val.data(), string_bytes);
+			return true;
+		}
+		template<string_type S>
+		[[nodiscard]] bool write_varint_string(const S& val) noexcept {
+			return write_varint_string(std::basic_string_view<typename S::value_type>{ val.data(), val.length() });
+		}
+
+
+		// Zero-copy reads. Instead of copying out, these point into the buffer at what is at the cursor, and move the cursor past it.
+		// The views stay valid until the buffer is next written to, grown or freed. Otherwise same guarantees as the copying reads: if failed, object state remains unchanged.
+		// Strings only come in single byte characters, since nothing in the buffer is aligned for wider ones.
+		
+		// Fails if length() == 0, even if byte_count == 0.
+		// Fails if byte_count > (length() - position()).
+		[[nodiscard]] bool read_span(const size_t byte_count, std::span<const buf_t>& out) const noexcept {
+			if ((off.len == 0) or (byte_count > (off.len - off.pos))) {
+				return false;
+			}
+			out = std::span<const buf_t>{ mem + off.pos, byte_count };
+			off.pos += byte_count;
+			return true;
+		}
+
+		// Reads what write(const S&) wrote: a fixed 8 byte length, then the string.
+		template<typename CharT> requires (sizeof(CharT) == 1)
+		[[nodiscard]] bool read_view(std::basic_string_view<CharT>& out) const noexcept {
+			const offsets old_offsets{ off };
+			u64 length = 0;
+			std::span<const buf_t> bytes{};
+			if (not read(length) or (length > (off.len - off.pos)) or not read_span(static_cast<size_t>(length), bytes)) {
+				off = old_offsets;
+				return false;
+			}
+			out = std::basic_string_view<CharT>{ reinterpret_cast<const CharT*>(bytes.data()), bytes.size() };
+			return true;
+		}
+
+		// Reads what write_varint_string wrote: a LEB128 length, then the string.
+		template<typename CharT> requires (sizeof(CharT) == 1)
+		[[nodiscard]] bool read_varint_string_view(std::basic_string_view<CharT>& out) const noexcept {
+			const offsets old_offsets{ off };
+			u64 length = 0;
+			std::span<const buf_t> bytes{};
+			if (not read_varint(length) or (length > (off.len - off.pos)) or not read_span(static_cast<size_t>(length), bytes)) {
+				off = old_offsets;
+				return false;
+			}
+			out = std::basic_string_view<CharT>{ reinterpret_cast<const CharT*>(bytes.data()), bytes.size() };
+			return true;
+		}
+
+
 		// Resets cursor position to the start.
 		constexpr void rewind() const noexcept { off.pos = 0; }
 
@@ -232,38 +340,101 @@ namespace diff {
 
 		buf_t* mem{ nullptr };
 		mutable offsets off{};
+		size_t reserved{ 0 };	// Size of the address space range mem points to, if mem is one. 0 if mem came from malloc.
+
+		// Buffers this big live in reserved address space instead, and grow by committing more of it, in place.
+		// Reallocating them would copy the whole buffer every step, and hold both copies for a moment, which is a lot at multiple GBs.
+		static constexpr size_t reserve_threshold{ size_t{ 32 } << 20 };
+		// Least address space reserved at a time. Plenty for any snapshot on 64-bit. A 32-bit process has little to spare.
+		static constexpr size_t min_reservation{ sizeof(size_t) == 8 ? (size_t{ 64 } << 30) : (size_t{ 256 } << 20) };
+
+		static void free_memory(buf_t* block, const size_t reserved_size) noexcept {
+			if (reserved_size != 0) {
+				winapi::release_address_space(block);
+			}
+			else {
+				std::free(block);
+			}
+		}
 
 		void free_self() noexcept {
 			if (mem != nullptr) {
-				std::free(mem);
+				free_memory(mem, reserved);
 				mem = nullptr;
 				off.zero();
+				reserved = 0;
 			}
 		}
 
-		// Expands buffer to hold exactly to_size bytes, be it by allocating from null, or reallocating from existing allocation.
+		// Grows a big buffer to to_size bytes. In place if it is already in a range that fits to_size, else by moving it to a new range, which only happens
+		// once when it crosses reserve_threshold, barring huge buffers outgrowing min_reservation.
+		// Returns true on success and false on failure. If failed, object state remains unchanged.
+		[[nodiscard]] bool expand_reserved(const size_t to_size) noexcept {
+			if (to_size <= reserved) {
+				if (not winapi::commit_address_space(mem, to_size)) {
+					return false;
+				}
+				off.cap = to_size;
+				return true;
+			}
+
+			// Reserve ahead by a good margin, so moving again is rare.
+			const size_t ceil = std::bit_ceil(to_size);
+			const size_t ahead = (ceil != 0) and (ceil <= (static_cast<size_t>(-1) >> 2)) ? (ceil << 2) : to_size;
+			const size_t new_reserved = ahead > min_reservation ? ahead : min_reservation;
+			void* new_block = winapi::reserve_address_space(new_reserved);
+			if (new_block == nullptr) {
+				return false;
+			}
+			if (not winapi::commit_address_space(new_block, to_size)) {
+				winapi::release_address_space(new_block);
+				return false;
+			}
+			if (mem != nullptr) {
+				std::memcpy(new_block, mem, off.len);
+				free_memory(mem, reserved);
+			}
+			mem = static_cast<buf_t*>(new_block);
+			off.cap = to_size;
+			reserved = new_reserved;
+			return true;
+		}
+
+		// Expands buffer to hold exactly to_size bytes, be it by allocating from null, or reallocating from existing allocation, or committing more of its reserved range.
 		// Does nothing if to_size <= cap. to_size == 0 and cap == 0 is considered a failure.
 		// Returns true on success and false on failure. If failed, object state remains unchanged.
 		[[nodiscard]] bool expand_to(const size_t to_size) noexcept {
 			if (to_size <= off.cap) {
 				return off.cap != 0;
 			}
-			else {
-				void* new_block{ nullptr };
-				if (mem != nullptr) { // Already had memory. Must reallocate.
-					new_block = std::realloc(mem, to_size);
-				}
-				else { // Had no memory. Must allocate.
-					new_block = std::malloc(to_size);
-				}
-				if (new_block != nullptr) {
-					mem = static_cast<buf_t*>(new_block);
-					off.cap = to_size;
+			else if ((reserved != 0) or (to_size >= reserve_threshold)) {
+				if (expand_reserved(to_size)) {
 					return true;
 				}
-				else {
-					return false;
-				}
+				// A heap block may still fit where a whole reservation didn't, namely in a crowded 32-bit address space. A reserved buffer has no such fallback.
+				return (reserved == 0) and expand_heap(to_size);
+			}
+			else {
+				return expand_heap(to_size);
+			}
+		}
+
+		// The malloc path for small buffers, where reallocating is cheap enough, and wastes no address space. Same guarantees as expand_to.
+		[[nodiscard]] bool expand_heap(const size_t to_size) noexcept {
+			void* new_block{ nullptr };
+			if (mem != nullptr) { // Already had memory. Must reallocate.
+				new_block = std::realloc(mem, to_size);
+			}
+			else { // Had no memory. Must allocate.
+				new_block = std::malloc(to_size);
+			}
+			if (new_block != nullptr) {
+				mem = static_cast<buf_t*>(new_block);
+				off.cap = to_size;
+				return true;
+			}
+			else {
+				return false;
 			}
 		}
 
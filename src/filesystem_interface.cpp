@@ -1,6 +1,6 @@
 #include "filesystem_interface.h"
 #include <fstream>			// std::ifstream
-#include "winapi_funcs.h"	// get_owner
+#include "winapi_funcs.h"	// get_owner, flush_to_disk, replace_file
 
 
 namespace diff {
@@ -121,6 +121,36 @@ namespace diff {
 	}
 
 
+	bool append_dbuf_to_file(const path& file_path, const u64 keep_length, const dynamic_buffer& dbuf) noexcept {
+		if (keep_length == 0) {
+			return write_dbuf_to_file(file_path, dbuf);
+		}
+		try {
+			std::error_code ec{};
+			std::filesystem::resize_file(file_path, keep_length, ec);
+			if (ec) {
+				log::error("Buffer->File: Failed to cut file <{}> to <{}> bytes."sv, file_path.string(), keep_length);
+				return false;
+			}
+			std::ofstream ofs{ file_path, std::ios::binary | std::ios::app };
+			if (not ofs.is_open()) {
+				log::error("Buffer->File: Failed to open file <{}>."sv, file_path.string());
+				return false;
+			}
+			if ((dbuf.length() != 0) and not ofs.write(reinterpret_cast<const char*>(dbuf.data()), dbuf.length())) {
+				log::error("Buffer->File: Failed to append buffer to file <{}>."sv, file_path.string());
+				return false;
+			}
+			log::info("Buffer->File: Appended <{}> bytes from buffer to file <{}> after its first <{}>."sv, dbuf.length(), file_path.string(), keep_length);
+			return true;
+		}
+		catch (std::exception& ex) {
+			log::error("Buffer->File: Exception thrown: {}"sv, ex.what());
+			return false;
+		}
+	}
+
+
 	std::optional<configuration> get_configuration(const path& file_path) noexcept {
 		try {
 			std::ifstream ifs{ file_path, std::ios::binary | std::ios::ate }; // ::ate = seek to end after opening
@@ -312,6 +342,28 @@ namespace diff {
 		return true;
 	}
 	
+	bool flush_file(const path& file_path) noexcept {
+		if (not winapi::flush_to_disk(file_path)) {
+			log::error("File Flush: Failed to flush file <{}> to disk."sv, file_path.string());
+			return false;
+		}
+		return true;
+	}
+	
+	bool commit_file(const path& file_path, const path& target_path) noexcept {
+		// Flushed first, so the rename can never reach the disk ahead of the data it points to.
+		if (not flush_file(file_path)) {
+			log::error("File Commit: Did not replace <{}>, since <{}> may not be fully on disk."sv, target_path.string(), file_path.string());
+			return false;
+		}
+		if (not winapi::replace_file(file_path, target_path)) {
+			log::error("File Commit: Failed to replace <{}> with <{}>."sv, target_path.string(), file_path.string());
+			return false;
+		}
+		log::info("File Commit: Replaced <{}> with <{}>."sv, target_path.string(), file_path.string());
+		return true;
+	}
+	
 	bool folder_create_or_exists(const path& folder_name) noexcept {
 		std::error_code ec{};
 		
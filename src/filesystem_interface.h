@@ -21,6 +21,9 @@ namespace diff {
 	
 	[[nodiscard]] bool write_dbuf_to_file(const std::filesystem::path& file_path, const dynamic_buffer& dbuf) noexcept;
 	
+	// Cuts the file to its first keep_length bytes, then appends the buffer. A keep_length of 0 creates or replaces the file instead.
+	[[nodiscard]] bool append_dbuf_to_file(const std::filesystem::path& file_path, u64 keep_length, const dynamic_buffer& dbuf) noexcept;
+	
 
 	[[nodiscard]] std::optional<configuration> get_configuration(const std::filesystem::path& file_path) noexcept;
 
@@ -34,6 +37,13 @@ namespace diff {
 	
 	[[nodiscard]] bool delete_file(const std::filesystem::path& file_path) noexcept;
 	
+	// Waits until everything written to file_path is on disk, so it survives a crash or power loss from then on.
+	[[nodiscard]] bool flush_file(const std::filesystem::path& file_path) noexcept;
+	
+	// Flushes file_path, then moves it over target_path in one step. After a crash at any point, target_path holds either its old contents or all of the new ones.
+	// On failure, target_path is left as it was.
+	[[nodiscard]] bool commit_file(const std::filesystem::path& file_path, const std::filesystem::path& target_path) noexcept;
+	
 	[[nodiscard]] bool folder_create_or_exists(const std::filesystem::path& folder_name) noexcept;
 	
 }
\ No newline at end of file
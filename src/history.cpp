@@ -0,0 +1,207 @@
+#include "history.h"
+#include "filesystem_interface.h"
+#include "dynamic_buffer.h"
+#include "logger.h"
+
+
+namespace diff {
+
+	// Layout: magic, version, number of the first stored run, then one delta record (same framing as the journal) per run, oldest first.
+	enum : u32 {
+		history_magic = 'HIST',
+		history_version = 2,
+		first_portable_history_version = 2	// Folders separated by '/'. Version 1 histories hold '\\'.
+	};
+
+
+	// A history file read into memory, with its records located and checked, but not decoded.
+	struct history_file {
+		dynamic_buffer buf{};
+		u64 first_run{ 1 };
+		diff::vector<std::size_t> record_offsets{};
+		u64 valid_length{ 0 };	// Bytes up to the end of the last intact record. 0 if there is no usable history.
+		u32 version{ history_version };
+
+		[[nodiscard]] delta_separators separators() const noexcept {
+			return (version >= first_portable_history_version) ? delta_separators::portable : delta_separators::windows;
+		}
+	};
+
+	[[nodiscard]] static std::optional<history_file> read_history_file(const std::filesystem::path& history_path) noexcept {
+		history_file ret{};
+
+		const auto exists{ file_exists(history_path) };
+		if (not exists.has_value()) {
+			log::error("History: Could not verify whether <{}> exists."sv, history_path.string());
+			return std::nullopt;
+		}
+		if (not exists.value()) {
+			return ret;
+		}
+
+		auto opt_buf{ read_dbuf_from_file(history_path) };
+		if (not opt_buf.has_value()) {
+			log::error("History: Failed to read <{}>."sv, history_path.string());
+			return std::nullopt;
+		}
+		ret.buf = std::move(opt_buf.value());
+		const dynamic_buffer& buf = ret.buf;
+		buf.rewind();
+
+		u32 magic = 0;
+		if (not buf.read(magic) or not buf.read(ret.version) or not buf.read(ret.first_run) or (magic != history_magic) or (ret.version == 0) or (ret.version > history_version) or (ret.first_run == 0)) {
+			log::warning("History: <{}> is not a readable history. Starting a new one."sv, history_path.string());
+			return history_file{};
+		}
+		ret.valid_length = buf.position();
+
+		try {
+			while (buf.position() < buf.length()) {
+				const std::size_t record_start = buf.position();
+				if (not read_delta_record(buf, nullptr, ret.separators())) {
+					log::warning("History: Run <{}> in <{}> is torn or corrupt. Ignoring it and everything after it."sv, ret.first_run + ret.record_offsets.size(), history_path.string());
+					break;
+				}
+				ret.record_offsets.push_back(record_start);
+				ret.valid_length = buf.position();
+			}
+		}
+		catch (...) {
+			log::error("History: Failed to allocate space for the runs of <{}>."sv, history_path.string());
+			return std::nullopt;
+		}
+
+		return ret;
+	}
+
+
+	bool append_history(const std::filesystem::path& history_path, const journal_delta& delta, const u64 max_runs) noexcept {
+		if (max_runs == 0) {
+			return true;
+		}
+
+		auto opt{ read_history_file(history_path) };
+		if (not opt.has_value()) {
+			return false;
+		}
+		const history_file& hist = opt.value();
+
+		const u64 stored = hist.record_offsets.size();
+		const u64 dropped = ((stored + 1) > max_runs) ? ((stored + 1) - max_runs) : 0;
+
+		dynamic_buffer out{};
+		const bool outdated = (hist.valid_length != 0) and (hist.version != history_version);
+		const bool rewrite = (hist.valid_length == 0) or (dropped != 0) or outdated;
+		if (rewrite) {
+			// New history, or the kept runs moved up to the front. Records are copied as stored, without decoding them, unless they are in an older format.
+			const std::size_t kept_start = (dropped < stored) ? hist.record_offsets[dropped] : static_cast<std::size_t>(hist.valid_length);
+			const std::size_t kept_length = static_cast<std::size_t>(hist.valid_length) - kept_start;
+			bool written = out.write(u32{ history_magic })
+				and out.write(u32{ history_version })
+				and out.write(static_cast<u64>(hist.first_run + dropped));
+			if (outdated) {
+				for (u64 i = dropped; written and (i < stored); ++i) {
+					journal_delta kept{};
+					written = hist.buf.reposition(hist.record_offsets[i])
+						and read_delta_record(hist.buf, &kept, hist.separators())
+						and write_delta_record(out, kept);
+				}
+			}
+			else {
+				written = written and ((kept_length == 0) or out.write(hist.buf.data() + kept_start, kept_length));
+			}
+			if (not written) {
+				log::error("History: Failed to write kept runs into buffer."sv);
+				return false;
+			}
+		}
+		if (not write_delta_record(out, delta)) {
+			log::error("History: Failed to write run into buffer."sv);
+			return false;
+		}
+
+		if (rewrite) {
+			// Rewritten beside the old one, flushed, and moved in its place in one step, so after a crash at any point the file is either the old one or all of the new one.
+			std::filesystem::path new_history_path{ history_path };
+			new_history_path += ".new";
+			if (not write_dbuf_to_file(new_history_path, out) or not commit_file(new_history_path, history_path)) {
+				log::error("History: Failed to rewrite <{}>."sv, history_path.string());
+				return false;
+			}
+		}
+		else if (not append_dbuf_to_file(history_path, hist.valid_length, out)) {
+			log::error("History: Failed to append to <{}>."sv, history_path.string());
+			return false;
+		}
+
+		log::info("History: Stored run <{}> in <{}>, dropping the oldest <{}>."sv, hist.first_run + stored, history_path.string(), dropped);
+		return true;
+	}
+
+
+	std::optional<diff::vector<history_run>> list_history(const std::filesystem::path& history_path) noexcept {
+		auto opt{ read_history_file(history_path) };
+		if (not opt.has_value()) {
+			return std::nullopt;
+		}
+		const history_file& hist = opt.value();
+
+		diff::vector<history_run> ret{};
+		try {
+			ret.reserve(hist.record_offsets.size());
+			for (std::size_t i = 0; i < hist.record_offsets.size(); ++i) {
+				delta_summary summary{};
+				if (not hist.buf.reposition(hist.record_offsets[i]) or not read_delta_summary(hist.buf, summary)) {
+					log::error("History: Failed to decode run <{}> of <{}>."sv, hist.first_run + i, history_path.string());
+					return std::nullopt;
+				}
+				ret.emplace_back(hist.first_run + i, summary.run_time, summary.created_count, summary.deleted_count);
+			}
+		}
+		catch (...) {
+			log::error("History: Failed to allocate space for the runs of <{}>."sv, history_path.string());
+			return std::nullopt;
+		}
+		return ret;
+	}
+
+
+	std::optional<delta_overlay> history_change(const std::filesystem::path& history_path, const u64 from, const u64 to) noexcept {
+		if (from >= to) {
+			log::error("History: Can only diff an earlier run against a later one (asked for <{}> against <{}>)."sv, from, to);
+			return std::nullopt;
+		}
+
+		auto opt{ read_history_file(history_path) };
+		if (not opt.has_value()) {
+			return std::nullopt;
+		}
+		const history_file& hist = opt.value();
+
+		const u64 last_run = hist.first_run + hist.record_offsets.size() - 1;
+		if (hist.record_offsets.empty() or ((from + 1) < hist.first_run) or (to > last_run)) {
+			log::error("History: States after runs <{}> to <{}> are stored in <{}>, but <{}> to <{}> were asked for."sv, hist.first_run - 1, last_run, history_path.string(), from, to);
+			return std::nullopt;
+		}
+
+		delta_overlay ret{};
+		for (u64 run = from + 1; run <= to; ++run) {
+			journal_delta delta{};
+			if (not hist.buf.reposition(hist.record_offsets[run - hist.first_run]) or not read_delta_record(hist.buf, &delta, hist.separators())) {
+				log::error("History: Failed to decode run <{}> of <{}>."sv, run, history_path.string());
+				return std::nullopt;
+			}
+			try {
+				ret.apply(std::move(delta));
+			}
+			catch (...) {
+				log::error("History: Failed to allocate space for the changes of run <{}>."sv, run);
+				return std::nullopt;
+			}
+		}
+
+		log::info("History: Composed runs <{}> to <{}>: <{}> files added and <{}> removed."sv, from + 1, to, ret.added().size(), ret.removed().size());
+		return ret;
+	}
+
+}
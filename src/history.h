@@ -0,0 +1,32 @@
+#pragma once
+#include "int_defs.h"
+#include "vector_defs.h"
+#include "journal.h"	// journal_delta, delta_overlay
+#include <chrono>
+#include <filesystem>
+#include <optional>
+
+
+namespace diff {
+
+	// History of past runs, each stored as its delta against the run before it, so its size scales with how much changed and not with the tree.
+	// Runs are numbered from 1 and keep their numbers as the oldest are dropped. The state "after run 0" is whatever the first run diffed against.
+	// Any two stored states can be diffed by composing the deltas between them, without the snapshots themselves.
+
+	struct history_run {
+		u64 number{ 0 };
+		std::chrono::seconds run_time{ 0 };
+		u64 created_count{ 0 };
+		u64 deleted_count{ 0 };
+	};
+
+	// Appends delta as the newest run, dropping the oldest ones beyond max_runs.
+	[[nodiscard]] bool append_history(const std::filesystem::path& history_path, const journal_delta& delta, u64 max_runs) noexcept;
+
+	// Stored runs, oldest first. Empty if there is no history yet.
+	[[nodiscard]] std::optional<diff::vector<history_run>> list_history(const std::filesystem::path& history_path) noexcept;
+
+	// Net change from the state after run from to the state after run to. Needs from < to, and every run in (from, to] to be stored.
+	[[nodiscard]] std::optional<delta_overlay> history_change(const std::filesystem::path& history_path, u64 from, u64 to) noexcept;
+
+}
@@ -0,0 +1,374 @@
+#include "journal.h"
+#include "snapshot_format.h"	// header
+#include "filesystem_interface.h"
+#include "keystream.h"
+#include "string_utils.h"		// make_lowercase, make_portable_separators
+#include "logger.h"
+#include <fstream>
+#include <random>
+#include <algorithm>	// std::max
+
+
+namespace diff {
+
+	// Layout: magic, version, base tag, then delta records until the end of the file.
+	// Record: payload length, payload checksum, seed, then the payload, which is one delta encrypted with the lane keystream under that seed.
+	// The checksum covers the payload as stored, so a record torn by a crash mid-append is caught before it is decrypted.
+	enum : u32 {
+		journal_magic = 'JRNL',
+		journal_version = 2,
+		first_portable_journal_version = 2	// Folders separated by '/'. Version 1 journals hold '\\'.
+	};
+	static constexpr std::size_t journal_header_length = sizeof(u32) + sizeof(u32) + sizeof(u64);
+	static constexpr std::size_t record_prefix_length = sizeof(u64) + sizeof(u64) + sizeof(u32);
+
+	// Compact once the journal holds this many runs, or once it is bigger than 1/compaction_size_divisor of its base.
+	enum : u64 {
+		compaction_max_records = 64,
+		compaction_size_divisor = 4
+	};
+
+
+	// FNV-1a. Only guards against torn or garbled records, and tells bases apart, so it needn't be strong.
+	[[nodiscard]] static constexpr u64 fnv1a(const unsigned char* data, const std::size_t length) noexcept {
+		u64 hash = 0xCBF29CE484222325;
+		for (std::size_t i = 0; i < length; ++i) {
+			hash ^= data[i];
+			hash *= 0x100000001B3;
+		}
+		return hash;
+	}
+
+
+	file_record file_record::from(const snapshot_entry& entry) {
+		return file_record{
+			diff::u8string{ entry.parent },
+			diff::u8string{ entry.parent_lower },
+			diff::u8string{ entry.filename },
+			diff::u8string{ entry.filename_lower },
+			diff::u8string{ entry.owner },
+			entry.size_in_bytes,
+			entry.last_write
+		};
+	}
+
+	file_record file_record::from(const file& f) {
+		return file_record{
+			f.original_path.parent_path().generic_u8string(),
+			f.parent.str_cref(),
+			f.original_path.filename().u8string(),
+			f.filename.str_cref(),
+			f.owner.val,
+			f.size_in_bytes,
+			f.last_write
+		};
+	}
+
+	snapshot_entry file_record::view() const noexcept {
+		return snapshot_entry{ parent, parent_lower, filename, filename_lower, owner, size_in_bytes, last_write };
+	}
+
+
+	void delta_overlay::apply(journal_delta&& delta) {
+		// A single delta never both creates and deletes the same file, so the order between its two lists doesn't matter.
+		for (auto& rec : delta.deleted) {
+			record_key key{ rec.parent_lower, rec.filename_lower };
+			if (const auto it{ added_files.find(key) }; it != added_files.end()) {
+				added_files.erase(it);	// Created after the first state. Now it was never there as far as the net effect goes.
+			}
+			else {
+				removed_files.try_emplace(std::move(key), std::move(rec));
+			}
+		}
+		for (auto& rec : delta.created) {
+			record_key key{ rec.parent_lower, rec.filename_lower };
+			added_files.insert_or_assign(std::move(key), std::move(rec));
+		}
+	}
+
+
+	[[nodiscard]] static bool write_records(dynamic_buffer& buf, const diff::vector<file_record>& records) noexcept {
+		bool written = buf.write_varint(records.size());
+		for (const auto& rec : records) {
+			written = written
+				and buf.write_varint_string(rec.parent)
+				and buf.write_varint_string(rec.filename)
+				and buf.write_varint_string(rec.owner)
+				and buf.write_varint(rec.size_in_bytes)
+				and buf.write_varint(varint::zigzag(static_cast<i64>(rec.last_write.count())));
+		}
+		return written;
+	}
+
+	[[nodiscard]] static bool read_records(const dynamic_buffer& buf, diff::vector<file_record>& records, const delta_separators separators) noexcept {
+		u64 count = 0;
+		if (not buf.read_varint(count) or (count > (buf.length() - buf.position()))) { // Every record takes at least one byte.
+			return false;
+		}
+		try {
+			records.resize(count);
+			for (auto& rec : records) {
+				u8string_view parent{};
+				u8string_view filename{};
+				u8string_view owner{};
+				u64 last_write = 0;
+				if (not (buf.read_varint_string_view(parent)
+					and buf.read_varint_string_view(filename)
+					and buf.read_varint_string_view(owner)
+					and buf.read_varint(rec.size_in_bytes)
+					and buf.read_varint(last_write)))
+				{
+					return false;
+				}
+				rec.last_write = std::chrono::seconds{ varint::unzigzag(last_write) };
+				rec.parent.assign(parent);
+				rec.parent_lower.assign(parent);
+				rec.filename.assign(filename);
+				rec.filename_lower.assign(filename);
+				rec.owner.assign(owner);
+				if (separators == delta_separators::windows) {
+					make_portable_separators(rec.parent);
+					make_portable_separators(rec.parent_lower);
+				}
+				make_lowercase(rec.parent_lower);
+				make_lowercase(rec.filename_lower);
+			}
+		}
+		catch (...) {
+			return false;
+		}
+		return true;
+	}
+
+	// Walks the records read_records would read, only counting them. Strings are skipped over as views, so nothing is copied or allocated.
+	[[nodiscard]] static bool count_records(const dynamic_buffer& buf, u64& count) noexcept {
+		if (not buf.read_varint(count) or (count > (buf.length() - buf.position()))) {
+			return false;
+		}
+		for (u64 i = 0; i < count; ++i) {
+			u8string_view skipped{};
+			u64 number = 0;
+			if (not (buf.read_varint_string_view(skipped)
+				and buf.read_varint_string_view(skipped)
+				and buf.read_varint_string_view(skipped)
+				and buf.read_varint(number)
+				and buf.read_varint(number)))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool write_delta(dynamic_buffer& buf, const journal_delta& delta) noexcept {
+		return buf.write_varint(varint::zigzag(static_cast<i64>(delta.run_time.count())))
+			and write_records(buf, delta.created)
+			and write_records(buf, delta.deleted);
+	}
+
+	bool read_delta(const dynamic_buffer& buf, journal_delta& delta, const delta_separators separators) noexcept {
+		u64 run_time = 0;
+		if (not buf.read_varint(run_time)) {
+			return false;
+		}
+		delta.run_time = std::chrono::seconds{ varint::unzigzag(run_time) };
+		return read_records(buf, delta.created, separators) and read_records(buf, delta.deleted, separators);
+	}
+
+
+	bool write_delta_record(dynamic_buffer& buf, const journal_delta& delta) noexcept {
+		dynamic_buffer payload{};
+		if (not write_delta(payload, delta)) {
+			return false;
+		}
+		const u32 seed = std::random_device{}();
+		keystream::encrypt(payload.begin(), payload.length(), 0, seed);
+
+		return buf.expand_for_extra(record_prefix_length + payload.length())
+			and buf.write(static_cast<u64>(payload.length()))
+			and buf.write(fnv1a(payload.data(), payload.length()))
+			and buf.write(seed)
+			and buf.write(payload.data(), payload.length());
+	}
+
+	// Checks the framing of the record at the cursor, and leaves the cursor at its payload, which ends at payload_end.
+	[[nodiscard]] static bool read_record_frame(const dynamic_buffer& buf, std::size_t& payload_end, u32& seed) noexcept {
+		u64 payload_length = 0;
+		u64 checksum = 0;
+		if (not (buf.read(payload_length)
+			and buf.read(checksum)
+			and buf.read(seed)
+			and (payload_length <= (buf.length() - buf.position()))
+			and (fnv1a(buf.begin() + buf.position(), static_cast<std::size_t>(payload_length)) == checksum)))
+		{
+			return false;
+		}
+		payload_end = buf.position() + static_cast<std::size_t>(payload_length);
+		return true;
+	}
+
+	bool read_delta_record(const dynamic_buffer& buf, journal_delta* delta, const delta_separators separators) noexcept {
+		std::size_t payload_end = 0;
+		u32 seed = 0;
+		if (not read_record_frame(buf, payload_end, seed)) {
+			return false;
+		}
+		if (delta == nullptr) {
+			return buf.reposition(payload_end);
+		}
+		keystream::decrypt(buf.begin() + buf.position(), payload_end - buf.position(), 0, seed);
+		return read_delta(buf, *delta, separators) and (buf.position() == payload_end);
+	}
+
+	bool read_delta_summary(const dynamic_buffer& buf, delta_summary& summary) noexcept {
+		std::size_t payload_end = 0;
+		u32 seed = 0;
+		if (not read_record_frame(buf, payload_end, seed)) {
+			return false;
+		}
+		keystream::decrypt(buf.begin() + buf.position(), payload_end - buf.position(), 0, seed);
+		u64 run_time = 0;
+		if (not buf.read_varint(run_time)) {
+			return false;
+		}
+		summary.run_time = std::chrono::seconds{ varint::unzigzag(run_time) };
+		return count_records(buf, summary.created_count) and count_records(buf, summary.deleted_count) and (buf.position() == payload_end);
+	}
+
+
+	std::optional<u64> snapshot_tag(const std::filesystem::path& snapshot_path) noexcept {
+		try {
+			std::ifstream ifs{ snapshot_path, std::ios::binary };
+			unsigned char bytes[sizeof(header)]{};
+			if (not ifs.is_open() or not ifs.read(reinterpret_cast<char*>(bytes), sizeof(bytes))) {
+				log::error("Journal: Failed to read the header of <{}>."sv, snapshot_path.string());
+				return std::nullopt;
+			}
+			return fnv1a(bytes, sizeof(bytes)); // The header's random block differs on every write.
+		}
+		catch (std::exception& ex) {
+			log::error("Journal: Exception thrown while reading <{}>: {}"sv, snapshot_path.string(), ex.what());
+			return std::nullopt;
+		}
+	}
+
+
+	std::optional<journal_contents> read_journal(const std::filesystem::path& journal_path, const u64 base_tag) noexcept {
+		journal_contents ret{};
+
+		std::error_code ec{};
+		if (const bool exists = std::filesystem::exists(journal_path, ec); ec) {
+			log::error("Journal: Failed to check whether <{}> exists."sv, journal_path.string());
+			return std::nullopt;
+		}
+		else if (not exists) {
+			log::info("Journal: No journal at <{}>."sv, journal_path.string());
+			return ret;
+		}
+
+		auto opt_buf{ read_dbuf_from_file(journal_path) };
+		if (not opt_buf.has_value()) {
+			log::error("Journal: Failed to read <{}>."sv, journal_path.string());
+			return std::nullopt;
+		}
+		dynamic_buffer& buf = opt_buf.value();
+		buf.rewind();
+
+		u32 magic = 0;
+		u32 version = 0;
+		u64 tag = 0;
+		if (not buf.read(magic) or not buf.read(version) or not buf.read(tag) or (magic != journal_magic) or (version == 0) or (version > journal_version)) {
+			log::warning("Journal: <{}> is not a readable journal. Ignoring it."sv, journal_path.string());
+			return ret;
+		}
+		if (tag != base_tag) {
+			log::info("Journal: <{}> belongs to an older base snapshot. Ignoring it."sv, journal_path.string());
+			return ret;
+		}
+		ret.valid_length = buf.position();
+		ret.outdated = version != journal_version;
+		const delta_separators separators = (version >= first_portable_journal_version) ? delta_separators::portable : delta_separators::windows;
+
+		while (buf.position() < buf.length()) {
+			journal_delta delta{};
+			if (not read_delta_record(buf, &delta, separators)) {
+				log::warning("Journal: Record #{} of <{}> is torn or corrupt. Ignoring it and everything after it (<{}> bytes)."sv, ret.record_count + 1, journal_path.string(), buf.length() - ret.valid_length);
+				break;
+			}
+
+			try {
+				ret.overlay.apply(std::move(delta));
+			}
+			catch (...) {
+				log::error("Journal: Failed to allocate space for record #{} of <{}>."sv, ret.record_count + 1, journal_path.string());
+				return std::nullopt;
+			}
+			++ret.record_count;
+			ret.valid_length = buf.position();
+		}
+
+		log::info("Journal: Read <{}> records from <{}>: <{}> files added and <{}> removed since the base snapshot."sv, ret.record_count, journal_path.string(), ret.overlay.added().size(), ret.overlay.removed().size());
+		return ret;
+	}
+
+
+	bool append_journal(const std::filesystem::path& journal_path, const u64 base_tag, const u64 valid_length, const journal_delta& delta) noexcept {
+		dynamic_buffer record{};
+		if ((valid_length == 0) and not (record.write(u32{ journal_magic }) and record.write(u32{ journal_version }) and record.write(base_tag))) {
+			log::error("Journal: Failed to write journal header into buffer."sv);
+			return false;
+		}
+		if (not write_delta_record(record, delta)) {
+			log::error("Journal: Failed to write record into buffer."sv);
+			return false;
+		}
+
+		if (not append_dbuf_to_file(journal_path, valid_length, record)) {
+			log::error("Journal: Failed to append to <{}>."sv, journal_path.string());
+			return false;
+		}
+		if (not flush_file(journal_path)) {
+			log::error("Journal: Appended to <{}>, but the record may not be on disk yet."sv, journal_path.string());
+			return false;
+		}
+
+		log::info("Journal: Appended <{}> byte record (<{}> created, <{}> deleted) to <{}>."sv, record.length(), delta.created.size(), delta.deleted.size(), journal_path.string());
+		return true;
+	}
+
+
+	bool truncate_journal(const std::filesystem::path& journal_path, const u64 length) noexcept {
+		std::error_code ec{};
+		if (length == 0) {
+			std::filesystem::remove(journal_path, ec);
+		}
+		else {
+			std::filesystem::resize_file(journal_path, length, ec);
+		}
+		if (ec) {
+			log::error("Journal: Failed to cut <{}> back to <{}> bytes."sv, journal_path.string(), length);
+			return false;
+		}
+		log::info("Journal: Cut <{}> back to <{}> bytes."sv, journal_path.string(), length);
+		return true;
+	}
+
+
+	// Upper bound of what write_records takes for records, short of encrypting it.
+	[[nodiscard]] static u64 records_size_bound(const diff::vector<file_record>& records) noexcept {
+		u64 ret = varint::max_u64_bytes;
+		for (const auto& rec : records) {
+			ret += (5 * varint::max_u64_bytes) + rec.parent.length() + rec.filename.length() + rec.owner.length();
+		}
+		return ret;
+	}
+
+	bool should_compact(const journal_contents& journal, const journal_delta& pending, const u64 base_length) noexcept {
+		if (journal.outdated) {
+			return true;
+		}
+		const u64 grown_length = std::max<u64>(journal.valid_length, journal_header_length) + record_prefix_length + varint::max_u64_bytes + records_size_bound(pending.created) + records_size_bound(pending.deleted);
+		return ((journal.record_count + 1) >= compaction_max_records) or ((grown_length * compaction_size_divisor) > base_length);
+	}
+
+}
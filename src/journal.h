@@ -0,0 +1,137 @@
+#pragma once
+#include "int_defs.h"
+#include "string_defs.h"
+#include "vector_defs.h"
+#include "file.h"
+#include "snapshot_view.h"	// snapshot_entry
+#include "dynamic_buffer.h"
+#include <chrono>
+#include <compare>
+#include <filesystem>
+#include <map>
+#include <optional>
+
+
+namespace diff {
+
+	// Owning counterpart of snapshot_entry, for files that must outlive the snapshot or scan they came from.
+	struct file_record {
+		diff::u8string parent{};			// Relative to root, case-preserved.
+		diff::u8string parent_lower{};
+		diff::u8string filename{};			// Case-preserved.
+		diff::u8string filename_lower{};
+		diff::u8string owner{};
+		u64 size_in_bytes{ 0 };
+		std::chrono::seconds last_write{ 0 };
+
+		// Throw on allocation failure.
+		[[nodiscard]] static file_record from(const snapshot_entry& entry);
+		[[nodiscard]] static file_record from(const file& f);
+
+		// Views into this record. Valid while it is alive and unchanged.
+		[[nodiscard]] snapshot_entry view() const noexcept;
+	};
+
+	// Lowercase parent and filename. Ordered the same way as file.
+	struct record_key {
+		diff::u8string parent_lower{};
+		diff::u8string filename_lower{};
+
+		[[nodiscard]] std::strong_ordering operator<=>(const record_key&) const noexcept = default;
+		[[nodiscard]] bool operator==(const record_key&) const noexcept = default;
+
+		[[nodiscard]] std::strong_ordering operator<=>(const snapshot_entry& rhs) const noexcept {
+			const auto parent_cmp = u8string_view{ parent_lower } <=> rhs.parent_lower;
+			return parent_cmp != 0 ? parent_cmp : u8string_view{ filename_lower } <=> rhs.filename_lower;
+		}
+	};
+
+
+	// What one run changed: files that appeared and files that disappeared, both in snapshot order.
+	struct journal_delta {
+		std::chrono::seconds run_time{ 0 };
+		diff::vector<file_record> created{};
+		diff::vector<file_record> deleted{};
+	};
+
+	// Net effect of consecutive deltas, on top of the state before the first one. Memory is proportional to the changes, not to the state.
+	class delta_overlay {
+	public:
+		// Throws on allocation failure.
+		void apply(journal_delta&& delta);
+
+		// Files present now that weren't before, and files present before (as they were then) that aren't now.
+		// A file deleted and created again between the two states is in both.
+		[[nodiscard]] const std::map<record_key, file_record>& added() const noexcept { return added_files; }
+		[[nodiscard]] const std::map<record_key, file_record>& removed() const noexcept { return removed_files; }
+
+		// Moves every change into the overlay part_of(parent_lower) picks for it, leaving this one empty. Records are moved whole, never copied.
+		// Throws if part_of does, in which case the change being moved is lost.
+		template<typename PartOf>
+		void split(PartOf&& part_of) {
+			while (not added_files.empty()) {
+				auto node{ added_files.extract(added_files.begin()) };
+				auto& part_files{ part_of(u8string_view{ node.key().parent_lower }).added_files };
+				part_files.insert(part_files.end(), std::move(node));
+			}
+			while (not removed_files.empty()) {
+				auto node{ removed_files.extract(removed_files.begin()) };
+				auto& part_files{ part_of(u8string_view{ node.key().parent_lower }).removed_files };
+				part_files.insert(part_files.end(), std::move(node));
+			}
+		}
+
+	private:
+		std::map<record_key, file_record> added_files{};
+		std::map<record_key, file_record> removed_files{};
+	};
+
+
+	// How stored deltas separate folders. Everything is written with '/', whatever the OS. Files from before that hold the '\\' of Windows, the only OS that wrote them.
+	enum class delta_separators { portable, windows };
+
+	// Delta encoding, shared by everything that stores deltas. Strings are stored case-preserved, lowercase is derived on load.
+	[[nodiscard]] bool write_delta(dynamic_buffer& buf, const journal_delta& delta) noexcept;
+	[[nodiscard]] bool read_delta(const dynamic_buffer& buf, journal_delta& delta, delta_separators separators) noexcept;
+
+	// Record framing, shared by everything that stores deltas in a file: length, checksum and seed, then the delta encrypted under that seed.
+	[[nodiscard]] bool write_delta_record(dynamic_buffer& buf, const journal_delta& delta) noexcept;
+	// Reads the record at the cursor, decrypting it in place, or only checks and skips it if delta is null. Fails on a torn or corrupt record, leaving the cursor anywhere.
+	[[nodiscard]] bool read_delta_record(const dynamic_buffer& buf, journal_delta* delta, delta_separators separators) noexcept;
+
+	struct delta_summary {
+		std::chrono::seconds run_time{ 0 };
+		u64 created_count{ 0 };
+		u64 deleted_count{ 0 };
+	};
+
+	// Same as read_delta_record, but only counts the files the record lists, without copying out a single string. Separators don't matter then.
+	[[nodiscard]] bool read_delta_summary(const dynamic_buffer& buf, delta_summary& summary) noexcept;
+
+
+	// The journal sits next to a base snapshot, and holds the deltas of every run since that snapshot was written, in order.
+	// It is tied to its base by a tag (the manifest's, or one taken from the header of a single snapshot from before shards), so a journal left behind by an older base is recognized and ignored.
+
+	struct journal_contents {
+		delta_overlay overlay{};
+		u64 record_count{ 0 };
+		u64 valid_length{ 0 };	// Bytes up to the end of the last intact record. 0 if there is no usable journal.
+		bool outdated{ false };	// Written in an older format, so it must not be appended to. Compacting starts a new one.
+	};
+
+	[[nodiscard]] std::optional<u64> snapshot_tag(const std::filesystem::path& snapshot_path) noexcept;
+
+	// A missing journal, or one that belongs to another base, reads as empty. A torn last record (from a crash mid-append) is dropped.
+	[[nodiscard]] std::optional<journal_contents> read_journal(const std::filesystem::path& journal_path, u64 base_tag) noexcept;
+
+	// Appends after the first valid_length bytes, cutting off anything past them. A valid_length of 0 starts a new journal.
+	// Returns once the record is on disk.
+	[[nodiscard]] bool append_journal(const std::filesystem::path& journal_path, u64 base_tag, u64 valid_length, const journal_delta& delta) noexcept;
+
+	// Cuts the journal back to length bytes, e.g. to undo an append. A length of 0 deletes it.
+	[[nodiscard]] bool truncate_journal(const std::filesystem::path& journal_path, u64 length) noexcept;
+
+	// Whether the journal, with pending appended, would have grown enough that its base (base_length bytes on disk) should be rewritten with everything folded in instead. Always true for an outdated journal.
+	[[nodiscard]] bool should_compact(const journal_contents& journal, const journal_delta& pending, u64 base_length) noexcept;
+
+}
@@ -0,0 +1,183 @@
+#include "keystream.h"
+#include <array>
+#include <algorithm>	// std::min
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2)) || defined(__SSE2__)
+#define DIRDIFFER_KEYSTREAM_SSE2
+#include <emmintrin.h>
+#endif
+
+
+namespace diff::keystream {
+
+	enum class operation { add, subtract };
+
+	// gamerand, one instance per lane, laid out so the SIMD path can load all lanes' halves at once.
+	struct lane_states {
+
+		constexpr lane_states(const u32 seed, const u64 segment) noexcept {
+			for (u32 lane = 0; lane < lane_count; ++lane) {
+				const u32 lane_seed = mix(mix(seed ^ static_cast<u32>(segment)) + (static_cast<u32>(segment >> 32) * 0x85EBCA6Bu) + ((lane + 1) * 0x9E3779B9u));
+				high[lane] = lane_seed;
+				low[lane] = lane_seed ^ magic_xor;
+			}
+		}
+
+		// Same as gamerand::next(), for every lane. Writes each lane's output as 4 little endian bytes.
+		constexpr void step(unsigned char (&out)[step_length]) noexcept {
+			for (std::size_t lane = 0; lane < lane_count; ++lane) {
+				high[lane] = (high[lane] >> u32{ 16 }) + (high[lane] << u32{ 16 });
+				high[lane] += low[lane];
+				low[lane] += high[lane];
+				for (std::size_t byte = 0; byte < sizeof(u32); ++byte) {
+					out[(lane * sizeof(u32)) + byte] = static_cast<unsigned char>(high[lane] >> (8 * byte));
+				}
+			}
+		}
+
+		constexpr void skip(std::size_t steps) noexcept {
+			unsigned char discard[step_length]{};
+			for (; steps != 0; --steps) {
+				step(discard);
+			}
+		}
+
+		enum : u32 { magic_xor = 0x49616E42 }; // Same as gamerand.
+
+		// MurmurHash3 finalizer. Spreads similar seeds and segment indices apart before they become lane states.
+		[[nodiscard]] static constexpr u32 mix(u32 h) noexcept {
+			h ^= h >> 16;
+			h *= 0x85EBCA6Bu;
+			h ^= h >> 13;
+			h *= 0xC2B2AE35u;
+			h ^= h >> 16;
+			return h;
+		}
+
+		alignas(16) std::array<u32, lane_count> high{};
+		alignas(16) std::array<u32, lane_count> low{};
+	};
+
+	// Lanes must stay interchangeable with gamerand, or the stream is just some other generator.
+	static_assert([] {
+		lane_states lanes{ 0, 0 };
+		gamerand reference{ lanes.high[3] };
+		unsigned char out[step_length]{};
+		for (int i = 0; i < 100; ++i) {
+			lanes.step(out);
+			const u32 expected = reference.next();
+			const u32 got = u32{ out[12] } | (u32{ out[13] } << 8) | (u32{ out[14] } << 16) | (u32{ out[15] } << 24);
+			if (expected != got) {
+				return false;
+			}
+		}
+		return true;
+	}(), "Keystream lanes diverged from gamerand.");
+
+
+	template<operation op>
+	static void apply_bytes(unsigned char* data, const unsigned char* key, const std::size_t length) noexcept {
+		for (std::size_t i = 0; i < length; ++i) {
+			if constexpr (op == operation::add) {
+				data[i] += key[i];
+			}
+			else {
+				data[i] -= key[i];
+			}
+		}
+	}
+
+	// Applies whole steps. This is where all the time goes.
+	template<operation op>
+	static void apply_steps(lane_states& lanes, unsigned char* data, std::size_t steps) noexcept {
+#ifdef DIRDIFFER_KEYSTREAM_SSE2
+		__m128i high0 = _mm_load_si128(reinterpret_cast<const __m128i*>(lanes.high.data()));
+		__m128i high1 = _mm_load_si128(reinterpret_cast<const __m128i*>(lanes.high.data() + 4));
+		__m128i low0 = _mm_load_si128(reinterpret_cast<const __m128i*>(lanes.low.data()));
+		__m128i low1 = _mm_load_si128(reinterpret_cast<const __m128i*>(lanes.low.data() + 4));
+
+		for (; steps != 0; --steps, data += step_length) {
+			// high = rotl(high, 16) + low; low += high;
+			high0 = _mm_add_epi32(_mm_or_si128(_mm_srli_epi32(high0, 16), _mm_slli_epi32(high0, 16)), low0);
+			high1 = _mm_add_epi32(_mm_or_si128(_mm_srli_epi32(high1, 16), _mm_slli_epi32(high1, 16)), low1);
+			low0 = _mm_add_epi32(low0, high0);
+			low1 = _mm_add_epi32(low1, high1);
+
+			// x86 is little endian, so the lanes' bytes already sit in stream order.
+			__m128i data0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+			__m128i data1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16));
+			if constexpr (op == operation::add) {
+				data0 = _mm_add_epi8(data0, high0);
+				data1 = _mm_add_epi8(data1, high1);
+			}
+			else {
+				data0 = _mm_sub_epi8(data0, high0);
+				data1 = _mm_sub_epi8(data1, high1);
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(data), data0);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(data + 16), data1);
+		}
+
+		_mm_store_si128(reinterpret_cast<__m128i*>(lanes.high.data()), high0);
+		_mm_store_si128(reinterpret_cast<__m128i*>(lanes.high.data() + 4), high1);
+		_mm_store_si128(reinterpret_cast<__m128i*>(lanes.low.data()), low0);
+		_mm_store_si128(reinterpret_cast<__m128i*>(lanes.low.data() + 4), low1);
+#else
+		unsigned char key[step_length]{};
+		for (; steps != 0; --steps, data += step_length) {
+			lanes.step(key);
+			apply_bytes<op>(data, key, step_length);
+		}
+#endif
+	}
+
+	// [data, data + length) must lie within a single segment, starting at segment_offset into it.
+	template<operation op>
+	static void apply_segment(unsigned char* data, std::size_t length, const std::size_t segment_offset, const u32 seed, const u64 segment) noexcept {
+		lane_states lanes{ seed, segment };
+		lanes.skip(segment_offset / step_length);
+
+		unsigned char key[step_length]{};
+
+		// Partial leading step.
+		if (const std::size_t head = segment_offset % step_length; head != 0) {
+			lanes.step(key);
+			const std::size_t count = std::min(length, step_length - head);
+			apply_bytes<op>(data, key + head, count);
+			data += count;
+			length -= count;
+		}
+
+		apply_steps<op>(lanes, data, length / step_length);
+		data += length - (length % step_length);
+		length %= step_length;
+
+		// Partial trailing step.
+		if (length != 0) {
+			lanes.step(key);
+			apply_bytes<op>(data, key, length);
+		}
+	}
+
+	template<operation op>
+	static void apply(unsigned char* data, std::size_t length, u64 body_offset, const u32 seed) noexcept {
+		while (length != 0) {
+			const std::size_t segment_offset = static_cast<std::size_t>(body_offset % segment_length);
+			const std::size_t count = std::min(length, segment_length - segment_offset);
+			apply_segment<op>(data, count, segment_offset, seed, body_offset / segment_length);
+			data += count;
+			length -= count;
+			body_offset += count;
+		}
+	}
+
+
+	void encrypt(unsigned char* data, const std::size_t length, const u64 body_offset, const u32 seed) noexcept {
+		apply<operation::add>(data, length, body_offset, seed);
+	}
+
+	void decrypt(unsigned char* data, const std::size_t length, const u64 body_offset, const u32 seed) noexcept {
+		apply<operation::subtract>(data, length, body_offset, seed);
+	}
+
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include "int_defs.h"
+#include "rng.h"
+#include <cstddef>	// std::size_t
+
+
+namespace diff::keystream {
+
+	// Snapshot body obfuscation. Bytes are ADDED to on encryption and SUBTRACTED from on decryption.
+
+	// Version 4 and later.
+	// 8 independent gamerand lanes, stepped together, each contributing all 4 bytes of its output per step, so one step covers 32 bytes.
+	// The body is split into segments, and lanes are reseeded from (seed, segment index) at the start of each, so any range can be processed on its own.
+	enum : std::size_t {
+		lane_count = 8,
+		step_length = lane_count * sizeof(u32),
+		segment_length = std::size_t{ 64 } * 1024
+	};
+	static_assert((segment_length % step_length) == 0, "Keystream segments must hold a whole number of steps.");
+
+	// body_offset is the offset of data from the start of the body, i.e. from the end of the header. Any offset and length are fine.
+	void encrypt(unsigned char* data, std::size_t length, u64 body_offset, u32 seed) noexcept;
+	void decrypt(unsigned char* data, std::size_t length, u64 body_offset, u32 seed) noexcept;
+
+
+	// Versions 1 to 3. One gamerand call per byte, keeping only its low byte. Strictly sequential.
+	class legacy {
+	public:
+		explicit constexpr legacy(const u32 seed) noexcept : rng{ seed } {}
+
+		constexpr void encrypt(unsigned char* data, const std::size_t length) noexcept {
+			for (unsigned char* it = data, *end = data + length; it != end; ++it) {
+				*it += static_cast<unsigned char>(rng.next());	// ADD a random value to every byte.
+			}
+		}
+		constexpr void decrypt(unsigned char* data, const std::size_t length) noexcept {
+			for (unsigned char* it = data, *end = data + length; it != end; ++it) {
+				*it -= static_cast<unsigned char>(rng.next());	// SUBTRACT a random value from every byte.
+			}
+		}
+
+	private:
+		gamerand rng;
+	};
+
+}
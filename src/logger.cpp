@@ -1,55 +1,327 @@
 #include "logger.h"
+#include "int_defs.h"
 #include <fstream>
-// #include <chrono> // Timestamp log messages.
+#include <atomic>
+#include <thread>
+#include <algorithm>	// std::copy_n, std::min
+#include <bit>			// std::has_single_bit
+#include <chrono>
+#include <cstdint>		// std::uintptr_t
 
 
 namespace diff {
-	
+
+	// Messages go through a fixed ring of slots, so logging never allocates or waits on the disk. Any thread can queue a message, and only the writer thread takes them off,
+	// copying them into one big buffer, and writing it out in one go once the ring is empty or the buffer is full.
+	// If the writer falls behind and the ring fills up, info and warning messages give it a few chances to catch up, and are then dropped and counted. The count is logged once there is room again.
+	// Errors and critical messages wait for room instead, since they are the ones that explain a failed run.
+	// Separately, each call site may only log so many messages every few seconds, so a tree with a million unreadable files logs a handful of them and a count, instead of a million lines.
 	class log::log_impl { // Yes, this is valid syntax.
 	public:
-		[[nodiscard]] bool init(const std::filesystem::path& log_file_path) noexcept {
-			ofs.open(log_file_path,std::ios_base::binary);
-			return ofs.is_open();
-		}
-		
-		bool write(string_view msg) noexcept {
-			if (not ofs.is_open()) {
-				return false;
+		log_impl() noexcept {
+			for (std::size_t i = 0; i < slot_count; ++i) {
+				slots[i].sequence.store(i, std::memory_order::relaxed);
 			}
+		}
+		~log_impl() noexcept {
+			stop();
+		}
+		log_impl(const log_impl&) = delete;
+		log_impl& operator=(const log_impl&) = delete;
+
+		[[nodiscard]] bool init(const std::filesystem::path& log_file_path) noexcept {
+			stop();
 			try {
-				ofs << msg;
+				ofs.open(log_file_path, std::ios_base::binary);
+				if (not ofs.is_open()) {
+					return false;
+				}
+				stopping.store(false, std::memory_order::relaxed);
+				writer = std::thread{ [this]() noexcept { write_until_stopped(); } };
+				running.store(true, std::memory_order::release);
 				return true;
 			}
 			catch (...) {
+				ofs.close();
+				return false;
+			}
+		}
+
+		bool push(string_view msg, const severity sev) noexcept {
+			if (not running.load(std::memory_order::acquire)) {
 				return false;
 			}
+
+			u64 pos = enqueue_pos.load(std::memory_order::relaxed);
+			slot* target = nullptr;
+			for (u32 waits = 0;;) {
+				target = &slots[pos & index_mask];
+				const u64 sequence = target->sequence.load(std::memory_order::acquire);
+				if (sequence == pos) {
+					if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order::relaxed)) {
+						break; // The slot is ours.
+					}
+				}
+				else if (sequence < pos) { // Still holds the message from a lap ago, so the ring is full.
+					if ((sev < severity::sev_error) and (++waits > max_waits_when_full)) {
+						dropped.fetch_add(1, std::memory_order::relaxed);
+						return false;
+					}
+					if (not running.load(std::memory_order::relaxed)) {
+						return false;
+					}
+					wake_writer(); // Usually it just hasn't had a turn on a core yet.
+					std::this_thread::yield();
+					pos = enqueue_pos.load(std::memory_order::relaxed);
+				}
+				else { // Another thread took it first.
+					pos = enqueue_pos.load(std::memory_order::relaxed);
+				}
+			}
+
+			target->sev = sev;
+			target->length = static_cast<u32>(std::min(msg.length(), std::size_t{ max_message_length }));
+			std::copy_n(msg.data(), target->length, target->text.data());
+			target->sequence.store(pos + 1, std::memory_order::release);
+
+			// The writer announces it is going to sleep before it checks the ring one last time, so this either sees it, or it sees the message.
+			std::atomic_thread_fence(std::memory_order::seq_cst);
+			if (writer_sleeping.load(std::memory_order::relaxed)) {
+				wake_writer();
+			}
+			return true;
+		}
+
+		[[nodiscard]] bool within_rate(string_view fmt, const severity sev) noexcept {
+			if (sev == severity::sev_critical) {
+				return true; // Never held back. There is at most one per run anyway.
+			}
+			call_site* const site{ find_site(fmt, sev) };
+			if (site == nullptr) {
+				return true; // More distinct call sites than the table fits, which the program doesn't have.
+			}
+
+			const u64 window{ static_cast<u64>(std::chrono::steady_clock::now().time_since_epoch() / rate_window) };
+			u64 site_window{ site->window.load(std::memory_order::relaxed) };
+			if ((site_window != window) and site->window.compare_exchange_strong(site_window, window, std::memory_order::relaxed)) {
+				site->count.store(0, std::memory_order::relaxed); // Racing callers may slip one or two past the limit, which is fine.
+				report_suppressed(*site, fmt, sev);
+			}
+			if (site->count.fetch_add(1, std::memory_order::relaxed) < max_per_window) {
+				return true;
+			}
+			site->suppressed.fetch_add(1, std::memory_order::relaxed);
+			return false;
 		}
-		
+
 	private:
+		static constexpr std::chrono::seconds rate_window{ 10 };
+
+		enum : u64 {
+			slot_count = 1024,
+			index_mask = slot_count - 1,
+			batch_size = u64{ 64 } * 1024,
+			max_waits_when_full = 16,	// Times an info or warning message lets the writer catch up before it is dropped.
+			site_count = 256,
+			site_mask = site_count - 1,
+			max_site_probes = 32,
+			max_per_window = 20,		// Messages a call site may log per rate_window.
+			max_quoted_length = 400		// Of a suppressed call site's format string, in its summary.
+		};
+		static_assert(std::has_single_bit(static_cast<u64>(slot_count)));
+		static_assert(std::has_single_bit(static_cast<u64>(site_count)));
+
+		struct slot {
+			std::atomic<u64> sequence{ 0 };	// Position it is free to be queued at, or that plus 1 once a message is in it.
+			severity sev{ severity::sev_info };
+			u32 length{ 0 };
+			std::array<char, max_message_length> text{};
+		};
+
+		struct call_site {
+			std::atomic<const char*> fmt{ nullptr };	// Null while the entry is free. Claimed for good once set.
+			std::atomic<std::size_t> length{ 0 };
+			std::atomic<severity> sev{ severity::sev_info };
+			std::atomic<u64> window{ 0 };
+			std::atomic<u64> count{ 0 };				// Messages logged in window.
+			std::atomic<u64> suppressed{ 0 };			// Not logged since the last summary.
+		};
+
+		std::array<slot, slot_count> slots{};
+		std::array<call_site, site_count> sites{};
+		alignas(64) std::atomic<u64> enqueue_pos{ 0 };
+		alignas(64) u64 dequeue_pos{ 0 };	// Only the writer touches this.
+		std::atomic<u64> dropped{ 0 };
+		std::atomic<bool> writer_sleeping{ false };
+		std::atomic<bool> stopping{ false };
+		std::atomic<bool> running{ false };
+		std::thread writer{};
 		std::ofstream ofs{};
+		std::array<char, batch_size> batch{};
+		std::size_t batch_fill{ 0 };
+		u64 dropped_reported{ 0 };
+
+		void wake_writer() noexcept {
+			if (writer_sleeping.exchange(false, std::memory_order::relaxed)) {
+				writer_sleeping.notify_one();
+			}
+		}
+
+		// Format strings are literals, so a call site's one always has the same address, and that is hashed to find its entry.
+		[[nodiscard]] call_site* find_site(string_view fmt, const severity sev) noexcept {
+			const u64 hash{ static_cast<u64>(reinterpret_cast<std::uintptr_t>(fmt.data())) * u64{ 0x9E3779B97F4A7C15 } };
+			for (u64 probe = 0; probe < max_site_probes; ++probe) {
+				call_site& site{ sites[((hash >> 56) + probe) & site_mask] };
+				const char* key{ site.fmt.load(std::memory_order::acquire) };
+				if ((key == nullptr) and site.fmt.compare_exchange_strong(key, fmt.data(), std::memory_order::acq_rel)) {
+					site.length.store(fmt.length(), std::memory_order::relaxed);
+					site.sev.store(sev, std::memory_order::relaxed);
+					return &site;
+				}
+				if (key == fmt.data()) {
+					return &site;
+				}
+			}
+			return nullptr;
+		}
+
+		void report_suppressed(call_site& site, string_view fmt, const severity sev) noexcept {
+			const u64 suppressed{ site.suppressed.exchange(0, std::memory_order::relaxed) };
+			if (suppressed == 0) {
+				return;
+			}
+			std::array<char, max_message_length> buf{};
+			const auto res{ std::format_to_n(buf.data(), buf.size(), "Log: <{}> more messages like \"{}\" were suppressed."sv, suppressed, fmt.substr(0, max_quoted_length)) };
+			push({ buf.data(), std::min<std::size_t>(static_cast<std::size_t>(res.size), buf.size()) }, sev);
+		}
+
+		// Has the writer write out everything queued, and closes the file.
+		void stop() noexcept {
+			if (not running.load(std::memory_order::acquire)) {
+				return;
+			}
+			for (call_site& site : sites) { // Call sites that went quiet still owe a count.
+				const char* const key{ site.fmt.load(std::memory_order::acquire) };
+				if (key != nullptr) {
+					report_suppressed(site, { key, site.length.load(std::memory_order::relaxed) }, site.sev.load(std::memory_order::relaxed));
+				}
+			}
+			if (not running.exchange(false, std::memory_order::acq_rel)) {
+				return;
+			}
+			stopping.store(true, std::memory_order::seq_cst);
+			writer_sleeping.store(false, std::memory_order::seq_cst);
+			writer_sleeping.notify_one();
+			writer.join();
+			ofs.close();
+		}
+
+		// Writes out everything queued, then sleeps until there is more.
+		void write_until_stopped() noexcept {
+			for (;;) {
+				while (take_queued()) {}
+				report_dropped();
+				write_batch();
+
+				if (stopping.load(std::memory_order::acquire)) {
+					// Messages queued between the last take and stop() being called are still owed. Once stopping is set nothing more can be queued, short of a push already in flight.
+					while (take_queued()) {}
+					report_dropped();
+					write_batch();
+					return;
+				}
+
+				writer_sleeping.store(true, std::memory_order::seq_cst);
+				std::atomic_thread_fence(std::memory_order::seq_cst); // Pairs with the one in push().
+				if (not has_queued() and not stopping.load(std::memory_order::seq_cst)) {
+					writer_sleeping.wait(true, std::memory_order::relaxed);
+				}
+				writer_sleeping.store(false, std::memory_order::relaxed);
+			}
+		}
+
+		[[nodiscard]] bool has_queued() const noexcept {
+			return slots[dequeue_pos & index_mask].sequence.load(std::memory_order::acquire) == (dequeue_pos + 1);
+		}
+
+		// Moves the next queued message into the batch, writing the batch out first if it is full.
+		[[nodiscard]] bool take_queued() noexcept {
+			slot& next = slots[dequeue_pos & index_mask];
+			if (next.sequence.load(std::memory_order::acquire) != (dequeue_pos + 1)) {
+				return false;
+			}
+			append(severity_string(next.sev));
+			append({ next.text.data(), next.length });
+			append("\r\n"sv);
+			next.sequence.store(dequeue_pos + slot_count, std::memory_order::release);
+			++dequeue_pos;
+			return true;
+		}
+
+		void report_dropped() noexcept {
+			const u64 total = dropped.load(std::memory_order::relaxed);
+			if (total == dropped_reported) {
+				return;
+			}
+			std::array<char, 128> buf{};
+			const auto res{ std::format_to_n(buf.data(), buf.size(), "Log: <{}> messages were dropped, because they came faster than the log could be written."sv, total - dropped_reported) };
+			append(severity_string(severity::sev_warning));
+			append({ buf.data(), std::min<std::size_t>(static_cast<std::size_t>(res.size), buf.size()) });
+			append("\r\n"sv);
+			dropped_reported = total;
+		}
+
+		void append(string_view str) noexcept {
+			if ((batch.size() - batch_fill) < str.length()) {
+				write_batch();
+			}
+			std::copy_n(str.data(), str.length(), batch.data() + batch_fill);
+			batch_fill += str.length();
+		}
+
+		void write_batch() noexcept {
+			if (batch_fill == 0) {
+				return;
+			}
+			try {
+				ofs.write(batch.data(), static_cast<std::streamsize>(batch_fill));
+				ofs.flush();
+			}
+			catch (...) {} // Nowhere left to report it.
+			batch_fill = 0;
+		}
+
+		[[nodiscard]] static string_view severity_string(const severity sev) noexcept {
+			static constexpr std::array<string_view, 5> severity_strings{ "<Info>     ", "<Warning>  ", "<Error>    ", "<Critical> ", "<>         " };
+			return severity_strings[std::min(severity_strings.size() - 1, static_cast<std::size_t>(sev))]; // severity is self-provided so it should be trustable here, but whatever.
+
+			// No actual point in timestamps? The whole runtime won't even be a minute, so only message order matters.
+			// const auto now{ std::chrono::floor<std::chrono::seconds>(std::chrono::system_clock::now()) };
+			// return impl.write(std::format(L"{:%H:%M:%S} {} {}\r\n"sv, now, severity_strings[sev_idx], msg));
+		}
 	};
-	
-	
+
+
 	log::log_impl log::impl{};
-	
-	
+
+
 	bool log::init(const std::filesystem::path& log_file_path) noexcept {
 		return impl.init(log_file_path);
 	}
-	
+
+	void log::set_min_severity(const severity sev) noexcept {
+		min_severity.store(sev, std::memory_order::relaxed);
+	}
+
 	bool log::do_log(string_view msg, const severity sev) noexcept {
-		static constexpr std::array<string_view, 5> severity_strings{ "<Info>     ", "<Warning>  ", "<Error>    ", "<Critical> ", "<>         " };
-		
-		const std::size_t sev_idx = std::min(severity_strings.size() - 1, static_cast<std::size_t>(sev)); // severity is self-provided so it should be trustable here, but whatever.
-		
-		return impl.write(severity_strings[sev_idx]) and impl.write(msg) and impl.write("\r\n");
-
-		// No actual point in timestamps? The whole runtime won't even be a minute, so only message order matters.
-		// const auto now{ std::chrono::floor<std::chrono::seconds>(std::chrono::system_clock::now()) };
-		// return impl.write(std::format(L"{:%H:%M:%S} {} {}\r\n"sv, now, severity_strings[sev_idx], msg));
+		return impl.push(msg, sev);
+	}
+
+	bool log::within_rate(string_view fmt, const severity sev) noexcept {
+		return impl.within_rate(fmt, sev);
 	}
 
 
 
-	
-}
\ No newline at end of file
+
+}
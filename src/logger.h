@@ -3,6 +3,7 @@
 #include <filesystem>
 #include <format>
 #include <array>
+#include <atomic>
 
 namespace diff {
 
@@ -11,16 +12,20 @@ namespace diff {
 		
 		log() = delete; // Must only be used staticly.
 		
+	public:
 		enum severity {
 			sev_info,
 			sev_warning,
 			sev_error,
 			sev_critical
 		};
+		
+	private:
+		enum : std::size_t { max_message_length = 500 }; // Longer messages are cut short.
 
 		class char_buffer {
 		private:
-			enum : std::size_t { buffer_size = 500 };
+			enum : std::size_t { buffer_size = max_message_length };
 
 		public:
 
@@ -74,37 +79,66 @@ namespace diff {
 		
 		static bool do_log(string_view msg, const severity sev) noexcept;
 		
+		inline static constinit std::atomic<severity> min_severity{ severity::sev_info };
+		
+		// Checked before a message is formatted, so one that won't be written costs next to nothing.
+		[[nodiscard]] static bool wanted(string_view fmt, const severity sev) noexcept {
+			return (sev >= min_severity.load(std::memory_order::relaxed)) and within_rate(fmt, sev);
+		}
+		
+		// Each call site, told apart by its format string, gets a few messages every few seconds. Past that they are only counted, and the count logged later on.
+		[[nodiscard]] static bool within_rate(string_view fmt, const severity sev) noexcept;
+		
 	public:
 		
+		// Opens the log file, and starts the thread that writes to it. Messages are only queued by the calling thread, and written out by that one, in batches.
+		// Everything queued is written out when the program exits, or when init is called again for another file.
 		[[nodiscard]] static bool init(const std::filesystem::path& log_file_path) noexcept;
 		
+		// Messages of lower severity are skipped from here on. Everything is logged until this is called.
+		static void set_min_severity(const severity sev) noexcept;
+		
+		// The functions below return false only if a message that was meant to be written could not be. Skipped ones, and ones over their call site's rate, count as logged.
+		
 		static bool info(string_view fmt, auto&&... args) noexcept {
+			if (not wanted(fmt, severity::sev_info)) {
+				return true;
+			}
 			try {
-				static constinit char_buffer buf{};
+				static thread_local constinit char_buffer buf{};
 				return do_log({ buf.begin(), std::vformat_to(buf.get_overwriting_iterator(), fmt, std::make_format_args(args...)).get()}, severity::sev_info);
 			}
 			catch (...) { return false; }
 		}
 		
 		static bool warning(string_view fmt, auto&&... args) noexcept {
+			if (not wanted(fmt, severity::sev_warning)) {
+				return true;
+			}
 			try {
-				static constinit char_buffer buf{};
+				static thread_local constinit char_buffer buf{};
 				return do_log({ buf.begin(), std::vformat_to(buf.get_overwriting_iterator(), fmt, std::make_format_args(args...)).get()}, severity::sev_warning);
 			}
 			catch (...) { return false; }
 		}
 		
 		static bool error(string_view fmt, auto&&... args) noexcept {
+			if (not wanted(fmt, severity::sev_error)) {
+				return true;
+			}
 			try {
-				static constinit char_buffer buf{};
+				static thread_local constinit char_buffer buf{};
 				return do_log({ buf.begin(), std::vformat_to(buf.get_overwriting_iterator(), fmt, std::make_format_args(args...)).get() }, severity::sev_error);
 			}
 			catch (...) { return false; }
 		}
 		
 		static bool critical(string_view fmt, auto&&... args) noexcept {
+			if (not wanted(fmt, severity::sev_critical)) {
+				return true;
+			}
 			try {
-				static constinit char_buffer buf{};
+				static thread_local constinit char_buffer buf{};
 				return do_log({ buf.begin(), std::vformat_to(buf.get_overwriting_iterator(), fmt, std::make_format_args(args...)).get()}, severity::sev_critical);
 			}
 			catch (...) { return false; }
@@ -14,7 +14,8 @@ namespace diff {
 		constexpr lowercase_path& operator=(lowercase_path&&) noexcept = default;
 		constexpr ~lowercase_path() noexcept = default;
 		
-		explicit lowercase_path(const std::filesystem::path& any_path) : val{ any_path.u8string() } {
+		// Separated by '/' whatever the OS, so paths compare and sort the same everywhere.
+		explicit lowercase_path(const std::filesystem::path& any_path) : val{ any_path.generic_u8string() } {
 			make_lowercase(val);
 		}
 		explicit lowercase_path(diff::u8string&& any_path) noexcept : val{ any_path } {
@@ -5,12 +5,21 @@
 #include "configuration.h"
 #include "filesystem_interface.h"
 #include "serialization.h"
+#include "credentials.h"
+#include "snapshot_view.h"
+#include "journal.h"
+#include "shards.h"
+#include "history.h"
 #include "differ.h"
+#include "phase_arena.h"
+#include "run_metrics.h"
 #include "string_utils.h"
 #include "sample_config.h"
+#include "benchmark.h"
 #include <iostream>
 #include <filesystem>
 #include <chrono>
+#include <algorithm>	// std::any_of
 #include <format>
 
 
@@ -18,17 +27,47 @@ namespace diff {
 	
 	static constexpr std::string_view log_folder_name{ "logs" };
 	static constexpr std::string_view config_file_name{ "config.txt" };
-	static constexpr std::string_view data_file_name{ "data.bin" };
-	static constexpr std::string_view old_data_file_name{ "data.bin.old" };
-	static constexpr std::string_view new_data_file_name{ "data.bin.new" };
+	static constexpr std::string_view credentials_file_name{ "credentials.bin" };
+	static constexpr std::string_view data_file_name{ "data.bin" };	// Single snapshot from before shards. Read once, and split into shards.
+	static constexpr std::string_view manifest_file_name{ "data.manifest" };
+	static constexpr std::string_view new_manifest_file_name{ "data.manifest.new" };
+	static constexpr std::string_view shard_folder_name{ "shards" };
+	static constexpr std::string_view journal_file_name{ "data.journal" };
+	static constexpr std::string_view history_file_name{ "history.bin" };
+	
+	// With <empty report> batch, quiet stretches still get an empty report once this long passes without any report going out.
+	static constexpr std::chrono::days empty_report_interval{ 7 };
+	
+	// Whether a run that found nothing created or deleted should send its report. Sent reports are the runs in the history, so its newest one is the last report that went out.
+	[[nodiscard]] static bool should_send_empty_report(const configuration::empty_report_policy policy, const std::filesystem::path& history_path, const std::chrono::seconds run_time) noexcept {
+		switch (policy) {
+		case configuration::empty_report_policy::skip:
+			return false;
+		case configuration::empty_report_policy::batch: {
+			const auto runs{ list_history(history_path) };
+			if (not runs.has_value() or runs.value().empty()) {
+				return true; // No way to tell when the last one went out.
+			}
+			return (run_time - runs.value().back().run_time) >= empty_report_interval;
+		}
+		case configuration::empty_report_policy::send:
+			break;
+		}
+		return true;
+	}
 	
 	void normal_routine(const std::filesystem::path& startup_path) {
 
 		const auto start_time{ std::chrono::floor<std::chrono::seconds>(std::chrono::system_clock::now()) };
 
 		const std::filesystem::path config_path{ startup_path / config_file_name };
+		const std::filesystem::path credentials_path{ startup_path / credentials_file_name };
 		const std::filesystem::path savedata_path{ startup_path / data_file_name };
-		const std::filesystem::path old_savedata_path{ startup_path / old_data_file_name };
+		const std::filesystem::path manifest_path{ startup_path / manifest_file_name };
+		const std::filesystem::path new_manifest_path{ startup_path / new_manifest_file_name };
+		const std::filesystem::path shard_folder{ startup_path / shard_folder_name };
+		const std::filesystem::path journal_path{ startup_path / journal_file_name };
+		const std::filesystem::path history_path{ startup_path / history_file_name };
 		const std::filesystem::path logfile_path{ startup_path / log_folder_name / std::format("{:%Y-%m-%d_%UTC-%Hh-%Mm-%Ss_%a-%d-%B}.log"sv, start_time) };
 		//const std::filesystem::path logfile_path{ startup_path / log_folder_name / "aaaa.log" };
 		// e.g. "...\logs\2025-01-08_UTC-17h-02m-08s_Wed-08-January.log"
@@ -50,7 +89,13 @@ namespace diff {
 		
 		
 		
+		// Every phase below is timed, and the timings are logged whenever the routine returns.
+		run_metrics metrics{};
+		
+		
+		
 		// Read config.
+		metrics.enter_phase("config"sv);
 		configuration config{};
 		{
 			auto opt{ get_configuration(config_path) };
@@ -60,28 +105,128 @@ namespace diff {
 			}
 			config = std::move(opt.value());
 			log::info("Main: Parsed configuration file <{}>"sv, config_file_name);
+			log::set_min_severity(config.get_log_level());
+			if (not config.get_metrics_file().empty()) {
+				metrics.set_json_path(startup_path / config.get_metrics_file()); // Absolute paths replace startup_path.
+			}
 		}
 		
 		
 		
-		// Read saved data (smtp info and old filelist).
-		smtp_info smtp{};
-		old_files_t old_files{};
+		// Read saved data. Normally that is just the manifest, since shards are opened while diffing, each by the thread diffing it.
+		// Without a manifest, the old filelist is still in a single snapshot from before shards (along with smtp info, in snapshots from before credentials got their own store).
+		// Prefer mapping that snapshot and decoding old files lazily while diffing. Version 1 snapshots can't be mapped, so those are read whole.
+		metrics.enter_phase("load"sv);
+		std::optional<shard_manifest> manifest{};
 		{
-			auto opt{ read_dbuf_from_file(savedata_path).and_then(serialization::deserialize_from_buffer) };
+			const auto manifest_exists{ file_exists(manifest_path) };
+			if (not manifest_exists.has_value()) {
+				log::error("Main: Could not verify whether <{}> exists."sv, manifest_file_name);
+				return;
+			}
+			if (manifest_exists.value()) {
+				manifest = read_manifest(manifest_path);
+				if (not manifest.has_value()) {
+					log::error("Main: Failed to read saved data."sv);
+					return;
+				}
+				log::info("Main: Read <{}>, listing <{}> shards."sv, manifest_file_name, manifest.value().shards.size());
+				metrics.add_items(manifest.value().shards.size());
+			}
+		}
+		std::optional<smtp_info> legacy_smtp{};
+		std::optional<snapshot_view> old_view{ manifest.has_value() ? std::nullopt : snapshot_view::open(savedata_path) };
+		old_files_t old_files{};
+		if (old_view.has_value()) {
+			legacy_smtp = old_view.value().legacy_smtp();
+			log::info("Main: Mapped old serialized data from <{}>, containing entries for <{}> files"sv, data_file_name, old_view.value().file_count());
+			metrics.add_items(old_view.value().file_count());
+		}
+		else if (not manifest.has_value()) {
+			const auto dbuf{ read_dbuf_from_file(savedata_path) };
+			if (not dbuf.has_value()) {
+				log::error("Main: Failed to read saved data."sv);
+				return;
+			}
+			metrics.add_bytes(dbuf.value().length());
+			metrics.enter_phase("deserialize"sv); // Decrypts too.
+			auto opt{ serialization::deserialize_from_buffer(dbuf.value()) };
 			if (not opt.has_value()) {
 				log::error("Main: Failed to read saved data."sv);
 				return;
 			}
-			smtp = std::move(opt.value().smtp);
+			legacy_smtp = std::move(opt.value().legacy_smtp);
 			old_files.files = std::move(opt.value().files);
 			log::info("Main: Read old serialized data from <{}>, containing entries for <{}> files"sv, data_file_name, old_files.files.size());
+			metrics.add_items(old_files.files.size());
+			metrics.add_bytes(dbuf.value().length());
 			// No sort needed for old files. We always store sorted.
 		}
 		
+		
+		
+		// Read the journal of runs since the base (the manifest, or a single snapshot before that) was written. Single snapshots only get one if they're mapped and in the current format.
+		metrics.enter_phase("journal"sv);
+		std::optional<u64> base_tag{};
+		journal_contents journal{};
+		if (manifest.has_value()) {
+			base_tag = manifest.value().tag;
+		}
+		else if (old_view.has_value() and old_view.value().is_current_version()) {
+			base_tag = snapshot_tag(savedata_path);
+			if (not base_tag.has_value()) {
+				log::error("Main: Failed to tag <{}>."sv, data_file_name);
+				return;
+			}
+		}
+		if (base_tag.has_value()) {
+			auto opt{ read_journal(journal_path, base_tag.value()) };
+			if (not opt.has_value()) {
+				log::error("Main: Failed to read <{}>."sv, journal_file_name);
+				return;
+			}
+			journal = std::move(opt.value());
+			metrics.add_items(journal.record_count);
+			metrics.add_bytes(journal.valid_length);
+		}
+		
+		
+		
+		// Read smtp info. If there is no credentials store yet, move the info over from an old snapshot that still carries it.
+		metrics.enter_phase("credentials"sv);
+		smtp_info smtp{};
+		{
+			const auto credentials_exist{ file_exists(credentials_path) };
+			if (not credentials_exist.has_value()) {
+				log::error("Main: Could not verify whether <{}> exists."sv, credentials_file_name);
+				return;
+			}
+			if (credentials_exist.value()) {
+				auto opt{ read_credentials(credentials_path) };
+				if (not opt.has_value()) {
+					log::error("Main: Failed to read smtp info."sv);
+					return;
+				}
+				smtp = std::move(opt.value());
+			}
+			else if (legacy_smtp.has_value()) {
+				if (not write_credentials(credentials_path, legacy_smtp.value())) {
+					log::error("Main: Failed to move smtp info from <{}> to <{}>."sv, data_file_name, credentials_file_name);
+					return;
+				}
+				smtp = std::move(legacy_smtp.value());
+				log::info("Main: Moved smtp info from <{}> to <{}>. It will no longer be stored in <{}>."sv, data_file_name, credentials_file_name, data_file_name);
+			}
+			else {
+				log::error("Main: No smtp info found. Provide it with the \"-set\" argument."sv);
+				return;
+			}
+		}
+		
 
 
 		// Enumerate files currently on disk.
+		metrics.enter_phase("scan"sv);
 		new_files_t new_files{};
 		{
 			auto opt{ get_files_recursive(config) };
@@ -90,26 +235,60 @@ namespace diff {
 				return;
 			}
 			new_files.files = std::move(opt.value());
+			metrics.add_items(new_files.files.size());
+			metrics.enter_phase("sort"sv);
+			metrics.add_items(new_files.files.size());
 			std::sort(new_files.files.begin(), new_files.files.end()); // Sort new files. recursive_directory_iterator makes no order guarantees.
 			log::info("Main: Enumerated files of interest currently on disk ({} files) and sorted them."sv, new_files.files.size());
 		}
 		
 
 
-		// Diff old and new files.
+		// Diff old and new files. Old files are the base with the journal's runs applied on top.
+		// Shards are diffed each against the files under their top-level directory, in parallel. A single snapshot is diffed whole, then the new files are split up to be written as shards.
+		metrics.enter_phase("diff"sv);
 		diff::u8string report{};
+		journal_delta changes{ start_time.time_since_epoch() };
+		diff::vector<shard_part> parts{};
 		{
-			auto opt{ diff_sorted_files(old_files, new_files) };
+			phase_arena arena{ "diff"sv }; // Holds the lists of created and deleted files until the report is made from them. Freed, and reported on, at the end of the block.
+			std::optional<u8string> opt{};
+			if (manifest.has_value()) {
+				auto opt_parts{ split_into_parts(&manifest.value(), std::move(journal.overlay), std::move(new_files.files)) };
+				if (not opt_parts.has_value()) {
+					log::error("Main: Failed to split files by top-level directory."sv);
+					return;
+				}
+				parts = std::move(opt_parts.value());
+				opt = diff_sharded_files(shard_folder, parts, &changes, &arena);
+			}
+			else {
+				opt = old_view.has_value() ? diff_sorted_files(old_view.value(), journal.overlay, new_files, &changes, &arena) : diff_sorted_files(old_files, new_files, &changes, &arena);
+				old_view.reset();
+			}
 			if (not opt.has_value()) {
 				log::error("Main: Failed to diff old and new state."sv);
 				return;
 			}
 			report = std::move(opt.value());
 			log::info("Main: Generated UTF-8 report string ({} bytes long)."sv, report.length());
+			metrics.add_items(changes.created.size() + changes.deleted.size());
+			metrics.add_bytes(report.length());
+			
+			if (not manifest.has_value()) {
+				auto opt_parts{ split_into_parts(nullptr, delta_overlay{}, std::move(new_files.files)) };
+				if (not opt_parts.has_value()) {
+					log::error("Main: Failed to split files by top-level directory."sv);
+					return;
+				}
+				parts = std::move(opt_parts.value());
+			}
 		}
 		
 		
 		
+		metrics.enter_phase("report"sv);
+		metrics.add_bytes(report.length());
 		if (not write_to_file(reportfile_path, report)) {
 			log::warning("Main: Failed to write diff report to disk. Report will be sent via email later so this is not a hard error."sv);
 		}
@@ -117,48 +296,67 @@ namespace diff {
 		
 		
 		
-		// Generate serializable buffer from new files.
-		dynamic_buffer new_data_buf{};
-		{
-			auto opt{ serialization::serialize_to_buffer_encrypted(smtp, new_files.files) };
-			if (not opt.has_value()) {
-				log::error("Main: Failed to serialize data."sv);
+		// Most runs find nothing created or deleted. Those have nothing to record, so they skip straight to the report, which may not even be sent, and leave the saved data as it is.
+		// Unless it needs rewriting anyway: there are no shards yet, or some of the saved data is in an older format.
+		const bool outdated_shards = std::any_of(parts.begin(), parts.end(), [](const shard_part& part) { return part.outdated; });
+		if (changes.created.empty() and changes.deleted.empty() and manifest.has_value() and not outdated_shards and not journal.outdated) {
+			if (not should_send_empty_report(config.get_empty_report(), history_path, changes.run_time)) {
+				log::info("Main: Nothing changed. Left the saved data as it was, and skipped sending the empty report."sv);
+				return;
+			}
+			metrics.enter_phase("email"sv);
+			metrics.add_bytes(report.length());
+			if (not send_email(smtp, config.get_email_metadata(), report)) {
+				log::error("Main: Failed to send report email. Nothing changed, so there was nothing to record anyway."sv);
 				return;
 			}
-			new_data_buf = std::move(opt.value());
-			log::info("Main: Serialized new data into internal buffer."sv);
+			if (not append_history(history_path, changes, config.get_history_size())) {
+				log::warning("Main: Failed to store this run in <{}>. The run itself was successful, it just can't be compared against later."sv, history_file_name);
+			}
+			log::info("Main: Nothing changed. Left the saved data as it was, and sent the empty report."sv);
+			return;
 		}
 		
 		
 		
-		// Rename old datafile and write new one to disk.
-		{
-			if (not rename_file(savedata_path, old_data_file_name)) {
-				log::error("Main: Failed to rename <{}> to <{}>."sv, data_file_name, old_data_file_name);
-				return;
+		// Record this run. Normally that is just appending what changed to the journal, so the cost scales with the changes rather than with the tree.
+		// Once the journal has grown enough (or there is no usable one, or no shards yet, or any of it is in an older format), compact instead: write new shards for the directories that changed since their shards were written,
+		// and a new manifest listing them along with the unchanged ones, which empties the journal.
+		// Either way, nothing is recorded until the report is delivered. The manifest and the journal are only ever replaced or appended to in one durable step, so a crash at any point
+		// leaves the previous state intact, and the worst case is reporting the same changes again.
+		const bool compact = not manifest.has_value() or outdated_shards or should_compact(journal, changes, manifest.value().total_length());
+		
+		// Shard files the manifest on disk doesn't list are leftovers, either replaced by a compaction, or written for one that never got committed.
+		const auto remove_leftover_shards = [&shard_folder](const shard_manifest& committed) {
+			if (not remove_unlisted_shards(shard_folder, committed)) {
+				log::warning("Main: Failed to delete some unused shard files in <{}>. They are deleted on later runs. It is also safe to delete them manually, or to just ignore them."sv, shard_folder_name);
 			}
-			log::info("Main: Renamed old data file <{}> to <{}> to keep as a backup."sv, data_file_name, old_data_file_name);
-			if (not write_dbuf_to_file(savedata_path, new_data_buf)) {
-				log::error("Main: Failed to write serialized buffer to <{}>."sv, data_file_name);
-				if (not rename_file(old_savedata_path, data_file_name)) {
-					log::critical("Main: Failed to rename <{}> back to <{}> while cleaning up. Do so manually."sv, old_data_file_name, data_file_name);
-				}
+		};
+		
+		metrics.enter_phase("record"sv);
+		std::optional<shard_manifest> new_manifest{};
+		if (compact) {
+			new_manifest = write_changed_shards(shard_folder, parts);
+			if (not new_manifest.has_value() or not write_manifest(new_manifest_path, new_manifest.value())) {
+				log::error("Main: Failed to write new data to <{}> and <{}>."sv, shard_folder_name, new_manifest_file_name);
+				remove_leftover_shards(manifest.value_or(shard_manifest{}));
 				return;
 			}
-			log::info("Main: Wrote new new data to <{}>."sv, data_file_name);
+			log::info("Main: Compacting. Wrote new data to <{}> and <{}>."sv, shard_folder_name, new_manifest_file_name);
 		}
 		
 		
 		
 		// Send email.
-		
+		metrics.enter_phase("email"sv);
+		metrics.add_bytes(report.length());
 		if (not send_email(smtp, config.get_email_metadata(), report)) {
-			log::error("Main: Failed to send report email."sv);
-			if (not delete_file(savedata_path)) {
-				log::critical("Main: Failed to delete <{0}>. It contains new data that should be discarded because email dispatch failed. Delete it manually, and rename <{1}> back to <{0}>"sv, data_file_name, old_data_file_name);
-			}
-			else if (not rename_file(old_savedata_path, data_file_name)) {
-				log::critical("Main: Failed to rename <{}> to <{}> when cleaning up after email dispatch failed. Do so manually."sv, old_data_file_name, data_file_name);
+			log::error("Main: Failed to send report email. Nothing was recorded, so these changes will be reported again next run."sv);
+			if (compact) {
+				if (not delete_file(new_manifest_path)) {
+					log::warning("Main: Failed to delete unused <{}>. It is never read, and is overwritten next time. It is safe to delete it manually, or to just ignore it."sv, new_manifest_file_name);
+				}
+				remove_leftover_shards(manifest.value_or(shard_manifest{}));
 			}
 			return;
 		}
@@ -167,18 +365,53 @@ namespace diff {
 		//log::info("Main: Skipped sending email."sv);
 		
 		
-		if (not delete_file(old_savedata_path)) {
-			log::warning("Main: Failed to delete backup file <{}> when finishing up. All other operations were successful and the file is no longer needed. It is safe to delete it manually, or to just ignore it."sv);
-			return;
+		
+		// Commit.
+		metrics.enter_phase("commit"sv);
+		if (not compact) {
+			if (not append_journal(journal_path, base_tag.value(), journal.valid_length, changes)) {
+				log::error("Main: Failed to append this run to <{}>. Its changes were reported, and will be reported again next run."sv, journal_file_name);
+				return;
+			}
+			log::info("Main: Appended this run to <{}>, which now holds <{}> runs."sv, journal_file_name, journal.record_count + 1);
 		}
-		log::info("Main: All operations completed successfully. Deleted <{}> backup file."sv);
+		else {
+			// New shards are left in place on failure. Should the replace have gone through after all, the manifest on disk needs them, and otherwise a later run deletes them.
+			if (not commit_file(new_manifest_path, manifest_path)) {
+				log::error("Main: Failed to replace <{}> with <{}>. The previous state is still in place, so these changes were reported and will be reported again next run."sv, manifest_file_name, new_manifest_file_name);
+				return;
+			}
+			log::info("Main: Replaced <{}> with <{}>."sv, manifest_file_name, new_manifest_file_name);
+		}
+		
+		
+		if (not append_history(history_path, changes, config.get_history_size())) {
+			log::warning("Main: Failed to store this run in <{}>. The run itself was successful, it just can't be compared against later."sv, history_file_name);
+		}
+		
+		
+		if (compact) {
+			remove_leftover_shards(new_manifest.value());
+			
+			// The journal belongs to the replaced manifest now, so it would be ignored anyway. Deleting it just reclaims the space.
+			if (not truncate_journal(journal_path, 0)) {
+				log::warning("Main: Failed to delete <{}>, which was folded into the shards. It is safe to delete it manually, or to just ignore it."sv, journal_file_name);
+			}
+			
+			// Everything in a single snapshot from before shards is in them now.
+			if (not manifest.has_value() and not delete_file(savedata_path)) {
+				log::warning("Main: Failed to delete <{}>, which was split into shards and is no longer read. It is safe to delete it manually, or to just ignore it."sv, data_file_name);
+			}
+		}
+		
+		log::info("Main: All operations completed successfully."sv);
 		
 	}
 	
 	
 	void set_smtp(const std::filesystem::path& startup_path, string_view smtp_filename) {
 		const std::filesystem::path savedata_path{ startup_path / data_file_name };
-		const std::filesystem::path old_savedata_path{ startup_path / old_data_file_name };
+		const std::filesystem::path manifest_path{ startup_path / manifest_file_name };
 		
 		diff::vector<diff::u8string> lines{ [](const std::filesystem::path& smtp_file_path) -> diff::vector<diff::u8string> {
 			const auto content{ read_from_file(smtp_file_path) };
@@ -211,108 +444,162 @@ namespace diff {
 		smtp.username = std::move(lines[1]);
 		smtp.password = std::move(lines[2]);
 		
-		diff::vector<file> files{};
-
+		if (not write_credentials(startup_path / credentials_file_name, smtp)) {
+			std::cout << "Error:    Failed to write SMTP info to <" << credentials_file_name << ">. Try running the program again.\n\n";
+			system("pause");
+			return;
+		}
+		std::cout << "Info:     Wrote SMTP info to <" << credentials_file_name << ">.\n";
+		
+		// Normal runs need a saved state to diff against. Start an empty one if there is none yet. An existing one is left alone, even a single snapshot that still carries old smtp info: the credentials store takes precedence, and the next normal run drops it.
+		const auto manifest_exists = file_exists(manifest_path);
 		const auto savedata_exists = file_exists(savedata_path);
-
-		if (not savedata_exists.has_value()) {
-			std::cout << "Error:    Could not verify whether <" << data_file_name << "> (containing serialized data) exists or not. Aborting without effect. Try running the program again.\n\n";
+		
+		if (not manifest_exists.has_value() or not savedata_exists.has_value()) {
+			std::cout << "Error:    Could not verify whether <" << manifest_file_name << "> or <" << data_file_name << "> (containing serialized data) exist or not. Try running the program again.\n\n";
 			system("pause");
 			return;
 		}
-		else if (savedata_exists.value()) {
-			std::cout << "Info:     Found <" << data_file_name << ">. Updating it with new SMTP info.\n";
-			auto data{ read_dbuf_from_file(savedata_path).and_then(serialization::deserialize_from_buffer) };
-			if (not data.has_value()) {
-				std::cout << "Error:    <" << data_file_name << "> exists but could not read it from disk. Aborting without effect. Try running the program again.\n\n";
+		else if (not manifest_exists.value() and not savedata_exists.value()) {
+			if (not write_manifest(manifest_path, make_empty_manifest())) {
+				std::cout << "Error:    Failed to write new savedata to <" << manifest_file_name << ">.\n";
 				system("pause");
 				return;
 			}
-			std::cout << "Info:     Existing data smtp = <"
-				<< reinterpret_cast<const char*>(data.value().smtp.url.c_str()) << ", "
-				<< reinterpret_cast<const char*>(data.value().smtp.username.c_str()) << ", "
-				<< reinterpret_cast<const char*>(data.value().smtp.password.c_str()) << ">\n";
-			files = std::move(data.value().files);
-			std::cout << "Info:     Loaded the serialized data from disk.\n";
-		}
-		else {
-			std::cout << "Info:     <" << data_file_name << "> not found. It will be created now with provided SMTP info.\n";
+			std::cout << "Info:     <" << manifest_file_name << "> not found. Created it with no files.\n";
 		}
 		
-		dynamic_buffer data_buf{};
-		{
-			auto opt{ serialization::serialize_to_buffer_encrypted(smtp, files) };
-			if (not opt.has_value()) {
-				std::cout << "Error:    Failed to serialize data with new SMTP info into internal buffer. Aborting without effect. Try running the program again.\n\n";
-				system("pause");
-				return;
-			}
-			data_buf = std::move(opt.value());
-			if (savedata_exists.value()) {
-				std::cout << "Info:     Re-serialized data with updated SMTP info into internal bufffer.\n";
-			}
-			else {
-				std::cout << "Info:     Initialized data with provided SMTP info into internal bufffer.\n";
-			}
+		std::cout << "Info:     You can now delete <" << smtp_filename << ">.\n\n";
+		system("pause");
+	}
+	
+
+	// Logging for the offline tools, to a file of their own next to the normal run logs.
+	[[nodiscard]] static bool init_tool_logging(const std::filesystem::path& startup_path, string_view tool_name) {
+		const auto start_time{ std::chrono::floor<std::chrono::seconds>(std::chrono::system_clock::now()) };
+		if (not folder_create_or_exists(startup_path / log_folder_name)
+			or not log::init(startup_path / log_folder_name / std::format("{:%Y-%m-%d_%UTC-%Hh-%Mm-%Ss_%a-%d-%B}_{}.log"sv, start_time, tool_name))) {
+			std::cout << "Error:    Failed to init logging.\n";
+			return false;
 		}
+		return true;
+	}
+	
+	
+	// Lists stored runs, or diffs the states after two of them, purely from history. Nothing on disk is scanned.
+	void history_routine(const std::filesystem::path& startup_path, const std::optional<std::pair<u64, u64>> runs) {
+		const std::filesystem::path history_path{ startup_path / history_file_name };
 		
+		if (not init_tool_logging(startup_path, "history"sv)) {
+			return;
+		}
 		
-		if (savedata_exists.value()) {
-			if (not rename_file(savedata_path, old_data_file_name)) {
-				std::cout << "Error:    Failed to rename <" << data_file_name << "> to <" << old_data_file_name << ">. Aborting without effect. Try running the program again.\n\n";
-				system("pause");
+		if (not runs.has_value()) {
+			const auto list{ list_history(history_path) };
+			if (not list.has_value()) {
+				std::cout << "Error:    Failed to read <" << history_file_name << ">. See the log for details.\n";
 				return;
 			}
-			std::cout << "Info:     Renamed <" << data_file_name << "> to <" << old_data_file_name << ">.\n";
-
-			if (not write_dbuf_to_file(savedata_path, data_buf)) {
-				std::cout << "Error:    Failed to write updated serialized data to <" << data_file_name << ">. Trying to rename <" << old_data_file_name << "> back to <" << data_file_name << ">...\n";
-				if (not rename_file(old_savedata_path, data_file_name)) {
-					std::cout << "Critical: Failed to rename <" << old_data_file_name << "> back to <" << data_file_name << ">. Do so manually before trying to run the program again.\n\n";
-				}
-				else {
-					std::cout << "Info:     Renamed <" << old_data_file_name << "> back to <" << data_file_name << ">. Aborting without effect. Try running the program again.\n\n";
-				}
-				system("pause");
+			if (list.value().empty()) {
+				std::cout << "Info:     No runs stored yet.\n";
 				return;
 			}
-			std::cout << "Info:     Wrote updated serialized data to <" << data_file_name << ">.\n";
-
-			if (not delete_file(old_savedata_path)) {
-				std::cout << "Warning:  Failed to delete <" << old_data_file_name << "> backup file. It is safe to delete it manually, or to just ignore it.\n\n";
-				system("pause");
-				return;
+			for (const auto& run : list.value()) {
+				std::cout << std::format("Run {:>6}    {:%Y-%m-%d %H:%M:%S} UTC    {} created, {} deleted\n", run.number, std::chrono::sys_seconds{ run.run_time }, run.created_count, run.deleted_count);
 			}
-
-			std::cout << "Info:     Deleted backup file <" << old_data_file_name << ">. <" << data_file_name << "> now contains the updated SMTP info. You can now delete <" << smtp_filename << ">.\n\n";
-			system("pause");
+			std::cout << "Info:     Any two of runs " << (list.value().front().number - 1) << " to " << list.value().back().number << " can be compared with \"-history <from> <to>\". Run " << (list.value().front().number - 1) << " is the state the earliest stored run started from.\n";
 			return;
 		}
-		else {
-			if (not write_dbuf_to_file(savedata_path, data_buf)) {
-				std::cout << "Error:    Failed to write new savedata to <" << data_file_name << ">.\n";
-				system("pause");
-				return;
-			}
+		
+		const auto [from, to] = runs.value();
+		const auto change{ history_change(history_path, from, to) };
+		if (not change.has_value()) {
+			std::cout << "Error:    Failed to compose runs " << from << " to " << to << " from <" << history_file_name << ">. See the log for details.\n";
+			return;
+		}
+		const auto report{ diff_sorted_files(change.value()) };
+		if (not report.has_value()) {
+			std::cout << "Error:    Failed to diff runs " << from << " and " << to << ". See the log for details.\n";
+			return;
+		}
+		const std::filesystem::path report_path{ startup_path / log_folder_name / std::format("history_{}-{}_report.txt", from, to) };
+		if (not write_to_file(report_path, report.value())) {
+			std::cout << "Error:    Failed to write report to <" << report_path.string() << ">.\n";
+			return;
+		}
+		std::cout << "Info:     Wrote the changes from run " << from << " to run " << to << " to <" << report_path.string() << ">.\n";
+	}
+	
+	
+	// Diffs two saved snapshots, e.g. a copy of an earlier shard against the current one to regenerate a lost report, or ones copied from another machine. Nothing on disk is scanned.
+	void compare_routine(const std::filesystem::path& startup_path, const std::filesystem::path& old_path, const std::filesystem::path& new_path) {
+		if (not init_tool_logging(startup_path, "compare"sv)) {
+			return;
+		}
+		
+		auto old_view{ snapshot_view::open(old_path) };
+		auto new_view{ snapshot_view::open(new_path) };
+		if (not old_view.has_value() or not new_view.has_value()) {
+			std::cout << "Error:    Failed to open <" << (old_view.has_value() ? new_path : old_path).string() << ">. Version 1 snapshots can't be compared; run the program normally once to upgrade one. See the log for details.\n";
+			return;
 		}
 		
+		const auto report{ diff_sorted_files(old_view.value(), new_view.value()) };
+		if (not report.has_value()) {
+			std::cout << "Error:    Failed to diff <" << old_path.string() << "> against <" << new_path.string() << ">. See the log for details.\n";
+			return;
+		}
+		
+		const auto start_time{ std::chrono::floor<std::chrono::seconds>(std::chrono::system_clock::now()) };
+		const std::filesystem::path report_path{ startup_path / log_folder_name / std::format("{:%Y-%m-%d_%UTC-%Hh-%Mm-%Ss_%a-%d-%B}_compare_report.txt"sv, start_time) };
+		if (not write_to_file(report_path, report.value())) {
+			std::cout << "Error:    Failed to write report to <" << report_path.string() << ">.\n";
+			return;
+		}
+		std::cout << "Info:     Wrote the changes from <" << old_path.string() << "> to <" << new_path.string() << "> to <" << report_path.string() << ">.\n";
 	}
 	
-
+	
+	// Checks a snapshot for damage without loading it. Returns false if it is damaged or couldn't be checked.
+	[[nodiscard]] bool verify_routine(const std::filesystem::path& startup_path, const std::filesystem::path& snapshot_path) {
+		if (not init_tool_logging(startup_path, "verify"sv)) {
+			return false;
+		}
+		
+		const auto start{ std::chrono::steady_clock::now() };
+		const auto check{ snapshot_view::verify(snapshot_path) };
+		const std::chrono::duration<double> elapsed{ std::chrono::steady_clock::now() - start };
+		if (not check.has_value()) {
+			std::cout << "Error:    <" << snapshot_path.string() << "> is damaged or unreadable. See the log for details.\n";
+			return false;
+		}
+		if (check.value().chunk_count == 0) {
+			std::cout << std::format("Warning:  <{}> (version {}) predates checksums. Its structure is intact, but damage inside a record can't be detected.\n", snapshot_path.string(), check.value().version);
+			return true;
+		}
+		std::cout << std::format("Info:     <{}> (version {}, {} bytes) is intact: all {} chunks match their checksums ({:.3f}s).\n", snapshot_path.string(), check.value().version, check.value().byte_count, check.value().chunk_count, elapsed.count());
+		return true;
+	}
+	
+	
 	void show_help(const std::filesystem::path& startup_path) {
 		using std::cout;
 
 		cout << "\nTo start, create a text file with exactly 3 lines, containing SMTP url, username, and password, in that order.";
 		cout << "Then, call the program with \"-set path\\to\\the\\file.txt\" arguments.\n";
-		cout << "This will create a savefile with the given credentials, encrypted, or update an existing one if found.\n";
+		cout << "This will store the given credentials, encrypted, in \"credentials.bin\", replacing any stored before, and create an empty savedata file if there is none.\n";
 		cout << "Afterwards, each invocation of the program will work as usual.\n";
-		cout << "If you never provide SMTP info like this, hence never having a savedata file, the program will do nothing.\n";
-		cout << "Everything the program stores is in the savedata file. Deleting it essentially resets everything to zero.\n\n";
+		cout << "If you never provide SMTP info like this, hence never having a credentials file, the program will do nothing.\n";
+		cout << "The file list the program compares against is in the savedata: \"data.manifest\", and the \"shards\" folder, which holds a snapshot per top-level directory under the root. Deleting both essentially resets that to zero.\n";
+		cout << "Two snapshots can be compared directly with \"-compare <old snapshot> <new snapshot>\", e.g. to regenerate a lost report from a copy of an earlier shard and the current one. The report is written to the logs folder.\n";
+		cout << "Past runs are kept in \"history.bin\", except ones that found nothing and sent no email (see <empty report> in the config). Call the program with \"-history\" to list them, or with \"-history <from> <to>\" to write what changed between two of them to the logs folder.\n";
+		cout << "A snapshot, such as a shard, can be checked for damage, without loading it, with \"-verify <snapshot>\".\n";
+		cout << "Calling the program with \"-profile\" does a normal run, and adds how much memory each part of it allocated to the end of its log.\n\n";
 
 		cout << "For normal use, the program needs a file named specificall \"config.txt\" in the same directory as the executable.\n";
 		cout << "In \"config.txt\" you can specify the parameters of the directory monitoring, and the email dispatch details.\n";
 		cout << "The syntax is similar to the classic INI file syntax, except with angle brackets (<>) replacing brackets ([]) for category tags, and double slashes (//) replacing semicolon (;) for line comments.\n";
-		cout << "The valid category tags are: <root>, <file extensions>, <excluded folders>, <min depth>, <email from>, <email to>, <email cc>, and <email subject>.\n\n";
+		cout << "The valid category tags are: <root>, <file extensions>, <excluded folders>, <min depth>, <history size>, <empty report>, <log level>, <metrics file>, <email from>, <email to>, <email cc>, and <email subject>.\n\n";
 		
 		cout << "Would you like to create a sample \"config.txt\" with more details about the syntax inside (no effect if a \"config.txt\" already exists)? Y/N\n";
 
@@ -415,6 +702,55 @@ int __cdecl main([[maybe_unused]] int argc, [[maybe_unused]] char** argv) {
 		if (std::string{ "-h" } == argv[1]) {
 			diff::show_help(startup_path);
 		}
+		else if (std::string{ "-profile" } == argv[1]) {
+			std::cout << "Normal routine, profiling allocations\n";
+			diff::memory::start_profiling();
+			diff::normal_routine(startup_path);
+		}
+		else if (std::string{ "-bench" } == argv[1]) {
+			if (argc != 3) {
+				std::cout << "Argument \"-bench\" must be followed by a benchmark name.\n";
+				diff::benchmark::list();
+				return 1;
+			}
+			if (not diff::benchmark::run(argv[2], startup_path / diff::config_file_name)) {
+				return 1;
+			}
+		}
+		else if (std::string{ "-compare" } == argv[1]) {
+			if (argc != 4) {
+				std::cout << "Argument \"-compare\" must be followed by the paths of the old and the new snapshot.\n";
+				return 1;
+			}
+			diff::compare_routine(startup_path, argv[2], argv[3]);
+		}
+		else if (std::string{ "-verify" } == argv[1]) {
+			if (argc != 3) {
+				std::cout << "Argument \"-verify\" must be followed by the path of the snapshot to check.\n";
+				return 1;
+			}
+			if (not diff::verify_routine(startup_path, argv[2])) {
+				return 1;
+			}
+		}
+		else if (std::string{ "-history" } == argv[1]) {
+			if (argc == 2) {
+				diff::history_routine(startup_path, std::nullopt);
+			}
+			else if (argc == 4) {
+				const diff::i64 from = diff::ul_parse(diff::u8string_view{ reinterpret_cast<const char8_t*>(argv[2]) });
+				const diff::i64 to = diff::ul_parse(diff::u8string_view{ reinterpret_cast<const char8_t*>(argv[3]) });
+				if ((from < 0) or (to < 0)) {
+					std::cout << "Arguments after \"-history\" must be run numbers.\n";
+					return 1;
+				}
+				diff::history_routine(startup_path, std::pair{ static_cast<diff::u64>(from), static_cast<diff::u64>(to) });
+			}
+			else {
+				std::cout << "Argument \"-history\" must be followed by either nothing, or two run numbers.\n";
+				return 1;
+			}
+		}
 		else if (std::string{ "-set" } != argv[1]) {
 			std::cout << "Unrecognized argument \"" << argv[1] << "\".\n";
 			return 1;
@@ -433,11 +769,7 @@ int __cdecl main([[maybe_unused]] int argc, [[maybe_unused]] char** argv) {
 	//system("pause");
 	std::cout << "Execution finished.";
 
-#ifdef DIRDIFFER_ALLOCATION_LOGGING
-
-	diff::diag::program_finished();
-
-#endif
+	diff::memory::log_profile();
 
 	return 0;
 	
@@ -1,259 +1,20 @@
 #include "memory.h"
 #include "int_defs.h"
 #include "logger.h"
+#include "rng.h"
 #include <cstdlib>	// std::malloc, std::free
 #include <array>
+#include <algorithm>	// std::copy, std::min for thread cache magazines
 #include <bit>		// std::has_single_bit for alignment value verification
 #include <new>		// std::hardware_constructive_interference_size
 
 #include <cstddef>	// std::byte
-#include <atomic>	// spinlock
+#include <atomic>	// spinlock, tracing and profiling
+#include <string_view>
 #include <intrin.h>
 #pragma intrinsic(_mm_pause)
 
 
-#ifdef DIRDIFFER_ALLOCATION_LOGGING
-
-#include <chrono>
-
-namespace diff::diag {
-	using std::size_t;
-
-
-	const inline auto start_point = std::chrono::steady_clock::now();
-
-
-	constinit inline size_t total_allocations = 0;
-	constinit inline size_t total_deallocations = 0;
-	constinit inline size_t max_concurrent_allocations = 0;
-	constinit inline size_t unhandled_deallocations = 0;
-
-	constinit inline size_t total_bytes_allocated = 0;
-	constinit inline size_t total_bytes_deallocated = 0;
-	constinit inline size_t maximum_bytes_in_use = 0;
-
-	struct block_stats {
-		size_t uses = 0;
-		size_t current = 0;
-		size_t max = 0;
-		size_t fails = 0;
-	};
-	constinit inline std::array<block_stats, 8> blocks_records{};
-	constinit inline size_t total_blocks_requested_bytes = 0;
-	constinit inline size_t current_blocks_used_bytes = 0;
-	constinit inline size_t max_blocks_used_bytes = 0;
-
-	class fancy_array {
-	private:
-		struct simple_pair {
-			constexpr void init(const size_t init_block_size) noexcept {
-				block_size = init_block_size;
-				times_allocated = 1;
-			}
-			constexpr void increment() noexcept { ++times_allocated; }
-			constexpr bool empty() const noexcept { return block_size == 0; }
-			constexpr void swap(simple_pair& rhs) noexcept {
-				size_t temp1 = this->block_size;
-				size_t temp2 = this->times_allocated;
-				this->block_size = rhs.block_size;
-				this->times_allocated = rhs.times_allocated;
-				rhs.block_size = temp1;
-				rhs.times_allocated = temp2;
-			}
-			constexpr auto operator==(const size_t other_block_size) const noexcept { return block_size == other_block_size; }
-			constexpr auto operator<=>(const simple_pair& rhs) const noexcept { return this->times_allocated <=> rhs.times_allocated; }
-			size_t block_size{ 0 };
-			size_t times_allocated{ 0 };
-		};
-
-		std::array<simple_pair, 100> data{};
-
-	public:
-		constexpr void increment(const size_t block_size) noexcept {
-			if (not data.back().empty()) {
-				return; // Already holding 100 records.
-			}
-
-			const auto begin = data.begin();
-			const auto end = data.end();
-
-			auto it = begin;
-			for (; it != end; ++it) {
-				if (*it == block_size) {
-					it->increment();
-					break;
-				}
-				if (it->empty()) {
-					it->init(block_size);
-					return;
-				}
-			}
-
-			for (auto previous = it; previous != begin;) {
-				--previous;
-				if (*it >= *previous) {
-					it->swap(*previous);
-					--it;
-				}
-				else {
-					return;
-				}
-			}
-
-		}
-
-		constexpr auto size() const noexcept {
-			size_t ret = 0;
-			for (const auto& elem : data) {
-				ret += not elem.empty();
-			}
-			return ret;
-		}
-		constexpr auto begin() const noexcept { return data.begin(); }
-		constexpr auto end() const noexcept { return data.end(); }
-
-	};
-
-	constinit inline size_t total_stack_requested_bytes = 0;
-	constinit inline size_t current_stack_used_bytes = 0;
-	constinit inline size_t max_stack_used_bytes = 0;
-	constinit inline size_t stack_failures = 0;
-	constinit inline fancy_array stack_top_allocation_sizes_and_counts{};
-
-	constinit inline size_t malloc_bytes = 0;
-	constinit inline size_t malloc_failures = 0;
-
-	constinit inline size_t aligned_allocations = 0;
-
-
-	enum class allocator : size_t {
-		bitblocks,
-		stack,
-		malloc
-	};
-
-	constexpr void generic_allocation_bookkeeping(const size_t byte_count, const bool aligned) noexcept {
-		if (++total_allocations; total_allocations >= total_deallocations) {
-			const auto diff = total_allocations - total_deallocations;
-			max_concurrent_allocations = diff > max_concurrent_allocations ? diff : max_concurrent_allocations;
-		}
-
-		if (total_bytes_allocated += byte_count; total_bytes_allocated >= total_bytes_deallocated) {
-			const auto diff = total_bytes_allocated - total_bytes_deallocated;
-			maximum_bytes_in_use = diff > maximum_bytes_in_use ? diff : maximum_bytes_in_use;
-		}
-
-		if (aligned) {
-			++aligned_allocations;
-		}
-	}
-
-	constexpr void report_bitblocks_allocation(const size_t byte_count, const bool aligned) noexcept {
-		generic_allocation_bookkeeping(byte_count, aligned);
-
-		total_blocks_requested_bytes += byte_count;
-		current_blocks_used_bytes += byte_count;
-		if (current_blocks_used_bytes > max_blocks_used_bytes) {
-			max_blocks_used_bytes = current_blocks_used_bytes;
-		}
-		const size_t idx = (byte_count >> 4) - 1;
-		++blocks_records[idx].uses;
-		const size_t current = ++blocks_records[idx].current;
-		if (current > blocks_records[idx].max) {
-			blocks_records[idx].max = current;
-		}
-	}
-	constexpr void report_stack_allocation(const size_t byte_count, const bool aligned) noexcept {
-		generic_allocation_bookkeeping(byte_count, aligned);
-
-		total_stack_requested_bytes += byte_count;
-		current_stack_used_bytes += byte_count;
-		if (current_stack_used_bytes > max_stack_used_bytes) {
-			max_stack_used_bytes = current_stack_used_bytes;
-		}
-		stack_top_allocation_sizes_and_counts.increment(byte_count);
-	}
-	constexpr void report_malloc_allocation(const size_t byte_count, const bool aligned) noexcept {
-		generic_allocation_bookkeeping(byte_count, aligned);
-
-		malloc_bytes += byte_count;
-	}
-	
-	constexpr void report_bitblocks_allocation_failure(const size_t byte_count) noexcept {
-		const size_t idx = (byte_count >> 4) - 1;
-		++blocks_records[idx].fails;
-	}
-	constexpr void report_stack_allocation_failure(const size_t byte_count) noexcept { ++stack_failures; }
-	constexpr void report_malloc_allocation_failure(const size_t byte_count) noexcept { ++malloc_failures; }
-
-	constexpr void generic_deallocation_bookkeeping(const size_t byte_count) noexcept {
-		++total_deallocations;
-		total_bytes_deallocated += byte_count;
-	}
-
-	constexpr void report_bitblocks_deallocation(const size_t byte_count) noexcept {
-		generic_deallocation_bookkeeping(byte_count);
-
-		current_blocks_used_bytes -= byte_count;
-		const size_t idx = (byte_count >> 4) - 1;
-		const size_t current = --blocks_records[idx].current;
-	}
-	constexpr void report_stack_deallocation(const size_t byte_count) noexcept {
-		generic_deallocation_bookkeeping(byte_count);
-
-		current_stack_used_bytes -= byte_count;
-	}
-	constexpr void report_malloc_deallocation(const size_t byte_count) noexcept {
-		generic_deallocation_bookkeeping(byte_count);
-	}
-	constexpr void report_unhandled_deallocation() { ++unhandled_deallocations; }
-
-
-	void program_finished() noexcept {
-		const auto end_point = std::chrono::steady_clock::now();
-		const auto microseconds = std::chrono::duration_cast<std::chrono::microseconds>(end_point - start_point).count();
-
-		log::info(""sv);
-		log::info("Memory: End of program signalled. Stats:\n"sv);
-
-		log::info("Memory: total allocations = {} (of which aligned = {})"sv, total_allocations, aligned_allocations);
-		log::info("Memory: total bytes requested = {}"sv, total_bytes_allocated);
-		log::info("Memory: unhandled deallocations = {}\n"sv, unhandled_deallocations);
-
-		log::info("Memory: blocks: requested = {}, max needed = {}\n"sv, total_blocks_requested_bytes, max_blocks_used_bytes);
-
-		const std::array<double, 8> block_counts{ 128.0, 2048.0, 1024.0, 1024.0, 1024.0, 1024.0, 1024.0, 512.0 };
-
-		for (size_t i = 0; i < blocks_records.size(); ++i) {
-			const size_t block_size = (i + 1) << 4;
-			const size_t uses = blocks_records[i].uses;
-			const size_t max = blocks_records[i].max;
-			const size_t fails = blocks_records[i].fails;
-			const size_t pcnt = static_cast<size_t>((static_cast<double>(max) / block_counts[i]) * 100.0);
-			log::info("Memory: {:3} byte blocks: uses = {:4}, max = {:4} ({:2}%), fails = {:4}"sv, block_size, uses, max, pcnt, fails);
-		}
-
-		log::info(""sv);
-		log::info("Memory: stack: requested = {}, max needed = {}, fails = {}\n"sv, total_stack_requested_bytes, max_stack_used_bytes, stack_failures);
-
-		for (const auto& [amount, count] : stack_top_allocation_sizes_and_counts) {
-			if (amount == 0) {
-				break;
-			}
-			log::info("Memory: stack: allocated {:6} bytes {:2} times"sv, amount, count);
-		}
-
-		log::info(""sv);
-		log::info("Memory: malloc: bytes = {}, failures = {}\n"sv, malloc_bytes, malloc_failures);
-
-		log::info("Total runtime before logger destruction = {}us."sv, microseconds);
-	}
-
-}
-
-#endif
-
-
 namespace diff {
 	using std::size_t;
 
@@ -867,7 +628,35 @@ namespace diff {
 		};
 
 		class fixed_blocks {
+		private:
+			// Calls func with the bucket for class_idx. Up here so its return type is known before the members using it.
+			template<typename Self, typename F>
+			static constexpr decltype(auto) with_bucket(Self& self, const size_t class_idx, F&& func) noexcept {
+				switch (class_idx) {
+				case 0: { return func(self.blocks_16); }
+				case 1: { return func(self.blocks_32); }
+				case 2: { return func(self.blocks_48); }
+				case 3: { return func(self.blocks_64); }
+				case 4: { return func(self.blocks_80); }
+				case 5: { return func(self.blocks_96); }
+				case 6: { return func(self.blocks_112); }
+				case 7: { return func(self.blocks_128); }
+				default: { std::unreachable(); }
+				}
+			}
+
 		public:
+			enum : size_t {
+				size_class_count = 8,
+				largest_block_size = 128
+			};
+			// Blocks in each bucket, smallest size first.
+			static constexpr std::array<size_t, size_class_count> block_counts{ memory::bucket_block_counts };
+			static_assert((size_class_count == memory::bucket_count) and (largest_block_size == memory::largest_bucket_block_size));
+
+			// Which bucket blocks of byte_count bytes come from. byte_count must be <= largest_block_size.
+			static constexpr size_t size_class_of(const multiple_of<minimum_alignment> byte_count) noexcept { return (byte_count >> shift_to_normalize) - 1; }
+
 			constexpr std::byte* allocate(const multiple_of<minimum_alignment> byte_count) noexcept {
 				std::byte* ptr = nullptr;
 				if (byte_count <= 128) {
@@ -905,6 +694,20 @@ namespace diff {
 				return deallocated;
 			}
 
+			// Takes up to count free blocks of class_idx into out. Returns how many it took.
+			constexpr size_t allocate_batch(const size_t class_idx, std::byte** out, const size_t count) noexcept {
+				return with_bucket(*this, class_idx, [out, count](auto& bucket) noexcept {
+					size_t taken = 0;
+					for (; taken < count; ++taken) {
+						out[taken] = bucket.allocate();
+						if (out[taken] == nullptr) {
+							break;
+						}
+					}
+					return taken;
+				});
+			}
+
 		private:
 			template<size_t block_size, size_t block_count> requires(
 				(block_size >= minimum_alignment) and
@@ -923,9 +726,7 @@ namespace diff {
 					return ptr;
 				}
 				constexpr bool deallocate(std::byte* ptr) noexcept {
-					const std::uintptr_t ptr_num = std::bit_cast<std::uintptr_t>(ptr);
-					const std::uintptr_t storage_num = std::bit_cast<std::uintptr_t>(&blocks[0].storage[0]);
-					const std::uintptr_t ptr_idx_in_storage = (ptr_num - storage_num) / block_size;
+					const std::uintptr_t ptr_idx_in_storage = index_of(ptr);
 					const bool in_range = ptr_idx_in_storage < block_count;
 					if (in_range) {
 						already_allocated_flags.unset(ptr_idx_in_storage);
@@ -939,36 +740,49 @@ namespace diff {
 					last_valid_ptr_offset = (block_size * block_count) - block_size
 				};
 
+				// Wraps around to something huge for pointers below the blocks, so one compare against block_count checks both ends.
+				constexpr std::uintptr_t index_of(const std::byte* ptr) const noexcept {
+					const std::uintptr_t ptr_num = std::bit_cast<std::uintptr_t>(ptr);
+					const std::uintptr_t storage_num = std::bit_cast<std::uintptr_t>(&blocks[0].storage[0]);
+					return (ptr_num - storage_num) / block_size;
+				}
+
+				// One bit per block, plus a summary word with one bit per full word of those, so finding a free block is two countr_one()s however full the bucket is.
 				struct bit_array {
 					enum : u64 {
 						u64s_needed = (block_count >= 64) ? (block_count / 64) : 1,
 						shift_for_u64_idx = 6, // Shorthand for /64
 						mask_for_bit_idx = 0b11'1111
 					};
+					static_assert(u64s_needed <= 64, "bit_array: The summary word covers 64 words, so 4096 blocks at most.");
 
 					constexpr void set(const u64 absolute_bit_idx) noexcept {
 						const u64 u64_idx = absolute_bit_idx >> shift_for_u64_idx;
 						const u64 bit_idx_in_u64 = absolute_bit_idx & mask_for_bit_idx;
 						const u64 bit_mask = u64{ 1 } << bit_idx_in_u64;
 						data[u64_idx] |= bit_mask;
+						if (data[u64_idx] == ~u64{ 0 }) {
+							full_words |= u64{ 1 } << u64_idx;
+						}
 					}
 					constexpr void unset(const u64 absolute_bit_idx) noexcept {
 						const u64 u64_idx = absolute_bit_idx >> shift_for_u64_idx;
 						const u64 bit_idx_in_u64 = absolute_bit_idx & mask_for_bit_idx;
 						const u64 bit_mask = ~(u64{ 1 } << bit_idx_in_u64);
 						data[u64_idx] &= bit_mask;
+						full_words &= ~(u64{ 1 } << u64_idx);
 					}
+					// Can return an index >= block_count when block_count < 64, since the bits past it are never set.
 					constexpr size_t find_first_free() const noexcept {
-						for (size_t i = 0; i < u64s_needed; ++i) {
-							const size_t first_zero_idx = std::countr_one(data[i]);
-							if (first_zero_idx < 64) {
-								return first_zero_idx + (i * 64);
-							}
+						const size_t first_free_word = std::countr_one(full_words);
+						if (first_free_word >= u64s_needed) {
+							return static_cast<size_t>(-1);
+							static_assert(static_cast<size_t>(-1) == std::numeric_limits<size_t>::max());
 						}
-						return static_cast<size_t>(-1);
-						static_assert(static_cast<size_t>(-1) == std::numeric_limits<size_t>::max());
+						return static_cast<size_t>(std::countr_one(data[first_free_word])) + (first_free_word * 64);
 					}
 
+					u64 full_words{ 0 };	// Bit i set if data[i] is all ones.
 					u64 data[u64s_needed]{};
 				};
 				bit_array already_allocated_flags{}; // Aligned to at least minimum_alignment just by being here, so don't specify differently.
@@ -977,159 +791,195 @@ namespace diff {
 				alignas(block_alignment) block blocks[block_count]{};
 			};
 
-			block_bucket<16, 128> blocks_16{};
-			block_bucket<32, 2048> blocks_32{};
-			block_bucket<48, 1024> blocks_48{};
-			block_bucket<64, 1024> blocks_64{};
-			block_bucket<80, 1024> blocks_80{};
-			block_bucket<96, 1024> blocks_96{};
-			block_bucket<112, 1024> blocks_112{};
-			block_bucket<128, 512> blocks_128{};
+			block_bucket<16, block_counts[0]> blocks_16{};
+			block_bucket<32, block_counts[1]> blocks_32{};
+			block_bucket<48, block_counts[2]> blocks_48{};
+			block_bucket<64, block_counts[3]> blocks_64{};
+			block_bucket<80, block_counts[4]> blocks_80{};
+			block_bucket<96, block_counts[5]> blocks_96{};
+			block_bucket<112, block_counts[6]> blocks_112{};
+			block_bucket<128, block_counts[7]> blocks_128{};
 
 		};
 		//static_assert(alignof(fixed_blocks) == 128); // This passes as it should, but Intellisense disagrees and thinks it's aligned on 16.
 
-		class stack {
+		// Where small blocks come from once their bucket is full: slabs taken from malloc as needed, carved into blocks of one size class each.
+		// Freed blocks go on a free list per size class, threaded through the blocks themselves, to be handed out again before any new slab is carved up.
+		// Slabs are kept until exit, so either way a block costs a pointer pop or bump.
+		class slab_pools {
 		public:
-			constexpr std::byte* allocate(const multiple_of<minimum_alignment> byte_count) noexcept {
-				std::byte* ptr = nullptr;
-				if (remaining >= byte_count) {
-					ptr = next_byte;
-					next_byte += byte_count;
-					remaining -= byte_count;
+			// Returns null only if a new slab was needed and malloc failed.
+			std::byte* allocate(const size_t class_idx) noexcept {
+				pool& p = pools[class_idx];
+				if (p.free_list != nullptr) {
+					std::byte* ptr = reinterpret_cast<std::byte*>(p.free_list);
+					p.free_list = p.free_list->next;
+					return ptr;
 				}
-				return ptr;
-			}
-			constexpr std::byte* allocate(const multiple_of<minimum_alignment> byte_count, const std::align_val_t alignment) noexcept {
-				// Raise alignment to minimum_alignment if lower, and round it up to the nearest power of two (if already a power of 2, no changes).
-				const size_t adjusted_alignment = std::bit_ceil(std::max<size_t>(static_cast<size_t>(alignment), minimum_alignment));
-				const size_t bytes_to_skip_to_align = amount_missing_to_next_multiple_of_x(std::bit_cast<size_t>(next_byte), adjusted_alignment);
-				const size_t total_bytes_needed = byte_count + bytes_to_skip_to_align;
-				std::byte* ptr = nullptr;
-				if (remaining >= total_bytes_needed) {
-					next_byte += bytes_to_skip_to_align;
-					ptr = next_byte;
-					next_byte += byte_count;
-					remaining -= total_bytes_needed;
+				if ((p.unused_blocks == 0) and not grow(p, class_idx)) {
+					return nullptr;
 				}
+				std::byte* ptr = p.next_unused;
+				p.next_unused += block_size_of(class_idx);
+				--p.unused_blocks;
 				return ptr;
 			}
-			constexpr bool deallocate(std::byte* ptr, const multiple_of<minimum_alignment> byte_count) noexcept {
-				bool deallocated = false;
-				const std::uintptr_t ptr_num = std::bit_cast<std::uintptr_t>(ptr);
-				const std::uintptr_t storage_num = std::bit_cast<std::uintptr_t>(first_byte);
-				const std::uintptr_t offset = ptr_num - storage_num;
-				const bool in_range = (ptr_num >= storage_num) bitand (offset < stack_memory_block_size);
-				if (in_range) {
-					if (ptr + byte_count == next_byte) { // If it was the last allocation, it can be undone.
-						next_byte = ptr;
-						remaining += byte_count;
-					}
-					deallocated = true;
-				}
-				return deallocated;
+
+			// ptr must have come from allocate(class_idx).
+			void deallocate(std::byte* ptr, const size_t class_idx) noexcept {
+				pool& p = pools[class_idx];
+				p.free_list = ::new (static_cast<void*>(ptr)) free_block{ p.free_list };
 			}
-			// Can't do anything fancy with alignment in deallocation, so no separate method.
+
+			[[nodiscard]] size_t slab_count(const size_t class_idx) const noexcept { return pools[class_idx].slab_count; }
+			[[nodiscard]] static constexpr size_t blocks_per_slab(const size_t class_idx) noexcept { return slab_size / block_size_of(class_idx); }
+
 		private:
-			// MSVC won't accept constinit-ing an object with an 8MB array non-static member (4MB seems to work). Gotta have a raw static array. Probably a bug.
-			enum : size_t { stack_memory_block_size = size_t{ 8 } * size_t{ 1024 } * size_t{ 1024 } }; // 8MB
-			alignas(minimum_alignment) static constinit std::byte stack_block[stack_memory_block_size];
+			enum : size_t { slab_size = size_t{ 64 } * size_t{ 1024 } };
 
-			size_t remaining{ stack_memory_block_size };
-			/*std::byte* next_byte{ stack_block.storage };
-			std::byte* first_byte{ stack_block.storage };*/
-			std::byte* next_byte{ stack_block };
-			std::byte* first_byte{ stack_block };
+			struct free_block {
+				free_block* next;
+			};
+			static_assert(sizeof(free_block) <= minimum_alignment);
 
-			static constexpr size_t amount_missing_to_next_multiple_of_x(const size_t current, const size_t x) noexcept {
-				const size_t x_mask = x - 1;
+			struct pool {
+				free_block* free_list{ nullptr };
+				std::byte* next_unused{ nullptr };	// In the newest slab.
+				size_t unused_blocks{ 0 };
+				size_t slab_count{ 0 };
+			};
+			std::array<pool, fixed_blocks::size_class_count> pools{};
 
-				size_t addition = current & x_mask;		// Get remainder of division by x (% x).
-				addition = (x - addition) & x_mask;		// Get complement of remainder towards x. Mask with x_mask so if addition == 0, it stays == 0 (input already rounded).
+			static constexpr size_t block_size_of(const size_t class_idx) noexcept { return (class_idx + 1) << shift_to_normalize; }
 
-				return addition;
+			// malloc aligns to at least minimum_alignment, and block sizes are multiples of it, so every block is aligned.
+			static bool grow(pool& p, const size_t class_idx) noexcept {
+				std::byte* slab = static_cast<std::byte*>(std::malloc(slab_size));
+				if (slab == nullptr) {
+					return false;
+				}
+				p.next_unused = slab;
+				p.unused_blocks = blocks_per_slab(class_idx);
+				++p.slab_count;
+				return true;
 			}
 		};
 
-#ifdef DIRDIFFER_ALLOCATION_LOGGING
-		static constexpr void report_bitblocks_allocation(const size_t byte_count, const bool aligned = false) noexcept {
-			diag::report_bitblocks_allocation(byte_count, aligned);
-		}
-		static constexpr void report_stack_allocation(const size_t byte_count, const bool aligned = false) noexcept {
-			diag::report_stack_allocation(byte_count, aligned);
+		// Bucket blocks first, then slab blocks. Either way, they are small blocks of class_idx, freed with free_small_blocks. Lock must be held.
+		static size_t take_small_blocks(const size_t class_idx, std::byte** out, const size_t count) noexcept {
+			size_t taken = primary_bitblocks.allocate_batch(class_idx, out, count);
+			for (; taken < count; ++taken) {
+				out[taken] = secondary_slabs.allocate(class_idx);
+				if (out[taken] == nullptr) {
+					break;
+				}
+			}
+			return taken;
 		}
-		static constexpr void report_malloc_allocation(const size_t byte_count, const bool aligned = false) noexcept {
-			diag::report_malloc_allocation(byte_count, aligned);
+		static void free_small_blocks(const size_t class_idx, std::byte* const* ptrs, const size_t count) noexcept {
+			for (size_t i = 0; i < count; ++i) {
+				if (not primary_bitblocks.deallocate(ptrs[i], (class_idx + 1) << shift_to_normalize)) {
+					secondary_slabs.deallocate(ptrs[i], class_idx);
+				}
+			}
 		}
 
-		static constexpr void report_bitblocks_allocation_failure(const size_t byte_count) noexcept {
-			diag::report_bitblocks_allocation_failure(byte_count);
-		}
-		static constexpr void report_stack_allocation_failure(const size_t byte_count) noexcept {
-			diag::report_stack_allocation_failure(byte_count);
-		}
-		static constexpr void report_malloc_allocation_failure(const size_t byte_count) noexcept {
-			diag::report_malloc_allocation_failure(byte_count);
-		}
+		// Each thread keeps a magazine of free blocks for every size class to itself, so most small allocations and deallocations never touch the lock.
+		// The lock is only taken to refill an empty magazine or hand back half of a full one, a batch of blocks at a time. All blocks go back when the thread exits.
+		class thread_cache {
+		public:
+			constexpr thread_cache() noexcept = default;
+			~thread_cache() noexcept {
+				cache_retired = true; // Anything this thread frees after this point, in other thread-locals' destructors, skips the cache.
+				spinlock_guard guard{ lock };
+				for (size_t i = 0; i < fixed_blocks::size_class_count; ++i) {
+					free_small_blocks(i, magazines[i].blocks.data(), magazines[i].count);
+					magazines[i].count = 0;
+				}
+			}
+			thread_cache(const thread_cache&) = delete;
+			thread_cache(thread_cache&&) = delete;
+			thread_cache& operator=(const thread_cache&) = delete;
+			thread_cache& operator=(thread_cache&&) = delete;
+
+			// Returns null only if a slab was needed and couldn't be had.
+			std::byte* allocate(const size_t class_idx) noexcept {
+				magazine& mag = magazines[class_idx];
+				if (mag.count == 0) {
+					spinlock_guard guard{ lock };
+					mag.count = take_small_blocks(class_idx, mag.blocks.data(), batch_sizes[class_idx]);
+				}
+				return (mag.count != 0) ? mag.blocks[--mag.count] : nullptr;
+			}
 
-		static constexpr void report_bitblocks_deallocation(const size_t byte_count) noexcept {
-			diag::report_bitblocks_deallocation(byte_count);
-		}
-		static constexpr void report_stack_deallocation(const size_t byte_count) noexcept {
-			diag::report_stack_deallocation(byte_count);
-		}
-		static constexpr void report_malloc_deallocation(const size_t byte_count) noexcept {
-			diag::report_malloc_deallocation(byte_count);
-		}
-		static constexpr void report_unhandled_deallocation() noexcept  { diag::report_unhandled_deallocation(); }
-#else
-		static constexpr void report_bitblocks_allocation(const size_t) noexcept {}
-		static constexpr void report_stack_allocation(const size_t) noexcept {}
-		static constexpr void report_malloc_allocation(const size_t) noexcept {}
-
-		static constexpr void report_bitblocks_allocation(const size_t, const bool) noexcept {}
-		static constexpr void report_stack_allocation(const size_t, const bool) noexcept {}
-		static constexpr void report_malloc_allocation(const size_t, const bool) noexcept {}
-
-		static constexpr void report_bitblocks_allocation_failure(const size_t) noexcept {}
-		static constexpr void report_stack_allocation_failure(const size_t) noexcept {}
-		static constexpr void report_malloc_allocation_failure(const size_t) noexcept {}
-
-		static constexpr void report_bitblocks_deallocation(const size_t byte_count) noexcept {}
-		static constexpr void report_stack_deallocation(const size_t byte_count) noexcept {}
-		static constexpr void report_malloc_deallocation(const size_t byte_count) noexcept {}
-		static constexpr void report_unhandled_deallocation() noexcept {}
-#endif
+			// ptr must be a small block of class_idx, from a bucket or a slab.
+			void deallocate(std::byte* ptr, const size_t class_idx) noexcept {
+				magazine& mag = magazines[class_idx];
+				if (mag.count == capacities[class_idx]) {
+					// Hand back the oldest half. The newest are the likeliest to still be in the CPU's cache.
+					const size_t batch = batch_sizes[class_idx];
+					{
+						spinlock_guard guard{ lock };
+						free_small_blocks(class_idx, mag.blocks.data(), batch);
+					}
+					std::copy(mag.blocks.begin() + batch, mag.blocks.begin() + mag.count, mag.blocks.begin());
+					mag.count -= batch;
+				}
+				mag.blocks[mag.count++] = ptr;
+			}
+
+		private:
+			enum : size_t { max_capacity = 32 };
+
+			// A magazine holds 1/32 of its bucket, or 2 blocks for tiny buckets, so a handful of threads can't hoard a small bucket between them.
+			static constexpr std::array<size_t, fixed_blocks::size_class_count> capacities = [] {
+				std::array<size_t, fixed_blocks::size_class_count> ret{};
+				for (size_t i = 0; i < ret.size(); ++i) {
+					ret[i] = std::clamp<size_t>(fixed_blocks::block_counts[i] / 32, 2, max_capacity);
+				}
+				return ret;
+			}();
+			static constexpr std::array<size_t, fixed_blocks::size_class_count> batch_sizes = [] {
+				std::array<size_t, fixed_blocks::size_class_count> ret{};
+				for (size_t i = 0; i < ret.size(); ++i) {
+					ret[i] = capacities[i] / 2;
+				}
+				return ret;
+			}();
+			static_assert(std::ranges::all_of(batch_sizes, [](const size_t batch) { return batch != 0; }), "thread_cache: a bucket is too small for a magazine.");
+
+			struct magazine {
+				size_t count{ 0 };
+				std::array<std::byte*, max_capacity> blocks{};
+			};
+			std::array<magazine, fixed_blocks::size_class_count> magazines{};
+		};
 
 	public:
-		static constexpr std::byte* allocate(const size_t byte_count) noexcept {
-			{
-				const multiple_of<minimum_alignment> adjusted_amount{ byte_count }; // Rounds up if needed.
+		// Small blocks come from the calling thread's cache. Everything else takes the lock.
+		static std::byte* allocate(const size_t byte_count) noexcept {
+			const multiple_of<minimum_alignment> adjusted_amount{ byte_count }; // Rounds up if needed.
+			if ((adjusted_amount <= fixed_blocks::largest_block_size) and not cache_retired) {
+				return cache.allocate(fixed_blocks::size_class_of(adjusted_amount));
+			}
+			return allocate_locked(byte_count);
+		}
+		// Small blocks come from their bucket, or a slab once the bucket is full. Only bigger blocks come from malloc.
+		static constexpr std::byte* allocate_locked(const size_t byte_count) noexcept {
+			const multiple_of<minimum_alignment> adjusted_amount{ byte_count }; // Rounds up if needed.
+			if (adjusted_amount <= fixed_blocks::largest_block_size) {
+				const size_t class_idx = fixed_blocks::size_class_of(adjusted_amount);
 
 				spinlock_guard guard{ lock };
 
 				if (std::byte* ptr = primary_bitblocks.allocate(adjusted_amount); nullptr != ptr) {
-					report_bitblocks_allocation(adjusted_amount);
-					return ptr;
-				}
-				if (adjusted_amount <= 128) { // Only a failure if it could fit in a bucket to begin with.
-					report_bitblocks_allocation_failure(adjusted_amount);
-				}
-
-				if (std::byte* ptr = fallback_stack.allocate(adjusted_amount); nullptr != ptr) {
-					report_stack_allocation(adjusted_amount);
 					return ptr;
 				}
-				report_stack_allocation_failure(adjusted_amount);
+				// Small blocks never come from malloc, or deallocation couldn't tell a slab block from a malloc one.
+				return secondary_slabs.allocate(class_idx);
 			}
 
-			if (std::byte* ptr = static_cast<std::byte*>(std::malloc(byte_count)); nullptr != ptr) {
-				report_malloc_allocation(byte_count);
-				return ptr;
-			}
-			report_malloc_allocation_failure(byte_count);
-			
-			return nullptr;
+			return static_cast<std::byte*>(std::malloc(byte_count));
 		}
 		static constexpr std::byte* allocate(const size_t byte_count, const std::align_val_t alignment) noexcept {
 			{
@@ -1138,49 +988,35 @@ namespace diff {
 				spinlock_guard guard{ lock };
 
 				if (std::byte* ptr = primary_bitblocks.allocate(adjusted_amount); nullptr != ptr) {
-					report_bitblocks_allocation(adjusted_amount, true);
 					return ptr;
 				}
-				report_bitblocks_allocation_failure(adjusted_amount);
-
-				const std::align_val_t adjusted_alignment = static_cast<std::align_val_t>(static_cast<size_t>(alignment) < minimum_alignment ? minimum_alignment : static_cast<size_t>(alignment));
-				if (std::byte* ptr = fallback_stack.allocate(adjusted_amount, adjusted_alignment); nullptr != ptr) {
-					report_stack_allocation(adjusted_amount, true);
-					return ptr;
-				}
-				report_stack_allocation_failure(adjusted_amount);
-			}
-
-			if (std::byte* ptr = static_cast<std::byte*>(_aligned_malloc(byte_count, static_cast<size_t>(alignment))); nullptr != ptr) {
-				report_malloc_allocation(byte_count, true);
-				return ptr;
 			}
-			report_malloc_allocation_failure(byte_count);
 
-			return nullptr;
+			return static_cast<std::byte*>(_aligned_malloc(byte_count, static_cast<size_t>(alignment)));
 		}
 
-		static constexpr void deallocate(std::byte*) noexcept { report_unhandled_deallocation(); }
-		static constexpr void deallocate(std::byte* ptr, const size_t byte_count) noexcept {
-			{
-				const multiple_of<minimum_alignment> adjusted_amount{ byte_count }; // Rounds up if needed.
-
+		static constexpr void deallocate(std::byte*) noexcept {} // Without a size there is no telling where the block came from, so it is leaked.
+		static void deallocate(std::byte* ptr, const size_t byte_count) noexcept {
+			const multiple_of<minimum_alignment> adjusted_amount{ byte_count }; // Rounds up if needed.
+			if ((adjusted_amount <= fixed_blocks::largest_block_size) and not cache_retired) {
+				cache.deallocate(ptr, fixed_blocks::size_class_of(adjusted_amount));
+				return;
+			}
+			deallocate_locked(ptr, byte_count);
+		}
+		static constexpr void deallocate_locked(std::byte* ptr, const size_t byte_count) noexcept {
+			const multiple_of<minimum_alignment> adjusted_amount{ byte_count }; // Rounds up if needed.
+			if (adjusted_amount <= fixed_blocks::largest_block_size) {
 				spinlock_guard guard{ lock };
 
-				if (primary_bitblocks.deallocate(ptr, adjusted_amount)) {
-					report_bitblocks_deallocation(adjusted_amount);
-					return;
-				}
-
-				if (fallback_stack.deallocate(ptr, adjusted_amount)) {
-					report_stack_deallocation(adjusted_amount);
-					return;
+				if (not primary_bitblocks.deallocate(ptr, adjusted_amount)) {
+					secondary_slabs.deallocate(ptr, fixed_blocks::size_class_of(adjusted_amount));
 				}
+				return;
 			}
 			std::free(ptr);
-			report_malloc_deallocation(byte_count);
 		}
-		static constexpr void deallocate(std::byte*, std::align_val_t) noexcept { report_unhandled_deallocation(); }
+		static constexpr void deallocate(std::byte*, std::align_val_t) noexcept {}
 		static constexpr void deallocate(std::byte* ptr, const size_t byte_count, std::align_val_t alignment) noexcept {
 			{
 				const multiple_of<minimum_alignment> adjusted_amount{ byte_count }; // Rounds up if needed.
@@ -1188,33 +1024,235 @@ namespace diff {
 				spinlock_guard guard{ lock };
 
 				if (primary_bitblocks.deallocate(ptr, adjusted_amount)) {
-					report_bitblocks_deallocation(adjusted_amount);
-					return;
-				}
-
-				if (fallback_stack.deallocate(ptr, adjusted_amount)) {
-					report_stack_deallocation(adjusted_amount);
 					return;
 				}
 			}
 			_aligned_free(ptr);
-			report_malloc_deallocation(byte_count);
+		}
+
+		// Slabs taken so far for blocks of class_idx, once the bucket ran out.
+		static size_t slab_count(const size_t class_idx) noexcept {
+			spinlock_guard guard{ lock };
+			return secondary_slabs.slab_count(class_idx);
 		}
 
 	private:
 		static constinit spinlock lock;
 
 		static constinit fixed_blocks primary_bitblocks;
-		static constinit stack fallback_stack;
+		static constinit slab_pools secondary_slabs;
+
+		static constinit thread_local thread_cache cache;
+		static constinit thread_local bool cache_retired; // Separate from cache, so it can still be read after cache is destroyed.
 
 	};
 
 	constinit global_memory::spinlock global_memory::lock{};
 
 	constinit global_memory::fixed_blocks global_memory::primary_bitblocks{};
-	//constinit global_memory::stack::memory_block global_memory::stack::stack_block{};
-	alignas(global_memory::minimum_alignment) constinit std::byte global_memory::stack::stack_block[stack_memory_block_size]{};
-	constinit global_memory::stack global_memory::fallback_stack{};
+	constinit global_memory::slab_pools global_memory::secondary_slabs{};
+
+	constinit thread_local global_memory::thread_cache global_memory::cache{};
+	constinit thread_local bool global_memory::cache_retired{ false };
+
+
+	void* memory::allocate(const size_t byte_count, const path via) noexcept {
+		return (via == path::thread_cache) ? global_memory::allocate(byte_count) : global_memory::allocate_locked(byte_count);
+	}
+
+	void memory::deallocate(void* ptr, const size_t byte_count, const path via) noexcept {
+		if (via == path::thread_cache) {
+			global_memory::deallocate(static_cast<std::byte*>(ptr), byte_count);
+		}
+		else {
+			global_memory::deallocate_locked(static_cast<std::byte*>(ptr), byte_count);
+		}
+	}
+
+
+	// Allocation tracing. When off, all it costs operator new and delete is a relaxed load.
+	static constinit std::atomic<bool> tracing{ false };
+	static constinit memory::trace_event* trace_events{ nullptr };
+	static constinit size_t trace_capacity{ 0 };
+	static constinit std::atomic<size_t> trace_length{ 0 };
+
+	static void trace(const void* ptr, const size_t byte_count, const bool freed) noexcept {
+		if (not tracing.load(std::memory_order::relaxed)) {
+			return;
+		}
+		const size_t idx = trace_length.fetch_add(1, std::memory_order::relaxed);
+		if (idx < trace_capacity) {
+			trace_events[idx] = memory::trace_event{ ptr, static_cast<u32>(byte_count), freed };
+		}
+	}
+
+	void memory::start_trace(const std::span<trace_event> events) noexcept {
+		trace_events = events.data();
+		trace_capacity = events.size();
+		trace_length.store(0, std::memory_order::relaxed);
+		tracing.store(true, std::memory_order::release);
+	}
+
+	size_t memory::stop_trace() noexcept {
+		tracing.store(false, std::memory_order::relaxed);
+		return std::min(trace_length.load(std::memory_order::relaxed), trace_capacity);
+	}
+
+
+	// Allocation profiling. Off, it costs operator new and delete a relaxed load too. On, each thread adds up the bytes it allocated minus the bytes it freed on its own,
+	// and only every profile_sample_interval-th allocation, or deallocation, of a thread passes that on to the live count the threads share, and checks it against the peaks.
+	// A sampled allocation also goes in the histogram and the current phase, standing in for profile_sample_interval of them. The gaps between samples are random, averaging
+	// profile_sample_interval, or code that allocates in a repeating pattern, like a string object and then its buffer, would have the same one of them sampled every time.
+	enum : size_t {
+		profile_size_bin_count = memory::bucket_count + 17,	// A bin per bucket block size, then one per power of 2 up to 8 MiB, then one for anything bigger.
+		max_profile_phases = 16,
+		max_unshared_bytes = size_t{ 1024 } * 1024	// Shared early past this either way, so a few big allocations or deallocations between samples still show.
+	};
+
+	struct profile_size_bin {
+		std::atomic<u64> count{ 0 };
+		std::atomic<u64> bytes{ 0 };
+	};
+	struct profile_phase {
+		std::string_view name{};
+		std::atomic<u64> count{ 0 };
+		std::atomic<u64> bytes{ 0 };
+		std::atomic<i64> peak_live_bytes{ 0 };
+	};
+	struct profile_thread_counts {
+		i64 unshared_bytes{ 0 };
+		size_t until_allocation_sample{ memory::profile_sample_interval };
+		size_t until_deallocation_sample{ memory::profile_sample_interval };
+		gamerand rng{ 1 };
+
+		[[nodiscard]] constexpr size_t next_gap() noexcept { return 1 + (rng.next() % ((2 * memory::profile_sample_interval) - 1)); }
+	};
+
+	static constinit std::atomic<bool> profiling{ false };
+	static constinit bool profile_started{ false };
+	static constinit std::array<profile_size_bin, profile_size_bin_count> profile_size_bins{};
+	static constinit std::array<profile_phase, max_profile_phases> profile_phases{};
+	static constinit size_t profile_phase_count{ 0 };
+	static constinit std::atomic<size_t> current_profile_phase{ 0 };
+	static constinit std::atomic<i64> profile_live_bytes{ 0 };
+	static constinit std::atomic<i64> profile_peak_live_bytes{ 0 };
+	static constinit thread_local profile_thread_counts profile_counts{};
+
+	static constexpr size_t profile_size_bin_of(const size_t byte_count) noexcept {
+		if (byte_count <= memory::largest_bucket_block_size) {
+			return (byte_count + (byte_count == 0) + 15) / 16 - 1;
+		}
+		return std::min<size_t>(memory::bucket_count + std::bit_width(byte_count - 1) - 8, profile_size_bin_count - 1);
+	}
+	static_assert((profile_size_bin_of(1) == 0) and (profile_size_bin_of(128) == 7) and (profile_size_bin_of(129) == 8) and (profile_size_bin_of(256) == 8) and (profile_size_bin_of(257) == 9));
+	static_assert(profile_size_bin_of(size_t{ 8 } * 1024 * 1024) == (profile_size_bin_count - 2));
+
+	static void raise_to(std::atomic<i64>& peak, const i64 val) noexcept {
+		i64 old = peak.load(std::memory_order::relaxed);
+		while ((val > old) and not peak.compare_exchange_weak(old, val, std::memory_order::relaxed)) {}
+	}
+
+	static void share_live_bytes(profile_thread_counts& counts) noexcept {
+		const i64 live = profile_live_bytes.fetch_add(counts.unshared_bytes, std::memory_order::relaxed) + counts.unshared_bytes;
+		counts.unshared_bytes = 0;
+		raise_to(profile_peak_live_bytes, live);
+		raise_to(profile_phases[current_profile_phase.load(std::memory_order::relaxed)].peak_live_bytes, live);
+	}
+
+	static void profile_allocation(const size_t byte_count) noexcept {
+		if (not profiling.load(std::memory_order::relaxed)) {
+			return;
+		}
+		profile_thread_counts& counts = profile_counts;
+		counts.unshared_bytes += static_cast<i64>(byte_count);
+		if (--counts.until_allocation_sample == 0) {
+			counts.until_allocation_sample = counts.next_gap();
+
+			const u64 scaled_bytes = u64{ byte_count } * memory::profile_sample_interval;
+			profile_size_bin& bin = profile_size_bins[profile_size_bin_of(byte_count)];
+			bin.count.fetch_add(memory::profile_sample_interval, std::memory_order::relaxed);
+			bin.bytes.fetch_add(scaled_bytes, std::memory_order::relaxed);
+			profile_phase& phase = profile_phases[current_profile_phase.load(std::memory_order::relaxed)];
+			phase.count.fetch_add(memory::profile_sample_interval, std::memory_order::relaxed);
+			phase.bytes.fetch_add(scaled_bytes, std::memory_order::relaxed);
+		}
+		else if (counts.unshared_bytes < static_cast<i64>(max_unshared_bytes)) {
+			return;
+		}
+		share_live_bytes(counts);
+	}
+
+	static void profile_deallocation(const size_t byte_count) noexcept {
+		if (not profiling.load(std::memory_order::relaxed)) {
+			return;
+		}
+		profile_thread_counts& counts = profile_counts;
+		counts.unshared_bytes -= static_cast<i64>(byte_count);
+		if (--counts.until_deallocation_sample == 0) {
+			counts.until_deallocation_sample = counts.next_gap();
+		}
+		else if (counts.unshared_bytes > -static_cast<i64>(max_unshared_bytes)) {
+			return;
+		}
+		share_live_bytes(counts);
+	}
+
+	void memory::start_profiling() noexcept {
+		if (profile_started) {
+			return;
+		}
+		profile_started = true;
+		profile_phases[0].name = "start"sv;
+		profile_phase_count = 1;
+		profiling.store(true, std::memory_order::release);
+	}
+
+	void memory::enter_phase(const std::string_view name) noexcept {
+		if (not profile_started or (profile_phase_count == max_profile_phases)) {
+			return;
+		}
+		profile_phase& phase = profile_phases[profile_phase_count];
+		phase.name = name;
+		phase.peak_live_bytes.store(profile_live_bytes.load(std::memory_order::relaxed), std::memory_order::relaxed);
+		current_profile_phase.store(profile_phase_count++, std::memory_order::relaxed);
+	}
+
+	void memory::log_profile() noexcept {
+		if (not profile_started) {
+			return;
+		}
+		profiling.store(false, std::memory_order::relaxed);
+
+		log::info(""sv);
+		log::info("Memory: Allocation profile, from 1 in {} calls on each thread. At most <{}> bytes were live at once."sv, profile_sample_interval, std::max<i64>(profile_peak_live_bytes.load(), 0));
+
+		for (size_t i = 0; i < profile_size_bins.size(); ++i) {
+			const u64 count = profile_size_bins[i].count.load();
+			const u64 bytes = profile_size_bins[i].bytes.load();
+			if (count == 0) {
+				continue;
+			}
+			if (i == (profile_size_bins.size() - 1)) {
+				log::info("Memory: allocations over {:7} bytes: {:10}, totalling {:13} bytes"sv, size_t{ 1 } << (i - 1), count, bytes);
+			}
+			else {
+				const size_t largest = (i < bucket_count) ? ((i + 1) * 16) : (size_t{ 1 } << i);
+				log::info("Memory: allocations up to {:7} bytes: {:10}, totalling {:13} bytes"sv, largest, count, bytes);
+			}
+		}
+
+		for (size_t i = 0; i < profile_phase_count; ++i) {
+			const profile_phase& phase = profile_phases[i];
+			log::info("Memory: Phase <{}>: <{}> allocations, totalling <{}> bytes, with at most <{}> bytes live."sv, phase.name, phase.count.load(), phase.bytes.load(), std::max<i64>(phase.peak_live_bytes.load(), 0));
+		}
+
+		for (size_t i = 0; i < bucket_count; ++i) {
+			if (const size_t slabs = global_memory::slab_count(i); slabs != 0) {
+				log::info("Memory: {:3} byte blocks outgrew their bucket into <{}> slabs."sv, (i + 1) * 16, slabs);
+			}
+		}
+		log::info(""sv);
+	}
 
 }
 
@@ -1228,6 +1266,8 @@ void* operator new(size_t byte_count) {
 		void* block = diff::global_memory::allocate(byte_count);
 
 		if (block != nullptr) {
+			diff::trace(block, byte_count, false);
+			diff::profile_allocation(byte_count);
 			return block;
 		}
 
@@ -1242,7 +1282,11 @@ void* operator new(size_t byte_count) {
 }
 
 void operator delete(void* ptr) noexcept { diff::global_memory::deallocate(static_cast<std::byte*>(ptr)); }
-void operator delete(void* ptr, size_t byte_count) noexcept { diff::global_memory::deallocate(static_cast<std::byte*>(ptr), byte_count); }
+void operator delete(void* ptr, size_t byte_count) noexcept {
+	diff::trace(ptr, byte_count, true);
+	diff::profile_deallocation(byte_count);
+	diff::global_memory::deallocate(static_cast<std::byte*>(ptr), byte_count);
+}
 
 
 // Aligned
@@ -1253,6 +1297,7 @@ void* operator new(size_t byte_count, std::align_val_t alignment) {
 		void* block = diff::global_memory::allocate(byte_count, alignment);
 
 		if (nullptr != block) {
+			diff::profile_allocation(byte_count);
 			return block;
 		}
 
@@ -1267,7 +1312,10 @@ void* operator new(size_t byte_count, std::align_val_t alignment) {
 }
 
 void operator delete(void* ptr, std::align_val_t alignment) noexcept { diff::global_memory::deallocate(static_cast<std::byte*>(ptr), alignment); }
-void operator delete(void* ptr, size_t byte_count, std::align_val_t alignment) noexcept { diff::global_memory::deallocate(static_cast<std::byte*>(ptr), byte_count, alignment); }
+void operator delete(void* ptr, size_t byte_count, std::align_val_t alignment) noexcept {
+	diff::profile_deallocation(byte_count);
+	diff::global_memory::deallocate(static_cast<std::byte*>(ptr), byte_count, alignment);
+}
 
 
 
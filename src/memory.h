@@ -1,15 +1,63 @@
 #pragma once
-//#include <cstddef>
+#include "int_defs.h"
+#include <cstddef>
+#include <array>
+#include <span>
+#include <string_view>
+
+// Blocks in each of the allocator's buckets, for 16 to 128 byte blocks in steps of 16. Each must be a power of 2, up to 4096.
+// Define as 8 comma separated counts to override, e.g. with the ones "-bench buckets" suggests from the peaks of a real scan.
+#ifndef DIRDIFFER_BLOCK_COUNTS
+#define DIRDIFFER_BLOCK_COUNTS 128, 2048, 1024, 1024, 1024, 1024, 1024, 512
+#endif
 
-//#define DIRDIFFER_ALLOCATION_LOGGING
 
-#ifdef DIRDIFFER_ALLOCATION_LOGGING
+namespace diff::memory {
 
-namespace diff::diag {
-	void program_finished() noexcept;
-}
+	// Direct access to the allocator behind operator new, for benchmarking it. thread_cache is the path operator new takes.
+	// shared_lock skips the calling thread's cache, and takes the allocator's lock on every call.
+	enum class path {
+		thread_cache,
+		shared_lock
+	};
 
-#endif
+	// Same as operator new, except it returns null on failure. Either path can free what the other allocated.
+	[[nodiscard]] void* allocate(std::size_t byte_count, path via) noexcept;
+	void deallocate(void* ptr, std::size_t byte_count, path via) noexcept;
+
+	inline constexpr std::size_t bucket_count{ 8 };
+	inline constexpr std::size_t largest_bucket_block_size{ 128 };
+	inline constexpr std::array<std::size_t, bucket_count> bucket_block_counts{ DIRDIFFER_BLOCK_COUNTS };
+
+
+	// A trace of what operator new and sized operator delete were asked for, to replay against the allocator.
+	struct trace_event {
+		const void* ptr;
+		u32 byte_count;
+		bool freed;
+	};
+
+	// Records every allocation, and every deallocation that comes with its size, into events, until it is full or stop_trace is called.
+	// Meant for tracing work on one thread: recording is lock-free, but events from other threads in flight when it stops may be lost.
+	void start_trace(std::span<trace_event> events) noexcept;
+	// Returns how many events were recorded, which is less than the calls made if events filled up.
+	[[nodiscard]] std::size_t stop_trace() noexcept;
+
+
+	// Allocation profiling, meant to be left on for a real run: a histogram of allocation sizes, and for each phase of the run, how many allocations it made, how many bytes,
+	// and the most bytes live at once. Each thread counts on its own, and only one in profile_sample_interval of its calls to operator new and delete, on average, is recorded
+	// where the threads share it, so profiling costs a few thread-local adds per call. Figures are scaled up from those samples, so they are estimates.
+	// Live bytes only count what was allocated since profiling started, and freed with its size.
+	inline constexpr std::size_t profile_sample_interval{ 64 };
+
+	void start_profiling() noexcept;
+	// Allocations from now on, on any thread, are put down to the phase called name, until the next phase starts. Meant to be called from one thread.
+	// name must outlive the profile, e.g. be a literal. Once there are 16 phases, counting the one profiling started in, the rest are put down to the last of them.
+	void enter_phase(std::string_view name) noexcept;
+	// Stops profiling and logs the profile. Does nothing if profiling was never started.
+	void log_profile() noexcept;
+
+}
 
 
 namespace diff {
@@ -0,0 +1,42 @@
+#pragma once
+#include "int_defs.h"
+#include "vector_defs.h"
+#include <algorithm>	// std::max, std::clamp
+#include <cstddef>		// std::size_t
+#include <functional>	// std::cref
+#include <thread>
+
+
+namespace diff {
+
+	// How many tasks to split work into: one per hardware thread, but none smaller than min_work_per_task, and never fewer than 1.
+	[[nodiscard]] inline std::size_t task_count_for(const u64 work, const u64 min_work_per_task) noexcept {
+		const u64 hardware = std::max<u64>(std::thread::hardware_concurrency(), 1);
+		return static_cast<std::size_t>(std::clamp<u64>(work / min_work_per_task, 1, hardware));
+	}
+
+	// Runs task(0) to task(count - 1), and returns once all are done. task must be noexcept, and safe to call from several threads at once.
+	// The first runs on the calling thread and the rest on threads of their own, or inline if a thread cannot be started.
+	template<typename Task>
+	void run_tasks(const std::size_t count, const Task& task) noexcept {
+		diff::vector<std::thread> threads{};
+		std::size_t inline_from = count;
+		try {
+			threads.reserve(count - 1);
+			for (std::size_t i = 1; i < count; ++i) {
+				threads.emplace_back(std::cref(task), i);
+			}
+		}
+		catch (...) {
+			inline_from = threads.size() + 1;
+		}
+		task(0);
+		for (std::size_t i = inline_from; i < count; ++i) {
+			task(i);
+		}
+		for (auto& thread : threads) {
+			thread.join();
+		}
+	}
+
+}
@@ -0,0 +1,96 @@
+#include "phase_arena.h"
+#include "logger.h"
+#include <algorithm>	// std::max
+#include <cstdint>		// std::uintptr_t
+#include <cstdlib>		// std::malloc, std::free
+#include <new>			// std::bad_alloc
+
+
+namespace diff {
+
+	phase_arena::phase_arena(string_view name) noexcept : name{ name } {}
+
+	phase_arena::~phase_arena() noexcept {
+		release();
+	}
+
+	void phase_arena::release() noexcept {
+		const std::scoped_lock lock{ mutex };
+
+		const std::chrono::duration<double, std::milli> elapsed{ std::chrono::steady_clock::now() - start };
+		if (allocation_count != 0) {
+			log::info("Memory: Phase <{}> took {:.1f} ms, and allocated <{}> bytes in <{}> allocations from its arena, with at most <{}> bytes live, out of <{}> bytes of chunks."sv,
+				name, elapsed.count(), allocated_bytes, allocation_count, peak_live_bytes, chunk_bytes);
+		}
+		else {
+			log::info("Memory: Phase <{}> took {:.1f} ms, and allocated nothing from its arena."sv, name, elapsed.count());
+		}
+
+		while (chunks != nullptr) {
+			chunk_header* const prev{ chunks->prev };
+			std::free(chunks);
+			chunks = prev;
+		}
+		cursor = nullptr;
+		chunk_end = nullptr;
+		next_chunk_size = first_chunk_size;
+		allocation_count = 0;
+		allocated_bytes = 0;
+		live_bytes = 0;
+		peak_live_bytes = 0;
+		chunk_bytes = 0;
+		start = std::chrono::steady_clock::now();
+	}
+
+	bool phase_arena::add_chunk(const std::size_t min_byte_count) noexcept {
+		// Chunks double up to the largest size, so a phase that allocates a lot takes few of them. A request too big for that gets a chunk to itself.
+		const std::size_t byte_count{ std::max(next_chunk_size, sizeof(chunk_header) + min_byte_count) };
+		void* const mem{ std::malloc(byte_count) };
+		if (mem == nullptr) {
+			log::error("Memory: Phase <{}> failed to allocate a <{}> byte arena chunk."sv, name, byte_count);
+			return false;
+		}
+
+		chunk_header* const chunk{ ::new (mem) chunk_header{ chunks, byte_count } };
+		chunks = chunk;
+		cursor = reinterpret_cast<std::byte*>(chunk + 1);
+		chunk_end = reinterpret_cast<std::byte*>(chunk) + byte_count;
+		next_chunk_size = std::min(next_chunk_size * 2, std::size_t{ largest_chunk_size });
+		chunk_bytes += byte_count;
+		return true;
+	}
+
+	void* phase_arena::do_allocate(const std::size_t byte_count, const std::size_t alignment) {
+		const std::scoped_lock lock{ mutex };
+
+		// Bytes to skip to align the cursor. Before the first chunk, cursor and chunk_end are both null, so there is no room and one is added.
+		const auto padding = [this, alignment]() noexcept {
+			const std::uintptr_t addr{ reinterpret_cast<std::uintptr_t>(cursor) };
+			return static_cast<std::size_t>(((addr + (alignment - 1)) & ~(alignment - 1)) - addr);
+		};
+
+		if ((static_cast<std::size_t>(chunk_end - cursor) < padding()) or ((static_cast<std::size_t>(chunk_end - cursor) - padding()) < byte_count)) {
+			if (not add_chunk(byte_count + alignment)) {
+				throw std::bad_alloc{};
+			}
+		}
+		std::byte* const ptr{ cursor + padding() };
+		cursor = ptr + byte_count;
+
+		++allocation_count;
+		allocated_bytes += byte_count;
+		live_bytes += byte_count;
+		peak_live_bytes = std::max(peak_live_bytes, live_bytes);
+		return ptr;
+	}
+
+	void phase_arena::do_deallocate([[maybe_unused]] void* ptr, const std::size_t byte_count, [[maybe_unused]] const std::size_t alignment) {
+		const std::scoped_lock lock{ mutex };
+		live_bytes -= byte_count;
+	}
+
+	bool phase_arena::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+		return this == &other;
+	}
+
+}
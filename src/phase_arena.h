@@ -0,0 +1,60 @@
+#pragma once
+#include "int_defs.h"
+#include "string_defs.h"
+#include <chrono>
+#include <cstddef>
+#include <memory_resource>
+#include <mutex>
+
+
+namespace diff {
+
+	// Memory for the temporaries of one phase of a run, e.g. the per-shard report pieces of the diff, handed to std::pmr containers.
+	// Allocations bump through chunks, freeing them does nothing, and every chunk goes at once when the phase ends. So a phase that builds lots of short-lived
+	// strings pays no per-allocation bookkeeping, and leaves nothing fragmented behind for the phases after it.
+	// Safe to allocate from on several threads at once. Nothing allocated from it may be used after release().
+	class phase_arena final : public std::pmr::memory_resource {
+	public:
+		// name is only used to report on the phase, and must outlive the arena.
+		explicit phase_arena(string_view name) noexcept;
+		phase_arena(const phase_arena&) = delete;
+		phase_arena& operator=(const phase_arena&) = delete;
+		~phase_arena() noexcept override;
+
+		// Ends the phase: frees every chunk, and logs how long the phase took, how much it allocated, and the most it had live at once.
+		// The arena can be used again afterwards, for a new phase.
+		void release() noexcept;
+
+	private:
+		struct chunk_header {
+			chunk_header* prev;
+			std::size_t byte_count;
+		};
+
+		enum : std::size_t {
+			first_chunk_size = std::size_t{ 64 } * 1024,
+			largest_chunk_size = std::size_t{ 16 } * 1024 * 1024
+		};
+
+		std::mutex mutex{};
+		chunk_header* chunks{ nullptr };	// Newest first.
+		std::byte* cursor{ nullptr };
+		std::byte* chunk_end{ nullptr };
+		std::size_t next_chunk_size{ first_chunk_size };
+
+		u64 allocation_count{ 0 };
+		u64 allocated_bytes{ 0 };
+		u64 live_bytes{ 0 };		// What was allocated and not freed yet. Freeing gives nothing back, but this is what the phase actually needed.
+		u64 peak_live_bytes{ 0 };
+		u64 chunk_bytes{ 0 };		// What the arena took for chunks.
+		std::chrono::steady_clock::time_point start{ std::chrono::steady_clock::now() };
+		string_view name;
+
+		[[nodiscard]] bool add_chunk(std::size_t min_byte_count) noexcept;
+
+		void* do_allocate(std::size_t byte_count, std::size_t alignment) override;
+		void do_deallocate(void* ptr, std::size_t byte_count, std::size_t alignment) override;
+		[[nodiscard]] bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+	};
+
+}
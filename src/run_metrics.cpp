@@ -0,0 +1,113 @@
+#include "run_metrics.h"
+#include "logger.h"
+#include "memory.h"
+#include "winapi_funcs.h"
+#include "filesystem_interface.h"	// write_to_file
+#include <format>
+#include <string>
+#include <iterator>	// std::back_inserter
+
+
+namespace diff {
+
+	using milliseconds = std::chrono::duration<double, std::milli>;
+
+	run_metrics::run_metrics() noexcept :
+		start_time{ std::chrono::floor<std::chrono::seconds>(std::chrono::system_clock::now()).time_since_epoch() },
+		run_start{ std::chrono::steady_clock::now() },
+		run_cpu_start{ winapi::process_cpu_time() }
+	{}
+
+	run_metrics::~run_metrics() noexcept {
+		end_phase();
+		log_summary();
+		write_json();
+	}
+
+	void run_metrics::enter_phase(string_view name) noexcept {
+		end_phase();
+		memory::enter_phase(name);
+		if (phase_count < max_phases) {
+			phases[phase_count++] = phase{ .name = name };
+		}
+		phase_start = std::chrono::steady_clock::now();
+		phase_cpu_start = winapi::process_cpu_time();
+	}
+
+	void run_metrics::add_items(const u64 count) noexcept {
+		if (phase_count != 0) {
+			phases[phase_count - 1].items += count;
+		}
+	}
+
+	void run_metrics::add_bytes(const u64 count) noexcept {
+		if (phase_count != 0) {
+			phases[phase_count - 1].bytes += count;
+		}
+	}
+
+	void run_metrics::set_json_path(const std::filesystem::path& path) noexcept {
+		try {
+			json_path = path;
+		}
+		catch (...) {
+			log::warning("Metrics: Failed to set the metrics file to <{}>. None will be written."sv, path.string());
+		}
+	}
+
+	void run_metrics::end_phase() noexcept {
+		if (phase_count == 0) {
+			return;
+		}
+		phase& current{ phases[phase_count - 1] };
+		current.wall_time += std::chrono::steady_clock::now() - phase_start; // Added, rather than set, in case later phases were put down to this one.
+		current.cpu_time += winapi::process_cpu_time() - phase_cpu_start;
+		current.peak_resident_bytes = winapi::peak_working_set();
+	}
+
+	void run_metrics::log_summary() const noexcept {
+		// One line, so it can be grepped out of the log whole. Phases are name=wall/cpu/items/bytes, in whole milliseconds, and only the JSON has their peaks.
+		// The log cuts lines at 500 characters, which the dozen or so phases of a run stay under unless their counts run into the billions.
+		try {
+			std::string line{};
+			auto out{ std::back_inserter(line) };
+			std::format_to(out, "Metrics: Run took <{:.0f}> ms, and <{:.0f}> ms of CPU time, with at most <{}> bytes resident. Phases:"sv,
+				milliseconds{ std::chrono::steady_clock::now() - run_start }.count(), milliseconds{ winapi::process_cpu_time() - run_cpu_start }.count(), winapi::peak_working_set());
+			for (std::size_t i = 0; i < phase_count; ++i) {
+				const phase& ph{ phases[i] };
+				std::format_to(out, " {}={:.0f}/{:.0f}/{}/{}"sv, ph.name, milliseconds{ ph.wall_time }.count(), milliseconds{ ph.cpu_time }.count(), ph.items, ph.bytes);
+			}
+			log::info("{}"sv, line);
+		}
+		catch (...) {
+			log::warning("Metrics: Failed to make the summary."sv);
+		}
+	}
+
+	void run_metrics::write_json() const noexcept {
+		if (json_path.empty()) {
+			return;
+		}
+		// Phase names are all literals without anything that needs escaping.
+		try {
+			std::string json{};
+			auto out{ std::back_inserter(json) };
+			std::format_to(out, "{{\n\t\"start_time\": {},\n\t\"wall_ms\": {:.3f},\n\t\"cpu_ms\": {:.3f},\n\t\"peak_resident_bytes\": {},\n\t\"phases\": ["sv,
+				start_time.count(), milliseconds{ std::chrono::steady_clock::now() - run_start }.count(), milliseconds{ winapi::process_cpu_time() - run_cpu_start }.count(), winapi::peak_working_set());
+			for (std::size_t i = 0; i < phase_count; ++i) {
+				const phase& ph{ phases[i] };
+				std::format_to(out, "{}\n\t\t{{ \"name\": \"{}\", \"wall_ms\": {:.3f}, \"cpu_ms\": {:.3f}, \"items\": {}, \"bytes\": {}, \"peak_resident_bytes\": {} }}"sv,
+					(i == 0) ? ""sv : ","sv, ph.name, milliseconds{ ph.wall_time }.count(), milliseconds{ ph.cpu_time }.count(), ph.items, ph.bytes, ph.peak_resident_bytes);
+			}
+			json += "\n\t]\n}\n"sv;
+
+			if (not write_to_file(json_path, string_view{ json })) {
+				log::warning("Metrics: Failed to write the metrics to <{}>."sv, json_path.string());
+			}
+		}
+		catch (...) {
+			log::warning("Metrics: Failed to make the metrics for <{}>."sv, json_path.string());
+		}
+	}
+
+}
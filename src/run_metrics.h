@@ -0,0 +1,58 @@
+#pragma once
+#include "int_defs.h"
+#include "string_defs.h"
+#include <array>
+#include <chrono>
+#include <filesystem>
+
+
+namespace diff {
+
+	// Timings of the phases of one run, e.g. scanning or diffing: wall time, CPU time, what the phase went through, and the most memory the process had resident by its end.
+	// CPU time is the whole process's, so a phase running on several threads can take more of it than wall time.
+	// Phases follow each other, each one ending when the next starts, and the allocation profile (memory::enter_phase) follows along.
+	// When the metrics are destroyed, e.g. as the routine returns, early or not, the last phase ends and everything is logged in one line, and written as JSON if a file was set.
+	class run_metrics {
+	public:
+		run_metrics() noexcept;
+		run_metrics(const run_metrics&) = delete;
+		run_metrics& operator=(const run_metrics&) = delete;
+		~run_metrics() noexcept;
+
+		// name must outlive the metrics, e.g. be a literal. Once there are max_phases phases, the rest are put down to the last of them.
+		void enter_phase(string_view name) noexcept;
+
+		// Put down to the current phase. What an item is depends on the phase, e.g. files listed, or runs read from the journal.
+		void add_items(u64 count) noexcept;
+		void add_bytes(u64 count) noexcept;
+
+		// The JSON is written there, replacing whatever was there before. Empty, which is the default, writes none.
+		void set_json_path(const std::filesystem::path& path) noexcept;
+
+	private:
+		enum : std::size_t { max_phases = 16 };
+
+		struct phase {
+			string_view name{};
+			std::chrono::nanoseconds wall_time{ 0 };
+			std::chrono::nanoseconds cpu_time{ 0 };
+			u64 items{ 0 };
+			u64 bytes{ 0 };
+			u64 peak_resident_bytes{ 0 };
+		};
+
+		std::array<phase, max_phases> phases{};
+		std::size_t phase_count{ 0 };
+		std::chrono::seconds start_time{ 0 };	// Since the unix epoch.
+		std::chrono::steady_clock::time_point run_start{};
+		std::chrono::nanoseconds run_cpu_start{ 0 };
+		std::chrono::steady_clock::time_point phase_start{};
+		std::chrono::nanoseconds phase_cpu_start{ 0 };
+		std::filesystem::path json_path{};
+
+		void end_phase() noexcept;
+		void log_summary() const noexcept;
+		void write_json() const noexcept;
+	};
+
+}
@@ -83,6 +83,35 @@ namespace diff {
 		"<min depth>\r\n"
 		"2\r\n"
 		"\r\n"
+		"// How many past runs DirDiffer keeps, so any two of them can be compared later with the \"-history\" argument. This category is optional, and defaults to 30.\r\n"
+		"// Each run is stored as what changed since the run before it, so this costs little space unless the monitored tree changes a lot.\r\n"
+		"// If multiple values belong to this category, each subsequent value overwrites the previous, with the last being the eventual final value.\r\n"
+		"// 0 keeps no history.\r\n"
+		"<history size>\r\n"
+		"30\r\n"
+		"\r\n"
+		"// What to do with the report of a run that found no files created or deleted. This category is optional, and defaults to send.\r\n"
+		"// Such runs leave the saved file lists as they are, whichever value is picked. Those whose report is emailed are kept in the history, and the rest are left out of it.\r\n"
+		"// If multiple values belong to this category, each subsequent value overwrites the previous, with the last being the eventual final value.\r\n"
+		"// send:  Email the report anyway, saying there are no new or deleted files.\r\n"
+		"// skip:  Never email it.\r\n"
+		"// batch: Only email it if no report has gone out for a week, so quiet stretches still get an email now and then. Relies on the history to tell, so with a <history size> of 0 it acts like send.\r\n"
+		"<empty report>\r\n"
+		"send\r\n"
+		"\r\n"
+		"// The least severe messages DirDiffer writes to its log. This category is optional, and defaults to info, which logs everything.\r\n"
+		"// If multiple values belong to this category, each subsequent value overwrites the previous, with the last being the eventual final value.\r\n"
+		"// Valid values are info, warning, error and critical. Whichever is picked, a message repeated many times in a row, e.g. one per unreadable file, is logged a few times and then only counted.\r\n"
+		"<log level>\r\n"
+		"info\r\n"
+		"\r\n"
+		"// A file to write each run's timings to, as JSON, replacing the previous run's. This category is optional, and by default no such file is written. Relative paths are relative to the executable.\r\n"
+		"// For each phase of the run, e.g. the scan or the diff, it holds the wall and CPU time taken, the items (e.g. files) and bytes gone through, and the most memory used by the end of it.\r\n"
+		"// Those are also logged in one line at the end of every run, whether this is set or not.\r\n"
+		"// If multiple values belong to this category, each subsequent value overwrites the previous, with the last being the eventual final value.\r\n"
+		"<metrics file>\r\n"
+		"metrics.json\r\n"
+		"\r\n"
 		"// The email report sender that will be specified in the email headers. At least one value must belong in this category or the parse fails.\r\n"
 		"// If multiple values belong to this category, each subsequent value overwrites the previous, with the last being the eventual final value.\r\n"
 		"// Values in this category must be valid email addresses.\r\n"
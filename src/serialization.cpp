@@ -1,164 +1,100 @@
 #include "serialization.h"
+#include "snapshot_format.h"
 #include "logger.h"
 #include "int_defs.h"
 #include "string_defs.h"
-#include "rng.h"
+#include "keystream.h"
+#include "chunked_writer.h"
+#include "varint.h"
+#include "parallel.h"
+#include <algorithm>	// std::sort, std::is_sorted
 #include <random>
-#include <array>
-#include <concepts>
+#include <unordered_map>
 
 
 namespace diff {
 	
-	
-	enum : u32 { serialization_version = 1 };
-
 	enum class encryption : u32 { enabled , disabled };
 	
-	// A simple strong typedef, nameable through multicharacter literals, e.g. strong<vector<int>, 'foo'> foos;
-	template<std::integral T, int ID>
-	struct named {
-		static_assert(sizeof(int) == 4, "Multichar literals are expected to be 4 bytes.");
-		
-		explicit constexpr named() noexcept = default;
-		constexpr named(const named&) noexcept = default;
-		constexpr named(named&&) noexcept = default;
-		constexpr named& operator=(const named&) noexcept = default;
-		constexpr named& operator=(named&&) noexcept = default;
-		constexpr ~named() noexcept = default;
-		
-		template<typename U> requires(std::is_constructible_v<T, U>)
-		explicit constexpr named(U&& init) noexcept : value{ std::forward<U>(init) } {}
-		
-		template<typename U> requires(std::is_constructible_v<T, U>)
-		constexpr named& operator=(U&& rhs) noexcept {
-			value = std::forward<U>(rhs);
-			return *this;
+	
+	using native_view = std::basic_string_view<std::filesystem::path::value_type>;
+	
+	// Splits a root-relative path into its parent and filename parts, as views into path.native(). Same results as parent_path() and filename(), without allocating.
+	[[nodiscard]] std::pair<native_view, native_view> split_native(const std::filesystem::path& relative_path) noexcept {
+		static constexpr std::filesystem::path::value_type separators[]{ std::filesystem::path::preferred_separator, '/', '\0' };
+		const native_view whole{ relative_path.native() };
+		const auto separator_idx = whole.find_last_of(separators);
+		if (separator_idx == native_view::npos) {
+			return { native_view{}, whole };
 		}
-		
-
-		T value{};
-	};
+		return { whole.substr(0, separator_idx), whole.substr(separator_idx + 1) };
+	}
 	
-	struct header {
+	
+	// Deduplicating string storage. Indices are handed out in order of first appearance.
+	class string_table {
 	public:
-		using unit_type = u32;
-		enum : size_t { block_length = 40 };
-		static_assert(block_length > 3, "Serialization header num block must be at least 4 numbers long"); // To fit the seed pattern, but I don't want to type that in the string cause RE.
-		
-		explicit constexpr header() noexcept = default;
-		constexpr header(header&&) noexcept = default;
-		constexpr header& operator=(header&&) noexcept = default;
-		constexpr ~header() noexcept = default;
-		constexpr header(const header&) = default;
-		constexpr header& operator=(const header&) = default;
-		
-		explicit header(named<bool, 'ENCR'> encrypt, named<unit_type, 'SEED'> seed) noexcept
-			: version{ serialization_version }
-			, header_size{ sizeof(header) }
-			, wchar_size{ static_cast<u32>(sizeof(wchar_t)) }
-			, encryption_flag{ encrypt.value }
-		{
-			gamerand local_rng{ std::random_device{}() };
-			
-			// Randomize all block u32s.
-			for (auto& num : block) {
-				num = local_rng.next();
+		// Throws on allocation failure.
+		[[nodiscard]] u32 intern(u8string_view str) {
+			// Snapshots are sorted, so runs of the same string are the common case. Skip the map for them.
+			if (not strings.empty() and (strings[last_idx] == str)) {
+				return last_idx;
 			}
-			
-			if (!encrypt.value) {
-				return; // Done if not encrypting.
-			}
-			
-			using iterator_t = decltype(block)::iterator;
-
-			iterator_t seed_it = block.end();
-
-			// Try finding an existing pattern (x-y-z-seed with x <= y <= z) in the random block data.
-			{
-				for (size_t i = 0; i < (block.size() - 3); ++i) {
-					const u32 first = block[i];
-					const u32 second = block[i + 1];
-					const u32 third = block[i + 2];
-					if ((first <= second) bitand (second <= third)) {
-						seed_it = block.begin() + i + 3;
-						//log::info("Serialization: Header: Found seed placement pattern in random data. Seed will be at position <{}>"sv, std::distance(block.begin(), seed_it));
-						break;
-					}
-				}
-			}
-
-			if (seed_it == block.end()) { // Pattern not found. Create it somewhere randomly.
-				auto simple_swap = [] (iterator_t lhs, iterator_t rhs) -> void {
-					unit_type temp = *lhs;
-					*lhs = *rhs;
-					*rhs = temp;
-				};
-				// Starting index of the seed position pattern. If block_length == 40, idx <= 36, so idx + 3 is always a valid index.
-				iterator_t smallest = block.begin() + (local_rng.next() % (block.size() - 3));
-				iterator_t middle = smallest + 1;
-				iterator_t biggest = smallest + 2;
-				//log::info("Serialization: Header: Seed placement pattern not found in random data. Creating it manually. Seed will be at position <{}>"sv, std::distance(block.begin(), seed_it));
-				//log::info("Serialization: Header: Pattern initial values (x-y-z-seed) = {} - {} - {} - {}."sv, *smallest, *middle, *biggest, seed.value);
-				// Force order the three numbers to each be <= than the next.
-				if (middle < smallest) {
-					simple_swap(smallest, middle);
-				}
-				if (biggest < middle) {
-					simple_swap(middle, biggest);
-					if (middle < smallest) {
-						simple_swap(smallest, middle);
-					}
-				}
-				seed_it = smallest + 3;
-				//log::info("Serialization: Header: Pattern final values (x-y-z-seed) = {} - {} - {} - {}."sv, *smallest, *middle, *biggest, seed.value);
-			}
-
-			
-			// Place the seed after the ordered pattern, found or created.
-			*seed_it = seed.value;
-
-			//log::info("Serialization: Header: After seed placement, pattern final values (x-y-z-seed) = {} - {} - {} - {}."sv, *(seed_it - 3), *(seed_it - 2), *(seed_it - 1), *seed_it);
-		}
-		
-		constexpr unit_type get_version() const noexcept { return version; }
-		constexpr unit_type get_header_size() const noexcept { return header_size; }
-		constexpr unit_type get_wchar_size() const noexcept { return wchar_size; }
-		constexpr bool get_encrypted() const noexcept { return encryption_flag != 0; }
-		constexpr std::optional<unit_type> get_seed() const noexcept {
-			for (size_t i = 0; i < (block.size() - 3); ++i) {
-				const u32 first = block[i];
-				const u32 second = block[i + 1];
-				const u32 third = block[i + 2];
-				const u32 potential_seed = block[i + 3];
-				if ((first <= second) and (second <= third)) {
-					//log::info("Serialization: Header: Found seed at position <{}>"sv, i + 3);
-					return potential_seed;
-				}
+			const auto [it, inserted] = lookup.try_emplace(diff::u8string{ str }, static_cast<u32>(strings.size()));
+			if (inserted) {
+				strings.emplace_back(str);
 			}
-			return {};
+			last_idx = it->second;
+			return last_idx;
 		}
 		
+		[[nodiscard]] const diff::vector<diff::u8string>& entries() const noexcept { return strings; }
+		
 	private:
-		unit_type version{};
-		unit_type header_size{};
-		unit_type wchar_size{};
-		unit_type encryption_flag{};
-		std::array<unit_type, block_length> block{};
+		diff::vector<diff::u8string> strings{};
+		std::unordered_map<diff::u8string, u32> lookup{};
+		u32 last_idx{ 0 };
 	};
-	static_assert(sizeof(header) == (sizeof(header::unit_type) * (4 + header::block_length)));
-	static_assert(std::is_trivially_copyable_v<header>);
-
-
-	std::optional<dynamic_buffer> serialize_to_buffer(const smtp_info& smtp, const diff::vector<file>& files, encryption encr_setting) noexcept {
-		
-		static_assert(sizeof(smtp_info) == (
-			sizeof(decltype(smtp_info::url)) +
-			sizeof(decltype(smtp_info::username)) +
-			sizeof(decltype(smtp_info::password))
-		),
-			"Unexpected smtp_info stack size. Did you change the class but forgot to update serialization?" // These strings don't make it into the binary, so it's okay to say "email" .
-		);
+	
+	
+	// Interned parents and owners, plus each file's indices into them. Gathered in a pass of their own, since the tables precede the records.
+	// Only the case-preserved form is stored, separated by '/'. The lowercase keys are derived from it on load.
+	struct snapshot_tables {
+		string_table parents{};
+		string_table owners{};
+		diff::vector<u32> parent_indices{};
+		diff::vector<u32> owner_indices{};
+	};
+	
+	[[nodiscard]] static std::optional<snapshot_tables> build_tables(const diff::vector<file>& files) noexcept {
+		snapshot_tables ret{};
+		try {
+			ret.parent_indices.reserve(files.size());
+			ret.owner_indices.reserve(files.size());
+			
+			native_view last_parent{};
+			u32 last_parent_idx = 0;
+			for (const auto& file : files) {
+				const native_view parent{ split_native(file.original_path).first };
+				if (ret.parent_indices.empty() or (parent != last_parent)) {
+					last_parent_idx = ret.parents.intern(std::filesystem::path{ parent }.generic_u8string());
+					last_parent = parent;
+				}
+				ret.parent_indices.push_back(last_parent_idx);
+				ret.owner_indices.push_back(ret.owners.intern(file.owner.val));
+			}
+		}
+		catch (...) {
+			log::error("Serialization: Failed to allocate string tables for <{}> files."sv, files.size());
+			return std::nullopt;
+		}
+		return ret;
+	}
+	
+	
+	// Writes header and body, unencrypted. Writer is dynamic_buffer or chunked_file_writer, so the same bytes come out whether they are buffered or streamed.
+	template<typename Writer>
+	[[nodiscard]] static bool write_snapshot(Writer& out, const header& h, const diff::vector<file>& files, const snapshot_tables& tables) noexcept {
 		
 		static_assert(sizeof(file) == (
 			sizeof(decltype(file::original_path)) +
@@ -171,10 +107,97 @@ namespace diff {
 			"Unexpected file stack size. Did you change the class but forgot to update serialization?"
 		);
 		
-		static_assert(std::is_same_v <u32, decltype(std::random_device{}())> , "Seed size unexpected.");
-		
 		static_assert(sizeof(std::size_t) <= sizeof(u64), "std::size_t is bigger than u64!"); // std::size_t could theoretically exceed 64bit when we get 128bit architectures.
 		
+		const auto& parents = tables.parents.entries();
+		const auto& owners = tables.owners.entries();
+		
+		// Write Header
+		bool written = out.write(h);
+		
+		// Write string tables
+		written = written and out.write_varint(front_coding_restart_interval);
+		
+		written = written and out.write_varint(owners.size());
+		for (const auto& owner : owners) {
+			written = written and out.write_varint_string(owner);
+		}
+		
+		written = written and out.write_varint(parents.size());
+		for (size_t i = 0; i < parents.size(); ++i) {
+			const u8string_view previous{ i > 0 ? u8string_view{ parents[i - 1] } : u8string_view{} };
+			written = written and write_front_coded(out, previous, parents[i], (i % front_coding_restart_interval) == 0);
+		}
+		
+		if (not written) {
+			log::error("Serialization: Failed to write string tables."sv);
+			return false;
+		}
+		
+		// Write Files
+		if (not out.write_varint(files.size())) {
+			log::error("Serialization: Failed to write file count."sv);
+			return false;
+		}
+		const u64 records_start = out.position();
+		diff::vector<u64> restart_offsets{};
+		try {
+			restart_offsets.reserve((files.size() / front_coding_restart_interval) + 1);
+		}
+		catch (...) {
+			log::error("Serialization: Failed to allocate restart index."sv);
+			return false;
+		}
+		diff::u8string previous_filename{};
+		u32 previous_parent_idx = 0;
+		for (size_t i = 0; i < files.size(); ++i) {
+			const auto& file = files[i];
+			const bool restart = (i % front_coding_restart_interval) == 0;
+			if (restart) {
+				restart_offsets.push_back(out.position() - records_start); // Reserved above, so no throw.
+				previous_filename.clear();
+				previous_parent_idx = 0;
+			}
+			try {
+				diff::u8string filename{ std::filesystem::path{ split_native(file.original_path).second }.u8string() };
+				written = out.write_varint(varint::zigzag(static_cast<i64>(tables.parent_indices[i]) - static_cast<i64>(previous_parent_idx)))
+					and write_front_coded(out, previous_filename, filename, restart)
+					and out.write_varint(tables.owner_indices[i])
+					and out.write_varint(file.size_in_bytes)
+					and out.write_varint(varint::zigzag(static_cast<i64>(file.last_write.count())));
+				previous_filename = std::move(filename);
+				previous_parent_idx = tables.parent_indices[i];
+			}
+			catch (...) {
+				written = false;
+			}
+			if (not written) {
+				log::error("Serialization: Failed to write file #{}."sv, i + 1);
+				return false;
+			}
+		}
+		
+		// Write restart index, and its offset last so readers can find it from the end.
+		const u64 index_offset = out.position() - records_start;
+		written = out.write_varint(restart_offsets.size());
+		for (size_t i = 0; i < restart_offsets.size(); ++i) {
+			written = written and out.write_varint(restart_offsets[i] - (i > 0 ? restart_offsets[i - 1] : 0));
+		}
+		written = written and out.write(index_offset);
+		if (not written) {
+			log::error("Serialization: Failed to write restart index."sv);
+			return false;
+		}
+		
+		return true;
+	}
+	
+	
+	static_assert(std::is_same_v <u32, decltype(std::random_device{}())> , "Seed size unexpected.");
+	
+	
+	std::optional<dynamic_buffer> serialize_to_buffer(const diff::vector<file>& files, encryption encr_setting) noexcept {
+		
 		const bool encryption_enabled = encr_setting == encryption::enabled;
 		
 		const u32 seed = std::random_device{}(); // Always invoke random_device, regardless of whether we're actually gonna encrypt or not.
@@ -182,79 +205,207 @@ namespace diff {
 		//log::info("Serialization: Writing seed <{}>."sv, seed);
 
 		const header h{ named<bool, 'ENCR'>{ encryption_enabled }, named<u32, 'SEED'>{ seed } };
-
-		dynamic_buffer buf{};
-		
-		const u64 total_size{ [](const smtp_info& smtp, const diff::vector<file>& files) {
-			auto string_needed_bytes = [](const auto& str) noexcept -> u64 {
-				return 8u + (str.length() * sizeof(std::remove_cvref_t<decltype(str)>::value_type)); // 8 for length, then just enough for each char.
-			};
-			
-			u64 ret = sizeof(header);
-			
-			// Credentials
-			ret += string_needed_bytes(smtp.url);
-			ret += string_needed_bytes(smtp.username);
-			ret += string_needed_bytes(smtp.password);
-			
-			// Files
-			ret += 8; // 8 bytes for vector size (file count).
-			for (const auto& file : files) {
-				ret += string_needed_bytes(file.original_path.native());
-				ret += string_needed_bytes(file.parent.str_cref());
-				ret += string_needed_bytes(file.filename.str_cref());
-				ret += string_needed_bytes(file.owner.val);
-				ret += sizeof(decltype(file::size_in_bytes));
-				ret += sizeof(std::chrono::nanoseconds::rep);
-			}
-			
-			return ret;
-		}(smtp, files) };
 		
-		if (not buf.expand_for_extra(total_size)) {
-			log::error("Serialization: Failed to allocate buffer space (<{}> bytes)"sv, total_size);
+		auto tables{ build_tables(files) };
+		if (not tables.has_value()) {
 			return std::nullopt;
 		}
 		
-		// Write Header
-		(void)buf.write(h);
+		u64 estimated_size = sizeof(header);
+		for (const auto& file : files) {
+			estimated_size += split_native(file.original_path).second.length() + 16; // Filename, plus a typical size for the varints around it. The buffer grows if this falls short.
+		}
+		for (const auto* table : { &tables.value().parents, &tables.value().owners }) {
+			for (const auto& str : table->entries()) {
+				estimated_size += varint::max_u64_bytes + str.length();
+			}
+		}
 		
-		// Write SMTP info
-		(void)buf.write(smtp.url);
-		(void)buf.write(smtp.username);
-		(void)buf.write(smtp.password);
+		dynamic_buffer buf{};
 		
-		// Write Files
-		(void)buf.write(static_cast<u64>(files.size()));	// File count
-		for (const auto& file : files) {					// Files
-			(void)buf.write(file.original_path.native());
-			(void)buf.write(file.parent.str_cref());
-			(void)buf.write(file.filename.str_cref());
-			(void)buf.write(file.owner.val);
-			(void)buf.write(file.size_in_bytes);
-			(void)buf.write(static_cast<i64>(file.last_write.count()));
-			// rep for seconds is specified as signed 35+ bit (lol) int. Even though everyone implements it with i64, cast explicitly. This will probably be UB in 292 billion years.
+		if (not buf.expand_for_extra(estimated_size)) {
+			log::error("Serialization: Failed to allocate buffer space (<{}> bytes)"sv, estimated_size);
+			return std::nullopt;
+		}
+		
+		if (not write_snapshot(buf, h, files, tables.value())) {
+			return std::nullopt;
 		}
 		
 		// Encrypt if needed
 		if (encryption_enabled) {
-			gamerand rng{ seed };
-			for (auto it{ buf.begin() + sizeof(header) }, end{ buf.end() }; it != end; ++it) {
-				*it += static_cast<unsigned char>(rng.next());	// ADD a random value to every byte.
-			}
+			keystream::encrypt(buf.begin() + sizeof(header), buf.length() - sizeof(header), 0, seed);
+		}
+		
+		// Checksum what ends up on disk, so damage is found before decrypting.
+		if (not crc32c::append_footer(buf)) {
+			return std::nullopt;
 		}
 		
 		buf.rewind();
 		
-		log::info("Serialization: Serialized <{}> bytes to a buffer."sv, buf.length());
+		log::info("Serialization: Serialized <{}> files (<{}> distinct folders, <{}> distinct owners) into <{}> bytes."sv, files.size(), tables.value().parents.entries().size(), tables.value().owners.entries().size(), buf.length());
 		return buf;
 	}
 	
-	std::optional<dynamic_buffer> serialization::serialize_to_buffer_encrypted(const smtp_info& smtp, const diff::vector<file>& files) noexcept {
-		return serialize_to_buffer(smtp, files, encryption::enabled);
+	bool serialize_to_file(const std::filesystem::path& file_path, const diff::vector<file>& files, encryption encr_setting) noexcept {
+		
+		const bool encryption_enabled = encr_setting == encryption::enabled;
+		
+		const u32 seed = std::random_device{}(); // Always invoke random_device, regardless of whether we're actually gonna encrypt or not.
+		
+		//log::info("Serialization: Writing seed <{}>."sv, seed);
+
+		const header h{ named<bool, 'ENCR'>{ encryption_enabled }, named<u32, 'SEED'>{ seed } };
+		
+		auto tables{ build_tables(files) };
+		if (not tables.has_value()) {
+			return false;
+		}
+		
+		auto out{ chunked_file_writer::open(file_path, encryption_enabled ? std::optional<u32>{ seed } : std::nullopt, sizeof(header), true) };
+		if (not out.has_value()) {
+			log::error("Serialization: Failed to open <{}> for writing."sv, file_path.string());
+			return false;
+		}
+		
+		if (not write_snapshot(out.value(), h, files, tables.value())) {
+			return false;
+		}
+		
+		const u64 total_bytes = out.value().position();
+		if (not out.value().finish()) {
+			log::error("Serialization: Failed to finish writing <{}>."sv, file_path.string());
+			return false;
+		}
+		
+		log::info("Serialization: Streamed <{}> files (<{}> distinct folders, <{}> distinct owners) into <{}> ({} bytes)."sv, files.size(), tables.value().parents.entries().size(), tables.value().owners.entries().size(), file_path.string(), total_bytes);
+		return true;
+	}
+	
+	std::optional<dynamic_buffer> serialization::serialize_to_buffer_encrypted(const diff::vector<file>& files) noexcept {
+		return serialize_to_buffer(files, encryption::enabled);
+	}
+	std::optional<dynamic_buffer> serialization::serialize_to_buffer_unencrypted(const diff::vector<file>& files) noexcept {
+		return serialize_to_buffer(files, encryption::disabled);
+	}
+	
+	bool serialization::serialize_to_file_encrypted(const std::filesystem::path& file_path, const diff::vector<file>& files) noexcept {
+		return serialize_to_file(file_path, files, encryption::enabled);
+	}
+	bool serialization::serialize_to_file_unencrypted(const std::filesystem::path& file_path, const diff::vector<file>& files) noexcept {
+		return serialize_to_file(file_path, files, encryption::disabled);
+	}
+	
+	
+	// Loading splits its work across threads, but only in pieces big enough to be worth a thread of their own.
+	enum : u64 {
+		min_files_per_decode_task = u64{ 64 } * 1024,
+		min_segments_per_decrypt_task = 16
+	};
+	
+	// The lane keystream restarts every segment, so whole segments are decrypted in parallel.
+	static void decrypt_lane_body(unsigned char* const body, const std::size_t body_length, const u32 seed) noexcept {
+		const u64 segment_count = (body_length + keystream::segment_length - 1) / keystream::segment_length;
+		const std::size_t task_count = task_count_for(segment_count, min_segments_per_decrypt_task);
+		const std::size_t task_length = static_cast<std::size_t>((segment_count + task_count - 1) / task_count) * keystream::segment_length;
+		run_tasks(task_count, [=](const std::size_t task) noexcept {
+			const std::size_t begin = task * task_length;
+			if (begin < body_length) {
+				keystream::decrypt(body + begin, std::min(task_length, body_length - begin), begin, seed);
+			}
+		});
 	}
-	std::optional<dynamic_buffer> serialization::serialize_to_buffer_unencrypted(const smtp_info& smtp, const diff::vector<file>& files) noexcept {
-		return serialize_to_buffer(smtp, files, encryption::disabled);
+	
+	
+	// Snapshots from before portable paths may list their files out of order once their separators are converted (see body_decoder::records_in_order).
+	static void restore_order(diff::vector<file>& files) noexcept {
+		std::sort(files.begin(), files.end());
+		log::info("Deserialization: Sorted <{}> files again, whose order changed with their folder separators."sv, files.size());
+	}
+	
+	
+	file serialization::make_file(const std::filesystem::path& parent_path, const snapshot_entry& entry) {
+		return file{
+			parent_path / std::filesystem::path{ entry.filename },
+			lowercase_path{ lowercase_path::already_lowercase_tag{}, diff::u8string{ entry.parent_lower } },
+			lowercase_path{ lowercase_path::already_lowercase_tag{}, diff::u8string{ entry.filename_lower } },
+			file::owner_name{ diff::u8string{ entry.owner } },
+			entry.size_in_bytes,
+			entry.last_write
+		};
+	}
+	
+	// Each task decodes a group of whole restart runs into its own range of files, so the result is in the same order as a sequential decode.
+	template<typename Decoder>
+	bool serialization::decode_records_parallel(const dynamic_buffer& buf, const std::size_t body_end, const Decoder& decoder, const diff::vector<std::filesystem::path>& parent_paths, diff::vector<file>& files, const std::size_t task_count) noexcept {
+		using status_t = typename Decoder::record_status;
+		
+		diff::vector<u64> offsets{};
+		if (not decoder.read_restart_index(buf, body_end, offsets)) {
+			return false;
+		}
+		
+		struct task_result {
+			status_t status{ status_t::ok };
+			u64 failed_file{ 0 };
+		};
+		diff::vector<task_result> results{};
+		try {
+			results.resize(task_count);
+		}
+		catch (...) {
+			log::error("Deserialization: Failed to allocate decoding tasks."sv);
+			return false;
+		}
+		
+		const u64 run_count = offsets.size() - 1;
+		const u64 runs_per_task = (run_count + task_count - 1) / task_count;
+		const u64 interval = decoder.restart_spacing();
+		const std::size_t records_start = decoder.records_begin();
+		
+		run_tasks(task_count, [&](const std::size_t task) noexcept {
+			const u64 first_run = std::min(task * runs_per_task, run_count);
+			const u64 last_run = std::min(first_run + runs_per_task, run_count);
+			const u64 end_file = std::min(last_run * interval, decoder.file_count());
+			
+			const memory_reader reader{ buf.data(), records_start + static_cast<std::size_t>(offsets[first_run]), records_start + static_cast<std::size_t>(offsets[last_run]) };
+			typename Decoder::record_cursor cursor{ first_run * interval };
+			snapshot_entry entry{};
+			task_result& result = results[task];
+			
+			while (cursor.next_file < end_file) {
+				const u64 idx = cursor.next_file;
+				// Every run must start exactly where the index says, or the index and the records disagree.
+				if (((idx % interval) == 0) and (reader.position() != (records_start + offsets[idx / interval]))) {
+					result = { status_t::malformed, idx };
+					return;
+				}
+				if (const auto status = decoder.decode_record(reader, cursor, entry); status != status_t::ok) {
+					result = { status, idx };
+					return;
+				}
+				try {
+					files[static_cast<std::size_t>(idx)] = make_file(parent_paths[cursor.parent_idx], entry);
+				}
+				catch (...) {
+					result = { status_t::no_memory, idx };
+					return;
+				}
+			}
+			if (reader.position() != reader.length()) {
+				result = { status_t::malformed, end_file - 1 };
+			}
+		});
+		
+		// Logged here rather than from the tasks, reporting the earliest failure as a sequential decode would.
+		for (const auto& result : results) {
+			if (result.status != status_t::ok) {
+				Decoder::log_record_failure(result.status, result.failed_file);
+				return false;
+			}
+		}
+		return true;
 	}
 	
 	
@@ -267,18 +418,16 @@ namespace diff {
 			log::error("Deserialization: Failed to read header from buffer."sv);
 			return std::nullopt;
 		}
-		if (const auto header_size{ h.get_header_size() }; header_size != sizeof(header)) {
-			log::error("Deserialization: Unexpected header size (expected {}, read {})."sv, sizeof(header), header_size);
+		if (not validate_header(h)) {
 			return std::nullopt;
 		}
-		if (const auto wchar_size{ h.get_wchar_size() }; wchar_size != sizeof(wchar_t)) {
-			log::error("Deserialization: Unexpected wchar size (expected {}, read {})."sv, sizeof(wchar_t), wchar_size);
+		const auto deserializing_version = h.get_version();
+		
+		// Verify, on the bytes as stored
+		const auto snapshot_length{ checked_snapshot_length(h, buf.data(), buf.length()) };
+		if (not snapshot_length.has_value()) {
 			return std::nullopt;
 		}
-		if (const auto deserializing_version = h.get_version(); deserializing_version != serialization_version) {
-			// Atm there is only version 1 so nothing to do.
-			static_assert(serialization_version == 1, "New serialization version detected, but no code written to handle it.");
-		}
 		
 		// Decrypt
 		if (h.get_encrypted()) {
@@ -289,9 +438,13 @@ namespace diff {
 			}
 			else {
 				//log::info("Deserialization: Read seed value <{}>"sv, opt_seed.value());
-				gamerand rng{ opt_seed.value()};
-				for (auto it{ buf.begin() + sizeof(header) }, end{ buf.end() }; it != end; ++it) {
-					*it -= static_cast<unsigned char>(rng.next());	// SUBTRACT a random value to every byte.
+				unsigned char* const body = buf.begin() + sizeof(header);
+				const std::size_t body_length = snapshot_length.value() - sizeof(header);
+				if (deserializing_version >= first_lane_keystream_version) {
+					decrypt_lane_body(body, body_length, opt_seed.value());
+				}
+				else {
+					keystream::legacy{ opt_seed.value() }.decrypt(body, body_length);
 				}
 			}
 		}
@@ -299,12 +452,19 @@ namespace diff {
 			log::info("Deserialization: Buffer is not encrypted."sv);
 		}
 		
+		static_assert(serialization_version == 7, "New serialization version detected, but no code written to handle it.");
+		return deserializing_version == 1 ? deserialize_v1_body(buf) : deserialize_v2_body(buf, deserializing_version, snapshot_length.value());
+	}
+	
+	
+	std::optional<serialization::simple_pair> serialization::deserialize_v1_body(const dynamic_buffer& buf) noexcept {
 		simple_pair ret{};
 		
 		// Read Credentials
-		if (not buf.read(ret.smtp.url)
-			or not buf.read(ret.smtp.username)
-			or not buf.read(ret.smtp.password))
+		smtp_info& smtp = ret.legacy_smtp.emplace();
+		if (not buf.read(smtp.url)
+			or not buf.read(smtp.username)
+			or not buf.read(smtp.password))
 		{
 			log::error("Deserialization: Failed to read SMTP info!"sv);
 			return std::nullopt;
@@ -344,6 +504,7 @@ namespace diff {
 				buf.read(file_size) and
 				buf.read(last_write))
 			{
+				make_portable_separators(parent);
 				ret.files.emplace_back(
 					std::filesystem::path{ std::move(og_path) },
 					lowercase_path{ lowercase_path::already_lowercase_tag{}, std::move(parent) },
@@ -360,11 +521,89 @@ namespace diff {
 			
 		}
 		
+		if (not std::is_sorted(ret.files.begin(), ret.files.end())) {
+			restore_order(ret.files);
+		}
+		
 		log::info("Deserialization: Deserialized misc data and <{}> files."sv, ret.files.size());
 		return ret;
 	}
 	
 	
+	std::optional<serialization::simple_pair> serialization::deserialize_v2_body(const dynamic_buffer& buf, const u32 version, const std::size_t body_end) noexcept {
+		simple_pair ret{};
+		
+		body_decoder<dynamic_buffer> decoder{ version };
+		if (not decoder.read_preamble(buf, ret.legacy_smtp)) {
+			return std::nullopt;
+		}
+		
+		// Build each folder's path once, instead of once per file.
+		diff::vector<std::filesystem::path> parent_paths{};
+		try {
+			parent_paths.reserve(decoder.parent_table().size());
+			for (const auto& parent : decoder.parent_table()) {
+				parent_paths.emplace_back(parent).make_preferred(); // Native separators from here on, like the paths of scanned files.
+			}
+		}
+		catch (...) {
+			log::error("Deserialization: Failed to allocate folder paths."sv);
+			return std::nullopt;
+		}
+		
+		// Front-coded snapshots index their restart points, and every restart run decodes on its own, so big ones are decoded by several threads at once.
+		if (const std::size_t task_count = (version >= 3) ? task_count_for(decoder.file_count(), min_files_per_decode_task) : 1; task_count > 1) {
+			try {
+				ret.files.resize(static_cast<std::size_t>(decoder.file_count()));
+			}
+			catch (...) {
+				log::error("Deserialization: Failed to allocate file vector space."sv);
+				return std::nullopt;
+			}
+			if (not decode_records_parallel(buf, body_end, decoder, parent_paths, ret.files, task_count)) {
+				return std::nullopt;
+			}
+			if (not decoder.records_in_order()) {
+				restore_order(ret.files);
+			}
+			log::info("Deserialization: Deserialized misc data and <{}> files (<{}> distinct folders, <{}> distinct owners) with <{}> threads."sv, ret.files.size(), decoder.parent_table().size(), decoder.owner_table().size(), task_count);
+			return ret;
+		}
+		
+		try {
+			ret.files.reserve(decoder.file_count());
+		}
+		catch (...) {
+			log::error("Deserialization: Failed to allocate file vector space."sv);
+			return std::nullopt;
+		}
+		
+		snapshot_entry entry{};
+		for (u64 i = 0; i < decoder.file_count(); ++i) {
+			if (not decoder.read_next(buf, entry)) {
+				return std::nullopt;
+			}
+			try {
+				ret.files.push_back(make_file(parent_paths[decoder.current_parent_index()], entry));
+			}
+			catch (...) {
+				log::error("Deserialization: Failed to allocate file #{}. Aborted."sv, i + 1);
+				return std::nullopt;
+			}
+		}
+		
+		if (not decoder.read_trailer(buf)) {
+			return std::nullopt;
+		}
+		if (not decoder.records_in_order()) {
+			restore_order(ret.files);
+		}
+		
+		log::info("Deserialization: Deserialized misc data and <{}> files (<{}> distinct folders, <{}> distinct owners)."sv, ret.files.size(), decoder.parent_table().size(), decoder.owner_table().size());
+		return ret;
+	}
+	
+	
 	
 	
 }
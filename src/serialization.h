@@ -3,6 +3,7 @@
 #include "dynamic_buffer.h"
 #include "file.h"
 #include "smtp.h"
+#include <filesystem>
 #include <optional>
 
 #include <mutex>
@@ -10,12 +11,14 @@
 
 namespace diff {
 	
+	struct snapshot_entry;
+	
 	// Stateless class, used for friendship and code grouping.
 	class serialization {
 	public:
 	
 		struct simple_pair {
-			smtp_info smtp{};
+			std::optional<smtp_info> legacy_smtp{};	// Only in snapshots from before credentials got their own store, i.e. version 4 and older.
 			diff::vector<file> files{};
 		};
 
@@ -23,8 +26,25 @@ namespace diff {
 		[[nodiscard]] static std::optional<simple_pair> deserialize_from_buffer(const dynamic_buffer& buf) noexcept;
 		
 
-		[[nodiscard]] static std::optional<dynamic_buffer> serialize_to_buffer_encrypted(const smtp_info& smtp, const diff::vector<file>& files) noexcept;
-		[[nodiscard]] static std::optional<dynamic_buffer> serialize_to_buffer_unencrypted(const smtp_info& smtp, const diff::vector<file>& files) noexcept;
+		[[nodiscard]] static std::optional<dynamic_buffer> serialize_to_buffer_encrypted(const diff::vector<file>& files) noexcept;
+		[[nodiscard]] static std::optional<dynamic_buffer> serialize_to_buffer_unencrypted(const diff::vector<file>& files) noexcept;
+		
+		// Same bytes as the buffer versions, but encoded and written in chunks, so the whole snapshot never sits in memory. file_path is created or truncated.
+		[[nodiscard]] static bool serialize_to_file_encrypted(const std::filesystem::path& file_path, const diff::vector<file>& files) noexcept;
+		[[nodiscard]] static bool serialize_to_file_unencrypted(const std::filesystem::path& file_path, const diff::vector<file>& files) noexcept;
+		
+	private:
+		
+		// Body readers, called by deserialize_from_buffer after the header is validated and the buffer decrypted.
+		[[nodiscard]] static std::optional<simple_pair> deserialize_v1_body(const dynamic_buffer& buf) noexcept;
+		[[nodiscard]] static std::optional<simple_pair> deserialize_v2_body(const dynamic_buffer& buf, const u32 version, std::size_t body_end) noexcept; // Version 2 and later. The body ends at body_end, before any checksums.
+		
+		// Decodes every record of a front-coded body into files, already sized to the file count, on task_count threads. Decoder is body_decoder<dynamic_buffer>.
+		template<typename Decoder>
+		[[nodiscard]] static bool decode_records_parallel(const dynamic_buffer& buf, std::size_t body_end, const Decoder& decoder, const diff::vector<std::filesystem::path>& parent_paths, diff::vector<file>& files, std::size_t task_count) noexcept;
+		
+		// Throws on allocation failure.
+		[[nodiscard]] static file make_file(const std::filesystem::path& parent_path, const snapshot_entry& entry);
 		
 	};
 
@@ -0,0 +1,353 @@
+#include "shards.h"
+#include "serialization.h"
+#include "filesystem_interface.h"
+#include "keystream.h"
+#include "crc32c.h"
+#include "logger.h"
+#include <algorithm>	// std::sort, std::binary_search
+#include <cstring>		// std::memcpy
+#include <format>
+#include <fstream>
+#include <map>
+#include <random>
+
+
+namespace diff {
+
+	// Layout: magic, version, tag, seed, then the shard list encrypted with the lane keystream under that seed, then the CRC-32C of everything before it.
+	// Shard list: count, then each shard's key, file name, file count, length and footer checksum.
+	enum : u32 {
+		manifest_magic = 'SHRD',
+		manifest_version = 1
+	};
+	static constexpr std::size_t manifest_header_length = sizeof(u32) + sizeof(u32) + sizeof(u64) + sizeof(u32);
+
+	static constexpr std::string_view shard_extension{ ".bin" };
+
+
+	[[nodiscard]] static string_view as_chars(const u8string_view str) noexcept {
+		return string_view{ reinterpret_cast<const char*>(str.data()), str.length() };
+	}
+
+	[[nodiscard]] static u64 fresh_tag() noexcept {
+		std::random_device rd{};
+		return (static_cast<u64>(rd()) << 32) | static_cast<u64>(rd());
+	}
+
+
+	// Throws on allocation failure.
+	[[nodiscard]] static diff::u8string new_shard_name() {
+		const std::string name{ std::format("{:016x}{}"sv, fresh_tag(), shard_extension) };
+		return diff::u8string{ name.begin(), name.end() };
+	}
+
+
+	u8string_view shard_key_of(const u8string_view parent_lower) noexcept {
+		return parent_lower.substr(0, parent_lower.find(u8'/'));
+	}
+
+
+	u64 shard_manifest::total_length() const noexcept {
+		u64 ret = 0;
+		for (const auto& shard : shards) {
+			ret += shard.byte_length;
+		}
+		return ret;
+	}
+
+	shard_manifest make_empty_manifest() noexcept {
+		return shard_manifest{ fresh_tag() };
+	}
+
+
+	std::optional<shard_manifest> read_manifest(const std::filesystem::path& manifest_path) noexcept {
+		auto opt_buf{ read_dbuf_from_file(manifest_path) };
+		if (not opt_buf.has_value()) {
+			log::error("Shards: Failed to read <{}>."sv, manifest_path.string());
+			return std::nullopt;
+		}
+		dynamic_buffer& buf = opt_buf.value();
+
+		if (buf.length() < (manifest_header_length + sizeof(u32))) {
+			log::error("Shards: <{}> is too small to be a manifest."sv, manifest_path.string());
+			return std::nullopt;
+		}
+		const std::size_t body_end = buf.length() - sizeof(u32);
+		u32 stored_crc = 0;
+		std::memcpy(&stored_crc, buf.data() + body_end, sizeof(u32));
+		if (crc32c::compute(buf.data(), body_end) != stored_crc) {
+			log::error("Shards: <{}> is damaged."sv, manifest_path.string());
+			return std::nullopt;
+		}
+
+		shard_manifest ret{};
+		buf.rewind();
+		u32 magic = 0;
+		u32 version = 0;
+		u32 seed = 0;
+		if (not buf.read(magic) or not buf.read(version) or not buf.read(ret.tag) or not buf.read(seed) or (magic != manifest_magic) or (version != manifest_version)) {
+			log::error("Shards: <{}> is not a readable manifest."sv, manifest_path.string());
+			return std::nullopt;
+		}
+		keystream::decrypt(buf.begin() + buf.position(), body_end - buf.position(), 0, seed);
+
+		u64 count = 0;
+		if (not buf.read_varint(count) or (count > (body_end - buf.position()))) { // Every shard takes at least one byte.
+			log::error("Shards: <{}> has a malformed shard count."sv, manifest_path.string());
+			return std::nullopt;
+		}
+		try {
+			ret.shards.resize(static_cast<std::size_t>(count));
+		}
+		catch (...) {
+			log::error("Shards: Failed to allocate space for the <{}> shards of <{}>."sv, count, manifest_path.string());
+			return std::nullopt;
+		}
+		for (std::size_t i = 0; i < ret.shards.size(); ++i) {
+			auto& shard = ret.shards[i];
+			if (not (buf.read_varint_string(shard.key)
+				and buf.read_varint_string(shard.file_name)
+				and buf.read_varint(shard.file_count)
+				and buf.read_varint(shard.byte_length)
+				and buf.read(shard.footer_crc)))
+			{
+				log::error("Shards: Shard #{} of <{}> is malformed."sv, i + 1, manifest_path.string());
+				return std::nullopt;
+			}
+			// Names end up in paths, so anything but a bare file name would point outside the shard folder.
+			if (((i != 0) and not (ret.shards[i - 1].key < shard.key)) or shard.file_name.empty() or (shard.file_name.find_first_of(u8"\\/:"sv) != diff::u8string::npos)) {
+				log::error("Shards: Shard #{} of <{}> is out of order or badly named."sv, i + 1, manifest_path.string());
+				return std::nullopt;
+			}
+		}
+		if (buf.position() != body_end) {
+			log::error("Shards: <{}> has <{}> unexpected bytes after its last shard."sv, manifest_path.string(), body_end - buf.position());
+			return std::nullopt;
+		}
+
+		log::info("Shards: Read <{}>, listing <{}> shards."sv, manifest_path.string(), ret.shards.size());
+		return ret;
+	}
+
+	bool write_manifest(const std::filesystem::path& manifest_path, const shard_manifest& manifest) noexcept {
+		const u32 seed = std::random_device{}();
+
+		dynamic_buffer buf{};
+		bool written = buf.write(u32{ manifest_magic })
+			and buf.write(u32{ manifest_version })
+			and buf.write(manifest.tag)
+			and buf.write(seed)
+			and buf.write_varint(manifest.shards.size());
+		for (const auto& shard : manifest.shards) {
+			written = written
+				and buf.write_varint_string(shard.key)
+				and buf.write_varint_string(shard.file_name)
+				and buf.write_varint(shard.file_count)
+				and buf.write_varint(shard.byte_length)
+				and buf.write(shard.footer_crc);
+		}
+		if (not written) {
+			log::error("Shards: Failed to write manifest into buffer."sv);
+			return false;
+		}
+		keystream::encrypt(buf.begin() + manifest_header_length, buf.length() - manifest_header_length, 0, seed);
+		if (not buf.write(crc32c::compute(buf.data(), buf.length()))) {
+			log::error("Shards: Failed to write manifest checksum into buffer."sv);
+			return false;
+		}
+
+		if (not write_dbuf_to_file(manifest_path, buf)) {
+			log::error("Shards: Failed to write <{}>."sv, manifest_path.string());
+			return false;
+		}
+		log::info("Shards: Wrote <{}>, listing <{}> shards."sv, manifest_path.string(), manifest.shards.size());
+		return true;
+	}
+
+
+	// What the manifest records of a shard file, to tell it apart from any other.
+	struct shard_seal {
+		u64 byte_length{ 0 };
+		u32 footer_crc{ 0 };
+	};
+
+	[[nodiscard]] static std::optional<shard_seal> read_seal(const std::filesystem::path& shard_path) noexcept {
+		try {
+			std::ifstream ifs{ shard_path, std::ios::binary | std::ios::ate };
+			if (not ifs.is_open()) {
+				log::error("Shards: Failed to open <{}>."sv, shard_path.string());
+				return std::nullopt;
+			}
+			const std::streamoff length = ifs.tellg();
+			shard_seal ret{};
+			if ((length < static_cast<std::streamoff>(crc32c::footer_length(0)))
+				or not ifs.seekg(-static_cast<std::streamoff>(sizeof(u32)), std::ios::end)
+				or not ifs.read(reinterpret_cast<char*>(&ret.footer_crc), sizeof(u32)))
+			{
+				log::error("Shards: Failed to read the footer checksum of <{}>."sv, shard_path.string());
+				return std::nullopt;
+			}
+			ret.byte_length = static_cast<u64>(length);
+			return ret;
+		}
+		catch (std::exception& ex) {
+			log::error("Shards: Exception thrown while reading <{}>: {}"sv, shard_path.string(), ex.what());
+			return std::nullopt;
+		}
+	}
+
+	std::optional<snapshot_view> open_shard(const std::filesystem::path& shard_folder, const shard_info& shard) noexcept {
+		const std::filesystem::path shard_path{ shard_folder / shard.file_name };
+		const auto seal{ read_seal(shard_path) };
+		if (not seal.has_value()) {
+			return std::nullopt;
+		}
+		if ((seal.value().byte_length != shard.byte_length) or (seal.value().footer_crc != shard.footer_crc)) {
+			log::error("Shards: <{}> is not the shard the manifest lists for directory <{}>. It was replaced or truncated."sv, shard_path.string(), as_chars(shard.key));
+			return std::nullopt;
+		}
+
+		auto view{ snapshot_view::open(shard_path) };
+		if (not view.has_value()) {
+			log::error("Shards: Failed to open the shard of directory <{}>."sv, as_chars(shard.key));
+			return std::nullopt;
+		}
+		if (view.value().file_count() != shard.file_count) {
+			log::error("Shards: <{}> holds <{}> files, but the manifest lists <{}>."sv, shard_path.string(), view.value().file_count(), shard.file_count);
+			return std::nullopt;
+		}
+		return view;
+	}
+
+
+	std::optional<diff::vector<shard_part>> split_into_parts(const shard_manifest* const base, delta_overlay&& overlay, diff::vector<file>&& files) noexcept {
+		try {
+			std::map<diff::u8string, shard_part, std::less<>> parts{};
+			const auto part_for = [&parts](const u8string_view key) -> shard_part& {
+				auto it{ parts.find(key) };
+				if (it == parts.end()) {
+					it = parts.try_emplace(diff::u8string{ key }).first;
+					it->second.key = key;
+				}
+				return it->second;
+			};
+
+			if (base != nullptr) {
+				for (const auto& shard : base->shards) {
+					part_for(shard.key).base = &shard;
+				}
+			}
+
+			// Files are sorted, so neighbours are mostly in the same directory. Skip the lookup for them.
+			shard_part* last = nullptr;
+			for (auto& f : files) {
+				const u8string_view key{ shard_key_of(f.parent.str_cref()) };
+				if ((last == nullptr) or (last->key != key)) {
+					last = &part_for(key);
+				}
+				last->files.push_back(std::move(f));
+			}
+			diff::vector<file>{}.swap(files);
+
+			overlay.split([&part_for](const u8string_view parent_lower) -> delta_overlay& {
+				return part_for(shard_key_of(parent_lower)).overlay;
+			});
+
+			diff::vector<shard_part> ret{};
+			ret.reserve(parts.size());
+			for (auto& [key, part] : parts) {
+				ret.push_back(std::move(part));
+			}
+			log::info("Shards: Split this run into <{}> top-level directories."sv, ret.size());
+			return ret;
+		}
+		catch (...) {
+			log::error("Shards: Failed to allocate space while splitting files by top-level directory."sv);
+			return std::nullopt;
+		}
+	}
+
+
+	std::optional<shard_manifest> write_changed_shards(const std::filesystem::path& shard_folder, const diff::vector<shard_part>& parts) noexcept {
+		if (not folder_create_or_exists(shard_folder)) {
+			log::error("Shards: Failed to create shard folder <{}>."sv, shard_folder.string());
+			return std::nullopt;
+		}
+
+		shard_manifest ret{ make_empty_manifest() };
+		u64 written_count = 0;
+		try {
+			ret.shards.reserve(parts.size());
+			for (const auto& part : parts) {
+				// Same as for the journal, only which files exist counts as a change. A shard nothing was created in or deleted from since it was written still holds the right files.
+				const bool unchanged = (part.base != nullptr) and not part.changed and not part.outdated and part.overlay.added().empty() and part.overlay.removed().empty();
+				if (unchanged) {
+					ret.shards.push_back(*part.base);
+					continue;
+				}
+				if (part.files.empty()) {
+					continue; // Nothing left in this directory, so it gets no shard.
+				}
+
+				shard_info shard{ part.key, new_shard_name(), part.files.size() };
+				const std::filesystem::path shard_path{ shard_folder / shard.file_name };
+				if (not serialization::serialize_to_file_encrypted(shard_path, part.files) or not flush_file(shard_path)) {
+					log::error("Shards: Failed to write the shard of directory <{}> to <{}>."sv, as_chars(part.key), shard_path.string());
+					return std::nullopt;
+				}
+				const auto seal{ read_seal(shard_path) };
+				if (not seal.has_value()) {
+					return std::nullopt;
+				}
+				shard.byte_length = seal.value().byte_length;
+				shard.footer_crc = seal.value().footer_crc;
+				ret.shards.push_back(std::move(shard));
+				++written_count;
+			}
+		}
+		catch (...) {
+			log::error("Shards: Failed to allocate space for the new manifest."sv);
+			return std::nullopt;
+		}
+
+		log::info("Shards: Wrote <{}> changed shards, and kept <{}> unchanged ones."sv, written_count, ret.shards.size() - written_count);
+		return ret;
+	}
+
+
+	bool remove_unlisted_shards(const std::filesystem::path& shard_folder, const shard_manifest& manifest) noexcept {
+		diff::vector<std::filesystem::path> unlisted{};
+		try {
+			std::error_code ec{};
+			if (const bool exists = std::filesystem::exists(shard_folder, ec); ec or not exists) {
+				return not ec;
+			}
+
+			diff::vector<diff::u8string> listed{};
+			listed.reserve(manifest.shards.size());
+			for (const auto& shard : manifest.shards) {
+				listed.push_back(shard.file_name);
+			}
+			std::sort(listed.begin(), listed.end());
+
+			// Collected first, so nothing is deleted from under the iterator.
+			for (const auto& entry : std::filesystem::directory_iterator{ shard_folder }) {
+				if (entry.is_regular_file() and (entry.path().extension() == shard_extension) and not std::binary_search(listed.begin(), listed.end(), entry.path().filename().u8string())) {
+					unlisted.push_back(entry.path());
+				}
+			}
+		}
+		catch (std::exception& ex) {
+			log::error("Shards: Exception thrown while listing <{}>: {}"sv, shard_folder.string(), ex.what());
+			return false;
+		}
+
+		u64 removed_count = 0;
+		for (const auto& shard_path : unlisted) {
+			removed_count += delete_file(shard_path);
+		}
+		log::info("Shards: Deleted <{}> of <{}> shard files in <{}> that the manifest doesn't list."sv, removed_count, unlisted.size(), shard_folder.string());
+		return removed_count == unlisted.size();
+	}
+
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include "int_defs.h"
+#include "string_defs.h"
+#include "vector_defs.h"
+#include "file.h"
+#include "journal.h"		// delta_overlay
+#include "snapshot_view.h"
+#include <filesystem>
+#include <optional>
+
+
+namespace diff {
+
+	// The saved state is split into shards, one per top-level directory under the root, so a run only rewrites the shards whose directories changed, and shards can be read and diffed in parallel.
+	// Each shard is an ordinary snapshot file, holding the files under its directory in the usual order. Files directly in the root share a shard keyed by the empty string.
+	// A manifest lists the shards, with the length and footer checksum each was written with. Shard files are never rewritten in place: changed ones are written under new names, and the
+	// manifest pointing at them replaces the old one in a single commit, so the manifest on disk always describes a complete state.
+
+	// Top-level directory of a lowercase parent path, i.e. which shard its files belong to.
+	[[nodiscard]] u8string_view shard_key_of(u8string_view parent_lower) noexcept;
+
+	struct shard_info {
+		diff::u8string key{};		// Lowercase top-level directory.
+		diff::u8string file_name{};	// Of the shard file, in the shard folder.
+		u64 file_count{ 0 };
+		u64 byte_length{ 0 };
+		u32 footer_crc{ 0 };		// Last 4 bytes of the shard: the checksum of its chunk checksums, so it covers every byte of the file.
+	};
+
+	struct shard_manifest {
+		u64 tag{ 0 };						// Fresh for every manifest written. Ties the journal to it.
+		diff::vector<shard_info> shards{};	// Sorted by key.
+
+		[[nodiscard]] u64 total_length() const noexcept;
+	};
+
+	// An empty state, with a fresh tag.
+	[[nodiscard]] shard_manifest make_empty_manifest() noexcept;
+
+	[[nodiscard]] std::optional<shard_manifest> read_manifest(const std::filesystem::path& manifest_path) noexcept;
+	// manifest_path is created or truncated.
+	[[nodiscard]] bool write_manifest(const std::filesystem::path& manifest_path, const shard_manifest& manifest) noexcept;
+
+	// Checks that the shard file is the one the manifest recorded, then opens a view of it, which checks it for damage.
+	[[nodiscard]] std::optional<snapshot_view> open_shard(const std::filesystem::path& shard_folder, const shard_info& shard) noexcept;
+
+
+	// One top-level directory's part of a run: its shard in the old state, the journal's changes to it since, and the files in it now.
+	struct shard_part {
+		diff::u8string key{};
+		const shard_info* base{ nullptr };	// Null if the old state has no shard for this directory.
+		delta_overlay overlay{};
+		diff::vector<file> files{};			// Sorted.
+		bool changed{ false };				// Whether this run created or deleted anything here. Set by the diff.
+		bool outdated{ false };				// Whether its shard is in an older snapshot format, so it is rewritten even if nothing changed. Set by the diff.
+	};
+
+	// Splits a run by top-level directory, moving every file and journaled change into the part for its directory. Parts are sorted by key.
+	// base may be null, for a state not held in shards yet, in which case overlay must be empty.
+	[[nodiscard]] std::optional<diff::vector<shard_part>> split_into_parts(const shard_manifest* base, delta_overlay&& overlay, diff::vector<file>&& files) noexcept;
+
+	// Writes a new shard for every part that changed since its shard was written, flushed to disk, and returns the manifest of the new state. Unchanged shards are carried over as they are.
+	// Nothing already on disk is touched. Logs how many shards were written.
+	[[nodiscard]] std::optional<shard_manifest> write_changed_shards(const std::filesystem::path& shard_folder, const diff::vector<shard_part>& parts) noexcept;
+
+	// Deletes every shard file in the folder that manifest doesn't list: ones it replaced, and ones written for a state that was never committed.
+	// manifest must be the one on disk, or files it still needs go with them.
+	[[nodiscard]] bool remove_unlisted_shards(const std::filesystem::path& shard_folder, const shard_manifest& manifest) noexcept;
+
+}
@@ -0,0 +1,589 @@
+#pragma once
+#include "int_defs.h"
+#include "string_defs.h"
+#include "vector_defs.h"
+#include "dynamic_buffer.h"
+#include "snapshot_view.h"	// snapshot_entry
+#include "smtp.h"
+#include "logger.h"
+#include "string_utils.h"	// make_lowercase, make_portable_separators
+#include "rng.h"
+#include "crc32c.h"
+#include <random>
+#include <array>
+#include <algorithm>	// std::mismatch, std::is_sorted
+#include <concepts>
+#include <cstring>	// std::memcpy
+#include <optional>
+
+// Snapshot format pieces shared by the serializer and the readers. Not meant to be included outside of them.
+
+namespace diff {
+	
+	// 1: Fixed 8 byte lengths. Native wide original paths, plus separate lowercase parent and filename.
+	// 2: LEB128 lengths and numbers. Owner and parent string tables. Case-preserved UTF-8 names stored once, lowercase derived on load.
+	// 3: Front-coded parent table and filenames, delta-coded parent indices, with restart points and a trailing restart index.
+	// 4: Same body as 3. Encrypted with the segmented 8-lane keystream (see keystream.h) instead of one gamerand byte per byte.
+	// 5: No SMTP info. Credentials live in their own store (see credentials.h).
+	// 6: Same as 5, followed by CRC-32C checksums of the whole file as stored, header and encrypted body included (see crc32c.h).
+	// 7: Same as 6, but folders are separated by '/' whatever the OS that wrote them, so snapshots move between Windows and Linux. Earlier ones hold the writer's native '\\', converted on load.
+	enum : u32 { serialization_version = 7 };
+	enum : u32 {
+		first_lane_keystream_version = 4,
+		first_credential_free_version = 5,
+		first_checksummed_version = 6,
+		first_portable_path_version = 7
+	};
+	
+	// A simple strong typedef, nameable through multicharacter literals, e.g. strong<vector<int>, 'foo'> foos;
+	template<std::integral T, int ID>
+	struct named {
+		static_assert(sizeof(int) == 4, "Multichar literals are expected to be 4 bytes.");
+		
+		explicit constexpr named() noexcept = default;
+		constexpr named(const named&) noexcept = default;
+		constexpr named(named&&) noexcept = default;
+		constexpr named& operator=(const named&) noexcept = default;
+		constexpr named& operator=(named&&) noexcept = default;
+		constexpr ~named() noexcept = default;
+		
+		template<typename U> requires(std::is_constructible_v<T, U>)
+		explicit constexpr named(U&& init) noexcept : value{ std::forward<U>(init) } {}
+		
+		template<typename U> requires(std::is_constructible_v<T, U>)
+		constexpr named& operator=(U&& rhs) noexcept {
+			value = std::forward<U>(rhs);
+			return *this;
+		}
+		
+
+		T value{};
+	};
+	
+	struct header {
+	public:
+		using unit_type = u32;
+		enum : size_t { block_length = 40 };
+		static_assert(block_length > 3, "Serialization header num block must be at least 4 numbers long"); // To fit the seed pattern, but I don't want to type that in the string cause RE.
+		
+		explicit constexpr header() noexcept = default;
+		constexpr header(header&&) noexcept = default;
+		constexpr header& operator=(header&&) noexcept = default;
+		constexpr ~header() noexcept = default;
+		constexpr header(const header&) = default;
+		constexpr header& operator=(const header&) = default;
+		
+		// Other files may reuse the header with a version numbering of their own, next to something that tells them apart from snapshots.
+		explicit header(named<bool, 'ENCR'> encrypt, named<unit_type, 'SEED'> seed, named<unit_type, 'VERS'> format_version = named<unit_type, 'VERS'>{ u32{ serialization_version } }) noexcept
+			: version{ format_version.value }
+			, header_size{ sizeof(header) }
+			, wchar_size{ static_cast<u32>(sizeof(wchar_t)) }
+			, encryption_flag{ encrypt.value }
+		{
+			gamerand local_rng{ std::random_device{}() };
+			
+			// Randomize all block u32s.
+			for (auto& num : block) {
+				num = local_rng.next();
+			}
+			
+			if (!encrypt.value) {
+				return; // Done if not encrypting.
+			}
+			
+			using iterator_t = decltype(block)::iterator;
+
+			iterator_t seed_it = block.end();
+
+			// Try finding an existing pattern (x-y-z-seed with x <= y <= z) in the random block data.
+			{
+				for (size_t i = 0; i < (block.size() - 3); ++i) {
+					const u32 first = block[i];
+					const u32 second = block[i + 1];
+					const u32 third = block[i + 2];
+					if ((first <= second) bitand (second <= third)) {
+						seed_it = block.begin() + i + 3;
+						//log::info("Serialization: Header: Found seed placement pattern in random data. Seed will be at position <{}>"sv, std::distance(block.begin(), seed_it));
+						break;
+					}
+				}
+			}
+
+			if (seed_it == block.end()) { // Pattern not found. Create it somewhere randomly.
+				auto simple_swap = [] (iterator_t lhs, iterator_t rhs) -> void {
+					unit_type temp = *lhs;
+					*lhs = *rhs;
+					*rhs = temp;
+				};
+				// Starting index of the seed position pattern. If block_length == 40, idx <= 36, so idx + 3 is always a valid index.
+				iterator_t smallest = block.begin() + (local_rng.next() % (block.size() - 3));
+				iterator_t middle = smallest + 1;
+				iterator_t biggest = smallest + 2;
+				//log::info("Serialization: Header: Seed placement pattern not found in random data. Creating it manually. Seed will be at position <{}>"sv, std::distance(block.begin(), seed_it));
+				//log::info("Serialization: Header: Pattern initial values (x-y-z-seed) = {} - {} - {} - {}."sv, *smallest, *middle, *biggest, seed.value);
+				// Force order the three numbers to each be <= than the next.
+				if (middle < smallest) {
+					simple_swap(smallest, middle);
+				}
+				if (biggest < middle) {
+					simple_swap(middle, biggest);
+					if (middle < smallest) {
+						simple_swap(smallest, middle);
+					}
+				}
+				seed_it = smallest + 3;
+				//log::info("Serialization: Header: Pattern final values (x-y-z-seed) = {} - {} - {} - {}."sv, *smallest, *middle, *biggest, seed.value);
+			}
+
+			
+			// Place the seed after the ordered pattern, found or created.
+			*seed_it = seed.value;
+
+			//log::info("Serialization: Header: After seed placement, pattern final values (x-y-z-seed) = {} - {} - {} - {}."sv, *(seed_it - 3), *(seed_it - 2), *(seed_it - 1), *seed_it);
+		}
+		
+		constexpr unit_type get_version() const noexcept { return version; }
+		constexpr unit_type get_header_size() const noexcept { return header_size; }
+		constexpr unit_type get_wchar_size() const noexcept { return wchar_size; }
+		constexpr bool get_encrypted() const noexcept { return encryption_flag != 0; }
+		constexpr std::optional<unit_type> get_seed() const noexcept {
+			for (size_t i = 0; i < (block.size() - 3); ++i) {
+				const u32 first = block[i];
+				const u32 second = block[i + 1];
+				const u32 third = block[i + 2];
+				const u32 potential_seed = block[i + 3];
+				if ((first <= second) and (second <= third)) {
+					//log::info("Serialization: Header: Found seed at position <{}>"sv, i + 3);
+					return potential_seed;
+				}
+			}
+			return {};
+		}
+		
+	private:
+		unit_type version{};
+		unit_type header_size{};
+		unit_type wchar_size{};		// Of the writer. Only read for version 1, the only one that stored wide strings, so later snapshots load the same whatever wchar_t is.
+		unit_type encryption_flag{};
+		std::array<unit_type, block_length> block{};
+	};
+	static_assert(sizeof(header) == (sizeof(header::unit_type) * (4 + header::block_length)));
+	static_assert(std::is_trivially_copyable_v<header>);
+	
+	// Checks the fields every version shares. Call before touching anything past the header.
+	[[nodiscard]] inline bool validate_header(const header& h) noexcept {
+		if (const auto header_size{ h.get_header_size() }; header_size != sizeof(header)) {
+			log::error("Deserialization: Unexpected header size (expected {}, read {})."sv, sizeof(header), header_size);
+			return false;
+		}
+		const auto deserializing_version = h.get_version();
+		if ((deserializing_version == 0) or (deserializing_version > serialization_version)) {
+			log::error("Deserialization: Unsupported version <{}> (newest known is {})."sv, deserializing_version, static_cast<u32>(serialization_version));
+			return false;
+		}
+		if (const auto wchar_size{ h.get_wchar_size() }; (deserializing_version == 1) and (wchar_size != sizeof(wchar_t))) { // Only version 1 stores wide strings.
+			log::error("Deserialization: Unexpected wchar size (expected {}, read {})."sv, sizeof(wchar_t), wchar_size);
+			return false;
+		}
+		return true;
+	}
+	
+	
+	// Length of the snapshot in [data, data + length) without its checksum footer, once every checksum is verified. The whole length for versions without checksums.
+	// Call after validate_header. Checksums cover the stored bytes, so this comes before decrypting.
+	[[nodiscard]] inline std::optional<std::size_t> checked_snapshot_length(const header& h, const unsigned char* const data, const std::size_t length) noexcept {
+		if (h.get_version() < first_checksummed_version) {
+			return length;
+		}
+		const auto range{ crc32c::verify(data, length) };
+		if (not range.has_value() or (range.value().covered_length < sizeof(header))) {
+			log::error("Deserialization: Snapshot failed its integrity check. Aborted."sv);
+			return std::nullopt;
+		}
+		return static_cast<std::size_t>(range.value().covered_length);
+	}
+	
+	
+	// Front coding, for sorted string sequences. Each string is stored as the length of the prefix it shares with the previous one, followed by the rest of it.
+	// Every front_coding_restart_interval-th string is stored whole, so decoding can start at any restart point.
+	enum : u64 { front_coding_restart_interval = 16 };
+	
+	// Writer is dynamic_buffer or anything with the same write interface.
+	template<typename Writer>
+	[[nodiscard]] bool write_front_coded(Writer& buf, u8string_view previous, u8string_view current, const bool restart) noexcept {
+		const size_t shared = restart ? 0 : static_cast<size_t>(std::mismatch(previous.begin(), previous.end(), current.begin(), current.end()).first - previous.begin());
+		return buf.write_varint(shared) and buf.write_varint_string(current.substr(shared));
+	}
+	
+	// On entry, current holds the previous string. On success it holds the decoded one. On failure its contents are unspecified.
+	template<typename Reader>
+	[[nodiscard]] bool read_front_coded(const Reader& buf, diff::u8string& current, const bool restart) noexcept {
+		u64 shared = 0;
+		u64 suffix_length = 0;
+		if (not buf.read_varint(shared)
+			or not buf.read_varint(suffix_length)
+			or (shared > current.length())
+			or (restart and (shared != 0))
+			or (suffix_length > (buf.length() - buf.position())))
+		{
+			return false;
+		}
+		try {
+			current.resize(shared + suffix_length);
+		}
+		catch (...) {
+			return false;
+		}
+		return (suffix_length == 0) or buf.read(current.data() + shared, suffix_length);
+	}
+	
+	
+	// Read-only cursor over bytes owned by someone else, with the read interface of dynamic_buffer. Positions count from mem, and reads stop at end.
+	// Cheap to make one per thread over the same buffer, each with its own position.
+	class memory_reader {
+	public:
+		explicit constexpr memory_reader(const unsigned char* const mem, const std::size_t begin, const std::size_t end) noexcept : mem{ mem }, pos{ begin }, len{ end } {}
+		
+		[[nodiscard]] bool read(void* dst, const std::size_t byte_count) const noexcept {
+			if (byte_count > (len - pos)) {
+				return false;
+			}
+			std::memcpy(dst, mem + pos, byte_count);
+			pos += byte_count;
+			return true;
+		}
+		
+		template<typename T> requires (std::is_trivially_copyable_v<T> and not std::is_pointer_v<T>)
+		[[nodiscard]] bool read(T& out) const noexcept {
+			return read(std::addressof(out), sizeof(T));
+		}
+		
+		[[nodiscard]] bool read_varint(u64& out) const noexcept {
+			const std::size_t consumed = varint::decode(mem + pos, len - pos, out);
+			pos += consumed;
+			return consumed != 0;
+		}
+		
+		template<string_type S>
+		[[nodiscard]] bool read_varint_string(S& out) const noexcept {
+			const std::size_t old_pos = pos;
+			u64 length = 0;
+			if (not read_varint(length) or (length > ((len - pos) / sizeof(typename S::value_type)))) {
+				pos = old_pos;
+				return false;
+			}
+			try {
+				out.resize(length);
+			}
+			catch (...) {
+				pos = old_pos;
+				out.clear();
+				return false;
+			}
+			return read(out.data(), length * sizeof(typename S::value_type));
+		}
+		
+		[[nodiscard]] constexpr std::size_t position() const noexcept { return pos; }
+		[[nodiscard]] constexpr std::size_t length() const noexcept { return len; }
+		
+	private:
+		const unsigned char* mem;
+		mutable std::size_t pos;
+		std::size_t len;
+	};
+	
+	
+	// Decodes the body of a version 2 or later snapshot, i.e. everything after the header, one file record at a time.
+	// Reader is dynamic_buffer or anything with the same read interface, already decrypted wherever it is read from.
+	// The decoder keeps no reference to the reader, so both can be moved independently.
+	template<typename Reader>
+	class body_decoder {
+	public:
+		explicit body_decoder(const u32 version) noexcept : front_coded{ version >= 3 }, has_credentials{ version < first_credential_free_version }, native_separators{ version < first_portable_path_version } {}
+		
+		// Reads everything before the file records: credentials if the snapshot predates their own store, string tables and file count.
+		// legacy_smtp is left empty for snapshots without credentials.
+		[[nodiscard]] bool read_preamble(const Reader& buf, std::optional<smtp_info>& legacy_smtp) noexcept {
+			legacy_smtp.reset();
+			if (has_credentials) {
+				smtp_info& smtp = legacy_smtp.emplace();
+				if (not buf.read_varint_string(smtp.url)
+					or not buf.read_varint_string(smtp.username)
+					or not buf.read_varint_string(smtp.password))
+				{
+					log::error("Deserialization: Failed to read SMTP info!"sv);
+					return false;
+				}
+			}
+			
+			if (front_coded and (not buf.read_varint(restart_interval) or (restart_interval == 0))) {
+				log::error("Deserialization: Failed to read restart interval!"sv);
+				return false;
+			}
+			
+			try {
+				u64 owner_count = 0;
+				if (not read_count(buf, owner_count)) {
+					log::error("Deserialization: Failed to read owner count!"sv);
+					return false;
+				}
+				owners.resize(owner_count);
+				for (auto& owner : owners) {
+					if (not buf.read_varint_string(owner)) {
+						log::error("Deserialization: Failed to read owner table."sv);
+						return false;
+					}
+				}
+				
+				u64 parent_count = 0;
+				if (not read_count(buf, parent_count)) {
+					log::error("Deserialization: Failed to read folder count!"sv);
+					return false;
+				}
+				parents.resize(parent_count);
+				parents_lower.resize(parent_count);
+				for (u64 i = 0; i < parent_count; ++i) {
+					if (i > 0) {
+						parents[i] = parents[i - 1]; // Front coding continues from the previous entry.
+					}
+					if (not (front_coded ? read_front_coded(buf, parents[i], is_restart(i)) : buf.read_varint_string(parents[i]))) {
+						log::error("Deserialization: Failed to read folder table."sv);
+						return false;
+					}
+					parents_lower[i] = parents[i];
+					make_lowercase(parents_lower[i]);
+				}
+				if (native_separators) { // After the whole table, since front coding continues from the entries as stored.
+					for (u64 i = 0; i < parent_count; ++i) {
+						make_portable_separators(parents[i]);
+						make_portable_separators(parents_lower[i]);
+					}
+					parents_sorted = std::is_sorted(parents_lower.begin(), parents_lower.end());
+				}
+			}
+			catch (...) {
+				log::error("Deserialization: Failed to allocate string tables."sv);
+				return false;
+			}
+			
+			if (not read_count(buf, total_files)) {
+				log::error("Deserialization: Failed to read file count!"sv);
+				return false;
+			}
+			
+			records_start = buf.position();
+			
+			try {
+				if (front_coded) {
+					restart_offsets.reserve((total_files / restart_interval) + 1);
+				}
+			}
+			catch (...) {
+				log::error("Deserialization: Failed to allocate restart index space."sv);
+				return false;
+			}
+			
+			return true;
+		}
+		
+		// Decoding state carried from one record to the next. Starting one at a restart point lets it decode from there on its own.
+		struct record_cursor {
+			u64 next_file{ 0 };
+			u64 parent_idx{ 0 };
+			diff::u8string filename{};
+			diff::u8string filename_lower{};
+		};
+		
+		enum class record_status { ok, malformed, out_of_range, no_memory };
+		
+		// Decodes the record of file cursor.next_file from buf into out, and advances the cursor. The views in out point into the decoder and the cursor.
+		// Touches nothing but the cursor, so separate cursors over separate readers can decode at once. Does not log; see log_record_failure.
+		template<typename R>
+		[[nodiscard]] record_status decode_record(const R& buf, record_cursor& cursor, snapshot_entry& out) const noexcept {
+			const bool restart = is_restart(cursor.next_file);
+			if (restart) {
+				cursor.parent_idx = 0;
+			}
+			
+			u64 parent_field{};
+			u64 owner_idx{};
+			u64 file_size{};
+			u64 last_write{};
+			if (not (buf.read_varint(parent_field) and
+				(front_coded ? read_front_coded(buf, cursor.filename, restart) : buf.read_varint_string(cursor.filename)) and
+				buf.read_varint(owner_idx) and
+				buf.read_varint(file_size) and
+				buf.read_varint(last_write)))
+			{
+				return record_status::malformed;
+			}
+			
+			cursor.parent_idx = front_coded ? static_cast<u64>(static_cast<i64>(cursor.parent_idx) + varint::unzigzag(parent_field)) : parent_field;
+			if ((cursor.parent_idx >= parents.size()) or (owner_idx >= owners.size())) {
+				return record_status::out_of_range;
+			}
+			
+			try {
+				cursor.filename_lower = cursor.filename;
+			}
+			catch (...) {
+				return record_status::no_memory;
+			}
+			make_lowercase(cursor.filename_lower);
+			
+			out.parent = parents[cursor.parent_idx];
+			out.parent_lower = parents_lower[cursor.parent_idx];
+			out.filename = cursor.filename;
+			out.filename_lower = cursor.filename_lower;
+			out.owner = owners[owner_idx];
+			out.size_in_bytes = file_size;
+			out.last_write = std::chrono::seconds{ varint::unzigzag(last_write) };
+			
+			++cursor.next_file;
+			return record_status::ok;
+		}
+		
+		// file_idx is the 0-based index of the file that failed.
+		static void log_record_failure(const record_status status, const u64 file_idx) noexcept {
+			switch (status) {
+			case record_status::malformed:
+				log::error("Deserialization: Failed to deserialize file #{}. Aborted."sv, file_idx + 1);
+				break;
+			case record_status::out_of_range:
+				log::error("Deserialization: File #{} references a folder or owner out of range. Aborted."sv, file_idx + 1);
+				break;
+			case record_status::no_memory:
+				log::error("Deserialization: Failed to allocate file #{}. Aborted."sv, file_idx + 1);
+				break;
+			default:
+				break;
+			}
+		}
+		
+		// Decodes the next file record into out. The views in out point into the decoder, and stay valid until the next call.
+		[[nodiscard]] bool read_next(const Reader& buf, snapshot_entry& out) noexcept {
+			if (cursor.next_file >= total_files) {
+				return false;
+			}
+			
+			if (is_restart(cursor.next_file)) {
+				restart_offsets.push_back(buf.position() - records_start); // Reserved in read_preamble, so no throw.
+			}
+			
+			if (const record_status status = decode_record(buf, cursor, out); status != record_status::ok) {
+				log_record_failure(status, cursor.next_file);
+				return false;
+			}
+			return true;
+		}
+		
+		// Reads the restart index from the end of the body, which ends at body_end in buf, without decoding any record. Call right after read_preamble. Moves the cursor of buf.
+		// Fills offsets with the offset of every restart point from the first record, followed by the offset of the index itself, i.e. the end of the records.
+		// Records [offsets[i], offsets[i + 1]) hold files [i * restart_interval, (i + 1) * restart_interval), each run decodable on its own.
+		[[nodiscard]] bool read_restart_index(const Reader& buf, const std::size_t body_end, diff::vector<u64>& offsets) const noexcept {
+			if (not front_coded) {
+				return false;
+			}
+			const std::size_t index_offset_pos = body_end - sizeof(u64);
+			u64 index_offset = 0;
+			u64 restart_count = 0;
+			bool valid = (body_end <= buf.length())
+				and (body_end >= (records_start + sizeof(u64)))
+				and buf.reposition(index_offset_pos)
+				and buf.read(index_offset)
+				and (index_offset <= (index_offset_pos - records_start))
+				and buf.reposition(records_start + static_cast<std::size_t>(index_offset))
+				and buf.read_varint(restart_count)
+				and (restart_count == ((total_files + restart_interval - 1) / restart_interval));
+			if (valid) {
+				try {
+					offsets.resize(restart_count + 1);
+				}
+				catch (...) {
+					log::error("Deserialization: Failed to allocate restart index space."sv);
+					return false;
+				}
+				// Every run holds at least one file, and every file at least one byte, so offsets strictly increase from 0.
+				u64 offset = 0;
+				for (u64 i = 0; valid and (i < restart_count); ++i) {
+					u64 delta = 0;
+					valid = buf.read_varint(delta) and ((i == 0) ? (delta == 0) : (delta != 0)) and (delta <= (index_offset - offset));
+					offset += delta;
+					offsets[i] = offset;
+				}
+				valid = valid and ((restart_count == 0) or (offset < index_offset)) and (buf.position() == index_offset_pos);
+				offsets[restart_count] = index_offset;
+			}
+			if (not valid) {
+				log::error("Deserialization: Restart index is corrupt. Aborted."sv);
+				return false;
+			}
+			return true;
+		}
+		
+		// Cross-checks the restart index following the records against the restart points actually decoded. Call after all files are read.
+		[[nodiscard]] bool read_trailer(const Reader& buf) noexcept {
+			if (not front_coded) {
+				return true;
+			}
+			const u64 expected_index_offset = buf.position() - records_start;
+			u64 restart_count = 0;
+			bool index_matches = buf.read_varint(restart_count) and (restart_count == restart_offsets.size());
+			u64 offset = 0;
+			for (u64 i = 0; index_matches and (i < restart_count); ++i) {
+				u64 delta = 0;
+				index_matches = buf.read_varint(delta) and ((offset += delta) == restart_offsets[i]);
+			}
+			u64 index_offset = 0;
+			if (not index_matches or not buf.read(index_offset) or (index_offset != expected_index_offset)) {
+				log::error("Deserialization: Restart index does not match the file records. Aborted."sv);
+				return false;
+			}
+			return true;
+		}
+		
+		// Whether the records are in the order files sort in, as they always are once folders are separated by '/'.
+		// Older snapshots may hold folders in an order that '\\' separators made sorted but '/' ones don't, e.g. "a1" before "a\\b". Their files must be sorted again once loaded.
+		[[nodiscard]] bool records_in_order() const noexcept { return parents_sorted; }
+		
+		[[nodiscard]] u64 file_count() const noexcept { return total_files; }
+		[[nodiscard]] u64 files_read() const noexcept { return cursor.next_file; }
+		[[nodiscard]] u64 restart_spacing() const noexcept { return restart_interval; }
+		
+		// Position of the first file record in the reader, once the preamble is read.
+		[[nodiscard]] std::size_t records_begin() const noexcept { return records_start; }
+		
+		// Folder table index of the file last decoded.
+		[[nodiscard]] u64 current_parent_index() const noexcept { return cursor.parent_idx; }
+		
+		[[nodiscard]] const diff::vector<diff::u8string>& parent_table() const noexcept { return parents; }
+		[[nodiscard]] const diff::vector<diff::u8string>& owner_table() const noexcept { return owners; }
+		
+	private:
+		bool front_coded{ false };
+		bool has_credentials{ false };
+		bool native_separators{ false };
+		bool parents_sorted{ true };
+		u64 restart_interval{ 0 };
+		
+		diff::vector<diff::u8string> owners{};
+		diff::vector<diff::u8string> parents{};
+		diff::vector<diff::u8string> parents_lower{};
+		
+		u64 total_files{ 0 };
+		std::size_t records_start{ 0 };
+		diff::vector<u64> restart_offsets{};
+		
+		record_cursor cursor{};
+		
+		[[nodiscard]] bool is_restart(const u64 idx) const noexcept {
+			return front_coded and ((idx % restart_interval) == 0);
+		}
+		
+		// Every table entry and every file takes at least one byte, so any count above the remaining byte count is corrupt. Checked before reserving.
+		[[nodiscard]] static bool read_count(const Reader& buf, u64& out) noexcept {
+			return buf.read_varint(out) and (out <= (buf.length() - buf.position()));
+		}
+	};
+	
+}
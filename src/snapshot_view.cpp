@@ -0,0 +1,347 @@
+#include "snapshot_view.h"
+#include "snapshot_format.h"
+#include "winapi_funcs.h"	// file_mapping
+#include "keystream.h"
+#include "logger.h"
+#include <algorithm>	// std::min, std::max, std::sort
+#include <cstring>		// std::memcpy, std::memmove
+
+
+namespace diff {
+	
+	// Same read interface as dynamic_buffer, over a read-only file mapping, up to the end of the snapshot body.
+	// Encrypted bodies are decrypted into a small window that slides along with the cursor, so memory use stays flat whatever the file size, and the mapped pages stay clean for the OS to drop once read.
+	// The OS is also asked to read ahead of the cursor, so decoding rarely waits on a page fault.
+	class mapped_reader {
+	public:
+		// Throws if allocating the window fails.
+		explicit mapped_reader(const winapi::file_mapping& mapping, const std::size_t body_start, const std::size_t body_end, const std::optional<u32> seed, const u32 version)
+			: map{ mapping }
+			, mem{ mapping.data() }
+			, len{ body_end }
+			, pos{ body_start }
+			, body_begin{ body_start }
+			, window{ seed.has_value() ? std::make_unique_for_overwrite<unsigned char[]>(window_capacity) : nullptr }
+			, window_begin{ body_start }
+			, window_end{ body_start }
+			, prefetched_end{ body_start }
+			, key_seed{ seed.value_or(1) }
+			, lane_keystream{ version >= first_lane_keystream_version }
+			, legacy_keystream{ seed.value_or(1) }
+		{}
+		
+		[[nodiscard]] bool read(void* dst, std::size_t byte_count) const noexcept {
+			if (byte_count > (len - pos)) {
+				return false;
+			}
+			unsigned char* out = static_cast<unsigned char*>(dst);
+			while (byte_count != 0) { // Anything longer than the window goes through it in pieces.
+				const std::size_t count = std::min<std::size_t>(byte_count, window_capacity);
+				if (not available_through(pos + count)) {
+					return false;
+				}
+				std::memcpy(out, at(pos), count);
+				pos += count;
+				out += count;
+				byte_count -= count;
+			}
+			return true;
+		}
+		
+		template<typename T> requires (std::is_trivially_copyable_v<T> and not std::is_pointer_v<T>)
+		[[nodiscard]] bool read(T& out) const noexcept {
+			return read(std::addressof(out), sizeof(T));
+		}
+		
+		[[nodiscard]] bool read_varint(u64& out) const noexcept {
+			const std::size_t available = std::min<std::size_t>(len - pos, varint::max_u64_bytes);
+			if (not available_through(pos + available)) {
+				return false;
+			}
+			const std::size_t consumed = varint::decode(at(pos), available, out);
+			pos += consumed;
+			return consumed != 0;
+		}
+		
+		template<string_type S>
+		[[nodiscard]] bool read_varint_string(S& out) const noexcept {
+			const std::size_t old_pos = pos;
+			u64 length = 0;
+			if (not read_varint(length) or (length > ((len - pos) / sizeof(typename S::value_type)))) {
+				pos = old_pos;
+				return false;
+			}
+			try {
+				out.resize(length);
+			}
+			catch (...) {
+				pos = old_pos;
+				out.clear();
+				return false;
+			}
+			if ((length != 0) and not read(out.data(), length * sizeof(typename S::value_type))) {
+				pos = old_pos;
+				return false;
+			}
+			return true;
+		}
+		
+		[[nodiscard]] std::size_t position() const noexcept { return pos; }
+		[[nodiscard]] std::size_t length() const noexcept { return len; }
+		
+	private:
+		enum : std::size_t {
+			decrypt_step = keystream::segment_length,	// Decrypt (and slide) this many bytes at a time, so the per-read check is almost always a single comparison.
+			window_capacity = 2 * decrypt_step,			// Room for a full step past any read, which varints and strings never come close to.
+			readahead_length = 64 * decrypt_step		// Prefetch this far ahead of the cursor, half of it at a time.
+		};
+		
+		const winapi::file_mapping& map;
+		const unsigned char* mem{ nullptr };
+		std::size_t len{ 0 };
+		mutable std::size_t pos{ 0 };
+		std::size_t body_begin{ 0 };
+		std::unique_ptr<unsigned char[]> window;	// Only for encrypted bodies. Plain ones are read straight from the mapping.
+		mutable std::size_t window_begin{ 0 };		// File offsets the window holds, decrypted.
+		mutable std::size_t window_end{ 0 };
+		mutable std::size_t prefetched_end{ 0 };
+		u32 key_seed{ 1 };
+		bool lane_keystream{ true };
+		mutable keystream::legacy legacy_keystream;
+		
+		[[nodiscard]] const unsigned char* at(const std::size_t offset) const noexcept {
+			return (window != nullptr) ? (window.get() + (offset - window_begin)) : (mem + offset);
+		}
+		
+		// Makes [pos, end_pos) readable through at(). end_pos - pos must not exceed window_capacity.
+		// Reads only move forward, so this only ever drops what is behind the cursor and decrypts further along. The legacy keystream relies on that, being sequential.
+		bool available_through(const std::size_t end_pos) const noexcept {
+			if ((end_pos + (readahead_length / 2)) > prefetched_end) {
+				const std::size_t count = std::min<std::size_t>(readahead_length, len - prefetched_end);
+				map.prefetch(prefetched_end, count);
+				prefetched_end += count;
+			}
+			if ((window == nullptr) or (end_pos <= window_end)) {
+				return true;
+			}
+			
+			const std::size_t kept = window_end - pos;
+			std::memmove(window.get(), window.get() + (pos - window_begin), kept);
+			window_begin = pos;
+			
+			const std::size_t target = std::min({ len, std::max(end_pos, window_end + decrypt_step), window_begin + window_capacity });
+			unsigned char* const fill = window.get() + kept;
+			std::memcpy(fill, mem + window_end, target - window_end);
+			if (lane_keystream) {
+				keystream::decrypt(fill, target - window_end, window_end - body_begin, key_seed);
+			}
+			else {
+				legacy_keystream.decrypt(fill, target - window_end);
+			}
+			window_end = target;
+			return true;
+		}
+	};
+	
+	
+	class snapshot_view::view_impl {
+	public:
+		// Throws if allocating the reader's window fails.
+		explicit view_impl(winapi::file_mapping&& mapping_init, const std::size_t body_start, const std::size_t body_end, const std::optional<u32> seed, const u32 version)
+			: mapping{ std::move(mapping_init) }
+			, reader{ mapping, body_start, body_end, seed, version }
+			, decoder{ version }
+			, version{ version }
+		{}
+		
+		winapi::file_mapping mapping;
+		mapped_reader reader;
+		body_decoder<mapped_reader> decoder;
+		u32 version;
+		std::optional<smtp_info> legacy_smtp{};
+		snapshot_entry current{};
+		bool failed{ false };
+		
+		// Only for snapshots whose records are out of order (see body_decoder::records_in_order): every file, decoded up front and sorted.
+		// Folders and owners point into the decoder's tables, and filenames into sorted_names, which is reserved whole so it never moves them.
+		diff::vector<snapshot_entry> sorted_entries{};
+		diff::vector<diff::u8string> sorted_names{};
+		std::size_t sorted_next{ 0 };
+		
+		// Call right after reading the preamble. Logs what fails.
+		[[nodiscard]] bool load_sorted() noexcept {
+			const std::size_t count = static_cast<std::size_t>(decoder.file_count());
+			try {
+				sorted_entries.reserve(count);
+				sorted_names.reserve(2 * count);
+				snapshot_entry entry{};
+				while (decoder.read_next(reader, entry)) {
+					entry.filename = sorted_names.emplace_back(entry.filename);
+					entry.filename_lower = sorted_names.emplace_back(entry.filename_lower);
+					sorted_entries.push_back(entry);
+				}
+			}
+			catch (...) {
+				log::error("Snapshot View: Failed to allocate <{}> files to sort."sv, count);
+				return false;
+			}
+			if ((decoder.files_read() != decoder.file_count()) or not decoder.read_trailer(reader)) {
+				return false;
+			}
+			std::sort(sorted_entries.begin(), sorted_entries.end(), [](const snapshot_entry& lhs, const snapshot_entry& rhs) { return lhs < rhs; });
+			return true;
+		}
+	};
+	
+	
+	snapshot_view::snapshot_view(std::unique_ptr<view_impl>&& init) noexcept : impl{ std::move(init) } {}
+	snapshot_view::snapshot_view(snapshot_view&&) noexcept = default;
+	snapshot_view& snapshot_view::operator=(snapshot_view&&) noexcept = default;
+	snapshot_view::~snapshot_view() noexcept = default;
+	
+	
+	std::optional<snapshot_view> snapshot_view::open(const std::filesystem::path& file_path) noexcept {
+		auto mapping{ winapi::file_mapping::open_read_only(file_path) };
+		if (not mapping.has_value()) {
+			log::error("Snapshot View: Failed to map <{}>."sv, file_path.string());
+			return std::nullopt;
+		}
+		
+		header h{};
+		if (mapping.value().size() < sizeof(header)) {
+			log::error("Snapshot View: <{}> is too small to hold a header."sv, file_path.string());
+			return std::nullopt;
+		}
+		std::memcpy(&h, mapping.value().data(), sizeof(header));
+		if (not validate_header(h)) {
+			return std::nullopt;
+		}
+		if (h.get_version() < 2) {
+			log::info("Snapshot View: <{}> is a version <{}> snapshot, which can't be viewed in place."sv, file_path.string(), h.get_version());
+			return std::nullopt;
+		}
+		
+		const auto body_end{ checked_snapshot_length(h, mapping.value().data(), mapping.value().size()) };
+		if (not body_end.has_value()) {
+			log::error("Snapshot View: <{}> is damaged."sv, file_path.string());
+			return std::nullopt;
+		}
+		
+		std::optional<u32> seed{};
+		if (h.get_encrypted()) {
+			seed = h.get_seed();
+			if (not seed.has_value()) {
+				log::error("Snapshot View: Failed to find the decryption seed of <{}>."sv, file_path.string());
+				return std::nullopt;
+			}
+		}
+		
+		std::unique_ptr<view_impl> impl{};
+		try {
+			impl = std::make_unique<view_impl>(std::move(mapping.value()), sizeof(header), body_end.value(), seed, h.get_version());
+		}
+		catch (...) {
+			log::error("Snapshot View: Failed to allocate view state."sv);
+			return std::nullopt;
+		}
+		
+		if (not impl->decoder.read_preamble(impl->reader, impl->legacy_smtp)) {
+			log::error("Snapshot View: Failed to read <{}> preamble."sv, file_path.string());
+			return std::nullopt;
+		}
+		if (not impl->decoder.records_in_order()) {
+			if (not impl->load_sorted()) {
+				log::error("Snapshot View: Failed to load the files of <{}> to sort them."sv, file_path.string());
+				return std::nullopt;
+			}
+			log::info("Snapshot View: <{}> predates portable paths, and its folders sort differently since, so its <{}> files were loaded and sorted up front."sv, file_path.string(), impl->sorted_entries.size());
+		}
+		
+		log::info("Snapshot View: Mapped <{}> ({} bytes, version {}), holding <{}> files."sv, file_path.string(), impl->mapping.size(), h.get_version(), impl->decoder.file_count());
+		return snapshot_view{ std::move(impl) };
+	}
+	
+	std::optional<snapshot_view::check_result> snapshot_view::verify(const std::filesystem::path& file_path) noexcept {
+		check_result ret{};
+		{
+			auto mapping{ winapi::file_mapping::open_read_only(file_path) };
+			if (not mapping.has_value()) {
+				log::error("Snapshot View: Failed to map <{}>."sv, file_path.string());
+				return std::nullopt;
+			}
+			
+			header h{};
+			if (mapping.value().size() < sizeof(header)) {
+				log::error("Snapshot View: <{}> is too small to hold a header."sv, file_path.string());
+				return std::nullopt;
+			}
+			std::memcpy(&h, mapping.value().data(), sizeof(header));
+			if (not validate_header(h)) {
+				return std::nullopt;
+			}
+			ret.version = h.get_version();
+			ret.byte_count = mapping.value().size();
+			
+			if (ret.version >= first_checksummed_version) {
+				const auto range{ crc32c::verify(mapping.value().data(), mapping.value().size()) };
+				if (not range.has_value()) {
+					log::error("Snapshot View: <{}> is damaged."sv, file_path.string());
+					return std::nullopt;
+				}
+				ret.chunk_count = range.value().chunk_count;
+				log::info("Snapshot View: All <{}> chunks of <{}> match their checksums."sv, ret.chunk_count, file_path.string());
+				return ret;
+			}
+			if (ret.version < 2) {
+				log::error("Snapshot View: <{}> is a version <{}> snapshot, which can't be checked in place."sv, file_path.string(), ret.version);
+				return std::nullopt;
+			}
+		} // Unmapped before the view maps it again.
+		
+		// No checksums. Decoding every record at least catches damage that breaks the structure.
+		auto view{ open(file_path) };
+		if (not view.has_value()) {
+			return std::nullopt;
+		}
+		while (view.value().next()) {}
+		if (view.value().failed()) {
+			log::error("Snapshot View: <{}> is damaged."sv, file_path.string());
+			return std::nullopt;
+		}
+		log::info("Snapshot View: All <{}> files of <{}> decoded, but it predates checksums, so damage within a record goes unnoticed."sv, view.value().file_count(), file_path.string());
+		return ret;
+	}
+	
+	const std::optional<smtp_info>& snapshot_view::legacy_smtp() const noexcept { return impl->legacy_smtp; }
+	
+	bool snapshot_view::is_current_version() const noexcept { return impl->version == serialization_version; }
+	
+	u64 snapshot_view::file_count() const noexcept { return impl->decoder.file_count(); }
+	
+	bool snapshot_view::next() noexcept {
+		if (not impl->decoder.records_in_order()) {
+			if (impl->sorted_next >= impl->sorted_entries.size()) {
+				return false;
+			}
+			impl->current = impl->sorted_entries[impl->sorted_next++];
+			return true;
+		}
+		if (impl->failed or (impl->decoder.files_read() >= impl->decoder.file_count())) {
+			return false;
+		}
+		if (not impl->decoder.read_next(impl->reader, impl->current)) {
+			impl->failed = true;
+			return false;
+		}
+		if ((impl->decoder.files_read() == impl->decoder.file_count()) and not impl->decoder.read_trailer(impl->reader)) {
+			impl->failed = true; // The last file decoded fine but the index after it doesn't match, so none of it can be trusted.
+			return false;
+		}
+		return true;
+	}
+	
+	const snapshot_entry& snapshot_view::current() const noexcept { return impl->current; }
+	
+	bool snapshot_view::failed() const noexcept { return impl->failed; }
+	
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include "int_defs.h"
+#include "string_defs.h"
+#include "file.h"
+#include "smtp.h"
+#include <chrono>
+#include <compare>
+#include <filesystem>
+#include <memory>
+#include <optional>
+
+namespace diff {
+
+	// One file record of a snapshot, decoded in place. The views point into storage owned by whatever produced the entry.
+	struct snapshot_entry {
+		u8string_view parent{};			// Relative to root, case-preserved.
+		u8string_view parent_lower{};
+		u8string_view filename{};		// Case-preserved.
+		u8string_view filename_lower{};
+		u8string_view owner{};
+		u64 size_in_bytes{ 0 };
+		std::chrono::seconds last_write{ 0 };
+
+		// Same ordering as file.
+		[[nodiscard]] std::strong_ordering operator<=>(const file& rhs) const noexcept {
+			const auto parent_cmp = parent_lower <=> u8string_view{ rhs.parent.str_cref() };
+			return parent_cmp != 0 ? parent_cmp : filename_lower <=> u8string_view{ rhs.filename.str_cref() };
+		}
+		[[nodiscard]] std::strong_ordering operator<=>(const snapshot_entry& rhs) const noexcept {
+			const auto parent_cmp = parent_lower <=> rhs.parent_lower;
+			return parent_cmp != 0 ? parent_cmp : filename_lower <=> rhs.filename_lower;
+		}
+	};
+
+
+	// Read-only view of a saved snapshot, backed by a read-only mapping of the file instead of a buffer read into memory.
+	// Nothing is decoded up front except string tables (and credentials, in old snapshots). Files are decoded one at a time by next(), and decrypted just ahead of it into a small sliding window, so no file list is ever built and memory use doesn't grow with the file.
+	// The exception is snapshots from before folders were separated by '/' whose files sort differently since. Those are decoded and sorted whole when opened, until they are rewritten.
+	// Only version 2 and later snapshots can be viewed. Version 1 ones must go through serialization::deserialize_from_buffer.
+	class snapshot_view {
+	public:
+		snapshot_view() = delete;
+		snapshot_view(snapshot_view&&) noexcept;
+		snapshot_view& operator=(snapshot_view&&) noexcept;
+		~snapshot_view() noexcept;
+		snapshot_view(const snapshot_view&) = delete;
+		snapshot_view& operator=(const snapshot_view&) = delete;
+
+		// Damaged snapshots fail to open if they carry checksums (version 6 and later).
+		[[nodiscard]] static std::optional<snapshot_view> open(const std::filesystem::path& file_path) noexcept;
+
+		struct check_result {
+			u32 version{ 0 };
+			u64 byte_count{ 0 };
+			u64 chunk_count{ 0 };	// Checksummed chunks. 0 for versions without checksums.
+		};
+
+		// Checks a snapshot for damage without building or even decoding its file list. Logs what is wrong.
+		// Versions with checksums are checked against them alone, on several threads, without decrypting anything.
+		// Older ones are decoded record by record instead, which only catches damage that breaks the structure. Version 1 ones can't be checked.
+		[[nodiscard]] static std::optional<check_result> verify(const std::filesystem::path& file_path) noexcept;
+
+		// Credentials stored in snapshots from before they got their own store. Empty for newer snapshots.
+		[[nodiscard]] const std::optional<smtp_info>& legacy_smtp() const noexcept;
+
+		// Whether the snapshot was written in the format this build writes, i.e. rewriting it wouldn't change its layout.
+		[[nodiscard]] bool is_current_version() const noexcept;
+		
+		[[nodiscard]] u64 file_count() const noexcept;
+
+		// Decodes the next file into current(). Returns false past the last file, or on corrupt data, in which case failed() is also true.
+		// The views in current() are only valid until the next call.
+		[[nodiscard]] bool next() noexcept;
+
+		[[nodiscard]] const snapshot_entry& current() const noexcept;
+
+		[[nodiscard]] bool failed() const noexcept;
+
+	private:
+		class view_impl;
+		std::unique_ptr<view_impl> impl;
+
+		explicit snapshot_view(std::unique_ptr<view_impl>&& init) noexcept;
+	};
+
+}
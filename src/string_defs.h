@@ -1,6 +1,7 @@
 #pragma once
 #include <string>
 #include <string_view>
+#include <memory_resource>
 //#include "memory.h"
 
 namespace diff {
@@ -22,4 +23,12 @@ namespace diff {
 	
 	using namespace std::literals;
 	
+}
+
+namespace diff::pmr {
+	
+	// For temporaries that allocate from a phase_arena.
+	using string = std::pmr::string;
+	using u8string = std::pmr::u8string;
+	
 }
\ No newline at end of file
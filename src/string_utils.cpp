@@ -17,6 +17,14 @@ namespace diff {
 		}
 	}
 
+	void make_portable_separators(diff::u8string& str) noexcept {
+		for (auto& c : str) {
+			if (c == u8'\\') {
+				c = u8'/';
+			}
+		}
+	}
+
 	bool u8_iequal(u8string_view s1, u8string_view s2) noexcept {
 		if (s1.length() != s2.length()) {
 			return false;
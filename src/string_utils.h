@@ -13,6 +13,9 @@ namespace diff {
 	
 	bool u8_iequal(u8string_view s1, u8string_view s2) noexcept;
 	// bool iequal(string_view s1, string_view s2) noexcept;
+	
+	// Replaces '\\' folder separators with '/', the one paths are stored and compared with whatever the OS.
+	void make_portable_separators(diff::u8string& str) noexcept;
 
 	template<typename T>
 	constexpr diff::vector<T> split(const T& str, const typename T::value_type delim) {
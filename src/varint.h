@@ -0,0 +1,60 @@
+#pragma once
+#include "int_defs.h"
+#include <cstddef>	// std::size_t
+
+namespace diff {
+
+	// Unsigned LEB128. 7 payload bits per byte, high bit set on every byte except the last.
+	namespace varint {
+
+		enum : std::size_t { max_u64_bytes = 10 }; // ceil(64 / 7)
+
+		// Returns how many bytes encoding val takes.
+		[[nodiscard]] constexpr std::size_t encoded_size(u64 val) noexcept {
+			std::size_t ret = 1;
+			while (val >= 0x80) {
+				val >>= 7;
+				++ret;
+			}
+			return ret;
+		}
+
+		// Writes val to dst, which must have room for at least encoded_size(val) bytes.
+		// Returns the count of bytes written.
+		constexpr std::size_t encode(u64 val, unsigned char* dst) noexcept {
+			std::size_t written = 0;
+			while (val >= 0x80) {
+				dst[written++] = static_cast<unsigned char>(val | 0x80);
+				val >>= 7;
+			}
+			dst[written++] = static_cast<unsigned char>(val);
+			return written;
+		}
+
+		// Reads a value from [src, src + available) into out.
+		// Returns the count of bytes consumed, or 0 if the input is truncated or longer than max_u64_bytes. out is untouched on failure.
+		[[nodiscard]] constexpr std::size_t decode(const unsigned char* src, const std::size_t available, u64& out) noexcept {
+			u64 val = 0;
+			const std::size_t limit = available < max_u64_bytes ? available : max_u64_bytes;
+			for (std::size_t i = 0; i < limit; ++i) {
+				const u64 byte = src[i];
+				val |= (byte & 0x7F) << (7 * i);
+				if ((byte & 0x80) == 0) {
+					out = val;
+					return i + 1;
+				}
+			}
+			return 0;
+		}
+
+		// Maps signed values to unsigned so small magnitudes of either sign encode in few bytes: 0, -1, 1, -2, 2... -> 0, 1, 2, 3, 4...
+		[[nodiscard]] constexpr u64 zigzag(const i64 val) noexcept {
+			return (static_cast<u64>(val) << 1) ^ static_cast<u64>(val >> 63);
+		}
+		[[nodiscard]] constexpr i64 unzigzag(const u64 val) noexcept {
+			return static_cast<i64>(val >> 1) ^ -static_cast<i64>(val & 1);
+		}
+
+	}
+
+}
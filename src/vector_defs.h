@@ -1,5 +1,6 @@
 #pragma once
 #include <vector>
+#include <memory_resource>
 //#include "memory.h"
 
 
@@ -12,3 +13,11 @@ namespace diff {
 	using vector = std::vector<T>;
 	
 }
+
+namespace diff::pmr {
+	
+	// For temporaries that allocate from a phase_arena.
+	template<typename T>
+	using vector = std::pmr::vector<T>;
+	
+}
@@ -3,6 +3,13 @@
 #include "aclapi.h" // GetNamedSecurityInfoW, LookupSecurityDescriptorPartsW
 #include "stringapiset.h" // WideCharToMultiByte
 #include "errhandlingapi.h" // GetLastError
+#include "fileapi.h" // CreateFileW, GetFileSizeEx, FlushFileBuffers
+#include "winbase.h" // MoveFileExW
+#include "memoryapi.h" // CreateFileMappingW, MapViewOfFile, UnmapViewOfFile, PrefetchVirtualMemory, VirtualAlloc, VirtualFree
+#include "handleapi.h" // CloseHandle
+#include "processthreadsapi.h" // GetCurrentProcess, GetProcessTimes
+#include "psapi.h" // K32GetProcessMemoryInfo
+#include <algorithm> // std::min, called as (std::min) since the windows headers define a min macro
 
 namespace diff::winapi {
 	
@@ -146,4 +153,162 @@ namespace diff::winapi {
 		return wstring_to_utf8(wide);
 	}
 	
+	
+	file_mapping::file_mapping(file_mapping&& rhs) noexcept
+		: file_handle{ rhs.file_handle }
+		, mapping_handle{ rhs.mapping_handle }
+		, view{ rhs.view }
+		, length{ rhs.length }
+	{
+		rhs.file_handle = nullptr;
+		rhs.mapping_handle = nullptr;
+		rhs.view = nullptr;
+		rhs.length = 0;
+	}
+	
+	file_mapping& file_mapping::operator=(file_mapping&& rhs) noexcept {
+		if (&rhs != this) {
+			release();
+			file_handle = rhs.file_handle;
+			mapping_handle = rhs.mapping_handle;
+			view = rhs.view;
+			length = rhs.length;
+			rhs.file_handle = nullptr;
+			rhs.mapping_handle = nullptr;
+			rhs.view = nullptr;
+			rhs.length = 0;
+		}
+		return *this;
+	}
+	
+	file_mapping::~file_mapping() noexcept { release(); }
+	
+	void file_mapping::release() noexcept {
+		if (view != nullptr) {
+			UnmapViewOfFile(view);
+			view = nullptr;
+		}
+		if (mapping_handle != nullptr) {
+			CloseHandle(mapping_handle);
+			mapping_handle = nullptr;
+		}
+		if (file_handle != nullptr) {
+			CloseHandle(file_handle);
+			file_handle = nullptr;
+		}
+		length = 0;
+	}
+	
+	bool flush_to_disk(const std::filesystem::path& file_path) noexcept {
+		auto log_last_error = [&file_path](string_view what) {
+			const auto u8err{ wstring_to_utf8(error_string(GetLastError())) };
+			log::error("WinAPI Flush: Failed to {} <{}>, with error: {}"sv, what, file_path.string(), u8err.has_value() ? reinterpret_cast<const char*>(u8err.value().c_str()) : "unknown");
+		};
+		
+		// Any handle with write access flushes everything cached for the file, not just what went through that handle.
+		HANDLE file = CreateFileW(file_path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			log_last_error("open"sv);
+			return false;
+		}
+		const bool flushed = FlushFileBuffers(file);
+		if (not flushed) {
+			log_last_error("flush"sv);
+		}
+		CloseHandle(file);
+		return flushed;
+	}
+	
+	bool replace_file(const std::filesystem::path& from, const std::filesystem::path& to) noexcept {
+		if (not MoveFileExW(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+			const auto u8err{ wstring_to_utf8(error_string(GetLastError())) };
+			log::error("WinAPI Replace: Failed to move <{}> over <{}>, with error: {}"sv, from.string(), to.string(), u8err.has_value() ? reinterpret_cast<const char*>(u8err.value().c_str()) : "unknown");
+			return false;
+		}
+		return true;
+	}
+	
+	
+	std::chrono::nanoseconds process_cpu_time() noexcept {
+		FILETIME creation{}, exit{}, kernel{}, user{};
+		if (not GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+			return std::chrono::nanoseconds{ 0 };
+		}
+		const auto to_u64 = [](const FILETIME& ft) noexcept { return (static_cast<u64>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime; };
+		return std::chrono::nanoseconds{ (to_u64(kernel) + to_u64(user)) * 100 }; // FILETIME counts 100ns ticks.
+	}
+	
+	u64 peak_working_set() noexcept {
+		PROCESS_MEMORY_COUNTERS counters{};
+		counters.cb = sizeof(counters);
+		if (not K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) { // The K32 one is in kernel32, so psapi.lib needn't be linked.
+			return 0;
+		}
+		return counters.PeakWorkingSetSize;
+	}
+	
+	
+	void* reserve_address_space(const std::size_t byte_count) noexcept {
+		return VirtualAlloc(nullptr, byte_count, MEM_RESERVE, PAGE_NOACCESS);
+	}
+	
+	bool commit_address_space(void* base, const std::size_t byte_count) noexcept {
+		return VirtualAlloc(base, byte_count, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+	}
+	
+	void release_address_space(void* base) noexcept {
+		(void)VirtualFree(base, 0, MEM_RELEASE);
+	}
+	
+	
+	std::optional<file_mapping> file_mapping::open_read_only(const std::filesystem::path& file_path) noexcept {
+		auto log_last_error = [&file_path](string_view what) {
+			const auto u8err{ wstring_to_utf8(error_string(GetLastError())) };
+			log::error("WinAPI File Mapping: Failed to {} <{}>, with error: {}"sv, what, file_path.string(), u8err.has_value() ? reinterpret_cast<const char*>(u8err.value().c_str()) : "unknown");
+		};
+		
+		file_mapping ret{};
+		
+		// FILE_SHARE_DELETE so the file can still be renamed while mapped. Sequential scan hint because the view is read front to back.
+		HANDLE file = CreateFileW(file_path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			log_last_error("open"sv);
+			return std::nullopt;
+		}
+		ret.file_handle = file;
+		
+		LARGE_INTEGER file_size{};
+		if (not GetFileSizeEx(file, &file_size)) {
+			log_last_error("get size of"sv);
+			return std::nullopt;
+		}
+		if ((file_size.QuadPart <= 0) or (static_cast<unsigned long long>(file_size.QuadPart) > static_cast<unsigned long long>(SIZE_MAX))) {
+			log::error("WinAPI File Mapping: Can't map <{}> with size <{}>."sv, file_path.string(), file_size.QuadPart);
+			return std::nullopt;
+		}
+		
+		ret.mapping_handle = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (ret.mapping_handle == nullptr) {
+			log_last_error("create mapping for"sv);
+			return std::nullopt;
+		}
+		
+		ret.view = static_cast<unsigned char*>(MapViewOfFile(ret.mapping_handle, FILE_MAP_READ, 0, 0, 0));
+		if (ret.view == nullptr) {
+			log_last_error("map view of"sv);
+			return std::nullopt;
+		}
+		ret.length = static_cast<std::size_t>(file_size.QuadPart);
+		
+		return ret;
+	}
+	
+	void file_mapping::prefetch(const std::size_t offset, const std::size_t byte_count) const noexcept {
+		if ((offset >= length) or (byte_count == 0)) {
+			return;
+		}
+		WIN32_MEMORY_RANGE_ENTRY range{ view + offset, (std::min)(byte_count, length - offset) };
+		(void)PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+	}
+	
 }
\ No newline at end of file
@@ -1,11 +1,69 @@
 #pragma once
+#include "int_defs.h"
 #include "string_defs.h"
 #include <optional>
 #include <filesystem>
+#include <chrono>
+#include <cstddef>
 
 
 namespace diff::winapi {
 
 	std::optional<diff::u8string> get_owner(const std::filesystem::path& full_path);
+	
+	// Writes out whatever of the file the OS still holds in its cache, and waits until it is on disk.
+	[[nodiscard]] bool flush_to_disk(const std::filesystem::path& file_path) noexcept;
+	
+	// Moves from to to, replacing any file already there in one step, so to is always either the old file or the new one. Returns once the move itself is on disk.
+	[[nodiscard]] bool replace_file(const std::filesystem::path& from, const std::filesystem::path& to) noexcept;
+	
+	
+	// CPU time the process has used so far, on all of its threads, user and kernel time together. 0 on failure.
+	[[nodiscard]] std::chrono::nanoseconds process_cpu_time() noexcept;
+	
+	// The most memory the process has had resident at once so far, in bytes. 0 on failure.
+	[[nodiscard]] u64 peak_working_set() noexcept;
+	
+	
+	// Address space, for memory that grows in place. Reserving costs no memory, only committing does, and committed pages are only backed once touched.
+	
+	// Returns null on failure. Nothing in the range can be touched until committed.
+	[[nodiscard]] void* reserve_address_space(std::size_t byte_count) noexcept;
+	
+	// Makes the first byte_count bytes of a reserved range usable, zeroed. Pages already committed are left as they are.
+	[[nodiscard]] bool commit_address_space(void* base, std::size_t byte_count) noexcept;
+	
+	// Frees a whole range reserve_address_space returned, committed or not.
+	void release_address_space(void* base) noexcept;
+	
+	
+	// A whole file mapped into memory read-only. Its pages stay backed by the file, so they cost no commit and the OS can drop them at will, which makes mapping files bigger than RAM fine.
+	class file_mapping {
+	public:
+		file_mapping(file_mapping&& rhs) noexcept;
+		file_mapping& operator=(file_mapping&& rhs) noexcept;
+		~file_mapping() noexcept;
+		file_mapping(const file_mapping&) = delete;
+		file_mapping& operator=(const file_mapping&) = delete;
+		
+		// Fails for empty files, which can't be mapped.
+		[[nodiscard]] static std::optional<file_mapping> open_read_only(const std::filesystem::path& file_path) noexcept;
+		
+		[[nodiscard]] const unsigned char* data() const noexcept { return view; }
+		[[nodiscard]] std::size_t size() const noexcept { return length; }
+		
+		// Asks the OS to start reading [offset, offset + byte_count) in, ahead of it being touched. Only a hint, so failure is ignored.
+		void prefetch(std::size_t offset, std::size_t byte_count) const noexcept;
+		
+	private:
+		explicit file_mapping() noexcept = default;
+		
+		void release() noexcept;
+		
+		void* file_handle{ nullptr };		// HANDLE, kept opaque so windows headers stay out of here.
+		void* mapping_handle{ nullptr };	// HANDLE
+		unsigned char* view{ nullptr };
+		std::size_t length{ 0 };
+	};
 
 }